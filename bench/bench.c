@@ -0,0 +1,173 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Emulation core benchmark. Runs the cycle-exact CPU + PPU loop single-threaded with no output consumers and reports
+// throughput and time per emulated CPU cycle.
+//
+// Usage: nes_bench [rom] [--frames N] [--movie FILE] [--parallel-ppu] [--generic-core] [--perf]
+// Without a ROM, a built-in NROM program is used that loops over the implemented instructions with rendering on.
+// With a movie, its input is played back and the run ends with the movie (or after N frames, whichever is first).
+// With --parallel-ppu, frames are drawn on a second thread (see ppu_render.h) and the time includes drawing the last.
+// With --generic-core, the core that reaches the cartridge through function pointers runs instead of the one
+// specialized for its mapper (see cartridge/mappers.h), to measure what the specialization gains.
+// With --perf, hardware performance counters (see perf_counters.h) are read around the frame loop and reported per
+// frame and per emulated CPU cycle; where the kernel doesn't allow them the benchmark runs without.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "ppu_render.h"
+#include "load.h"
+#include "emu.h"
+#include "clock.h"
+#include "io.h"
+#include "movie.h"
+#include "perf_counters.h"
+#include "exit_codes.h"
+
+
+#define DEFAULT_FRAMES 600
+
+static const uint8_t bench_program[] = {
+    0xA2, 0x1E,        //       LDX #$1E
+    0x8E, 0x01, 0x20,  //       STX $2001     ; background + sprites on
+    0x18,              // loop: CLC
+    0xA9, 0x11,        //       LDA #$11
+    0x69, 0x22,        //       ADC #$22
+    0xAA,              //       TAX
+    0x8E, 0x00, 0x03,  //       STX $0300
+    0xE8,              //       INX
+    0xCA,              //       DEX
+    0xA8,              //       TAY
+    0xC8,              //       INY
+    0x88,              //       DEY
+    0x2C, 0x02, 0x20,  //       BIT $2002
+    0x18,              //       CLC
+    0x90, 0xEC,        //       BCC loop
+};
+
+static struct nes_file bench_rom()
+{
+    struct nes_file file = {
+        .mapper_idx = 0,
+        .prg_size = 1,
+        .chr_size = 1,
+        .prg_rom = calloc(get_prg_size_bytes(1), sizeof(uint8_t)),
+        .chr_rom = calloc(get_chr_size_bytes(1), sizeof(uint8_t)),
+    };
+    memcpy(file.prg_rom, bench_program, sizeof(bench_program));
+    // Reset vector -> 0x8000
+    file.prg_rom[0x3FFC] = 0x00;
+    file.prg_rom[0x3FFD] = 0x80;
+    for (size_t i = 0; i < get_chr_size_bytes(1); ++i)
+    {
+        file.chr_rom[i] = (uint8_t) (i * 37);
+    }
+    return file;
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* rom_file = NULL;
+    uint64_t frames = DEFAULT_FRAMES;
+    const char* movie_file = NULL;
+    bool parallel_ppu = false;
+    bool generic_core = false;
+    bool perf = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--movie") == 0 && i + 1 < argc)
+            movie_file = argv[++i];
+        else if (strcmp(argv[i], "--parallel-ppu") == 0)
+            parallel_ppu = true;
+        else if (strcmp(argv[i], "--generic-core") == 0)
+            generic_core = true;
+        else if (strcmp(argv[i], "--perf") == 0)
+            perf = true;
+        else
+            rom_file = argv[i];
+    }
+
+    struct nes_file nes_file = rom_file != NULL ? open_file(rom_file) : bench_rom();
+    load_file(&nes_file);
+    if (generic_core)
+        emu_select_core(EMU_GENERIC_CORE);
+    cpu_reset();
+
+    struct movie movie = { 0 };
+    if (movie_file != NULL)
+    {
+        movie_load(&movie, movie_file);
+        if (movie.rom_crc32 != nes_file_crc32(&nes_file) || movie.start_state != NULL)
+        {
+            fprintf(stderr, "Movie does not start from power-on with this ROM: %s", movie_file);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+        io_input_source = movie_playback_source(&movie);
+    }
+
+    if (parallel_ppu)
+        ppu_render_start();
+
+    struct perf_counters counters;
+    struct perf_counts counts = { 0 };
+    bool counting = perf && perf_counters_open(&counters);
+
+    uint64_t start_ns = clock_now_ns();
+    uint64_t start_cycles = clock_cpu_cycles;
+    if (counting)
+        perf_counters_start(&counters);
+    uint64_t frame = 0;
+    for (; frame < frames && io_poll_input(); ++frame)
+    {
+        if (!emu_run_frame())
+            break;
+    }
+    if (counting)
+        perf_counters_stop(&counters, &counts);
+    ppu_render_flush();
+    if (cpu_halted)
+    {
+        fprintf(stderr, "Unimplemented opcode encountered: %02X at $%04X after %llu frames\n", cpu_ir,
+                (uint16_t) (cpu_registers.pc - 1), (unsigned long long) frame);
+        exit(ERROR_CODE__UNIMPLEMENTED);
+    }
+    frames = frame;
+    uint64_t elapsed_ns = clock_now_ns() - start_ns;
+    uint64_t cycles = clock_cpu_cycles - start_cycles;
+
+#ifdef RESUMABLE_COMPUTED_GOTO
+    const char* dispatch = "computed goto";
+#else
+    const char* dispatch = "switch";
+#endif
+    printf("dispatch:         %s\n", dispatch);
+    printf("core:             %s\n", emu_core_name);
+    printf("rendering:        %s\n", parallel_ppu ? "parallel" : "inline");
+    printf("frames:           %llu\n", (unsigned long long) frames);
+    printf("cpu cycles:       %llu\n", (unsigned long long) cycles);
+    printf("time:             %.3f s\n", elapsed_ns / 1e9);
+    printf("frames/s:         %.1f\n", frames / (elapsed_ns / 1e9));
+    printf("ns per cpu cycle: %.2f (incl. 3 ppu dots)\n", (double) elapsed_ns / cycles);
+    if (counting)
+    {
+        printf("perf counters%s:\n", parallel_ppu ? " (emulation thread only)" : "");
+        perf_counts_print(stdout, &counts, frames, cycles, "  ");
+        perf_counters_close(&counters);
+    }
+    else if (perf)
+    {
+        printf("perf counters:    unavailable, %s\n", perf_counters_error(&counters));
+    }
+
+    ppu_render_stop();
+    movie_free(&movie);
+    nes_file_free(&nes_file);
+    return 0;
+}
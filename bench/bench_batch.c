@@ -0,0 +1,248 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Batched CPU benchmark. Runs the same program on CPU_BATCH_LANES lanes of the batched core and on the scalar
+// cycle-stepped core, and compares aggregate CPU cycles per second. CPU only: no PPU, APU or DMA.
+//
+// Usage: nes_bench_batch [--cycles N] [--divergent] [--perf]
+// Every lane gets a different seed in RAM. The default program's control flow doesn't depend on it; with --divergent
+// a data-dependent branch makes the lanes split up and rejoin every iteration.
+// Afterwards every lane is checked against the scalar core run on its seed for the same number of cycles: RAM,
+// registers, and that both cores are at the same instruction boundary.
+// With --perf, hardware performance counters (see perf_counters.h) are read around each run and reported per emulated
+// CPU cycle, of all lanes for the batched run; where the kernel doesn't allow them the benchmark runs without.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "cpu/cpu.h"
+#include "cpu/cpu_batch.h"
+#include "load.h"
+#include "clock.h"
+#include "perf_counters.h"
+
+
+#define DEFAULT_CYCLES 20000000
+#define SEED_ADDR 0x10
+
+static const uint8_t uniform_program[] = {
+    0xA2, 0x00,        //       LDX #$00
+    0x18,              // loop: CLC
+    0xA5, 0x10,        //       LDA $10
+    0x69, 0x03,        //       ADC #$03
+    0xAA,              //       TAX
+    0x86, 0x10,        //       STX $10
+    0xAE, 0x00, 0x02,  //       LDX $0200
+    0xE8,              //       INX
+    0x8E, 0x00, 0x02,  //       STX $0200
+    0xBD, 0xF0, 0x01,  //       LDA $01F0,X   ; crosses into $0200 once the counter reaches $10
+    0x24, 0x10,        //       BIT $10
+    0xA8,              //       TAY
+    0xC8,              //       INY
+    0x88,              //       DEY
+    0x18,              //       CLC
+    0x90, 0xE6,        //       BCC loop
+};
+
+static const uint8_t divergent_program[] = {
+    0xA2, 0x00,        //       LDX #$00
+    0x18,              // loop: CLC
+    0xA5, 0x10,        //       LDA $10
+    0x69, 0x03,        //       ADC #$03
+    0xAA,              //       TAX
+    0x86, 0x10,        //       STX $10
+    0xAE, 0x00, 0x02,  //       LDX $0200
+    0xE8,              //       INX
+    0x8E, 0x00, 0x02,  //       STX $0200
+    0xBD, 0xF0, 0x01,  //       LDA $01F0,X   ; crosses into $0200 once the counter reaches $10
+    0x24, 0x10,        //       BIT $10
+    0x30, 0x01,        //       BMI skip      ; depends on each lane's seed
+    0xC8,              //       INY
+    0xA8,              // skip: TAY
+    0x88,              //       DEY
+    0x18,              //       CLC
+    0x90, 0xE4,        //       BCC loop
+};
+
+static uint8_t lane_seed(unsigned lane)
+{
+    return (uint8_t) (lane * 0x1D);
+}
+
+/// Set by note_fetch when the scalar CPU fetches an opcode
+static bool fetched;
+static uint16_t fetched_addr;
+
+static void note_fetch(uint8_t trap, uint16_t addr, uint8_t value)
+{
+    fetched = true;
+    fetched_addr = addr;
+}
+
+/// Scalar CPU right after reset, to start each reference run from
+static struct cpu_registers reset_registers;
+static struct cpu_context reset_context;
+static uint8_t reset_ram[RAM_SIZE];
+
+/**
+ * Runs the scalar CPU from reset on the lane's RAM seed for as many cycles as the lane ran, and checks that it ends up
+ * where the lane did: with the same RAM and registers, and starting the lane's next instruction on the very next cycle,
+ * which fails if the two cores counted any instruction's cycles differently.
+ */
+static bool lane_matches_scalar(const struct cpu_batch* batch, unsigned lane)
+{
+    cpu_registers = reset_registers;
+    cpu_context = reset_context;
+    memcpy(ram, reset_ram, RAM_SIZE);
+    ram[SEED_ADDR] = lane_seed(lane);
+    cpu_halted = false;
+    for (uint64_t i = 0; i < batch->cycles[lane]; ++i)
+    {
+        cpu_cycle();
+    }
+
+    bool match = true;
+    for (size_t addr = 0; addr < RAM_SIZE; ++addr)
+    {
+        match &= batch->ram[addr][lane] == ram[addr];
+    }
+
+    // The cycle after the lane's last instruction has to be an opcode fetch, which also finishes that instruction
+    for (size_t page = 0; page < CPU_NUM_PAGES; ++page)
+    {
+        cpu_page_traps[page] = CPU_TRAP_FETCH;
+    }
+    cpu_trap_handler = note_fetch;
+    cpu_apply_page_traps();
+    fetched = false;
+    cpu_cycle();
+    memset(cpu_page_traps, 0, sizeof(cpu_page_traps));
+    cpu_apply_page_traps();
+
+    return match && fetched && fetched_addr == batch->pc[lane] &&
+           cpu_registers.sp == batch->sp[lane] &&
+           cpu_registers.acc == batch->acc[lane] &&
+           cpu_registers.idx_x == batch->idx_x[lane] &&
+           cpu_registers.idx_y == batch->idx_y[lane] &&
+           cpu_get_status() == cpu_batch_get_status(batch, lane);
+}
+
+static struct nes_file bench_rom(const uint8_t* program, size_t size)
+{
+    struct nes_file file = {
+        .mapper_idx = 0,
+        .prg_size = 1,
+        .chr_size = 1,
+        .prg_rom = calloc(get_prg_size_bytes(1), sizeof(uint8_t)),
+        .chr_rom = calloc(get_chr_size_bytes(1), sizeof(uint8_t)),
+    };
+    memcpy(file.prg_rom, program, size);
+    // Reset vector -> 0x8000
+    file.prg_rom[0x3FFC] = 0x00;
+    file.prg_rom[0x3FFD] = 0x80;
+    return file;
+}
+
+
+int main(int argc, char** argv)
+{
+    uint64_t cycles = DEFAULT_CYCLES;
+    bool divergent = false;
+    bool perf = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--divergent") == 0)
+            divergent = true;
+        else if (strcmp(argv[i], "--perf") == 0)
+            perf = true;
+    }
+
+    struct nes_file nes_file = divergent ? bench_rom(divergent_program, sizeof(divergent_program))
+                                         : bench_rom(uniform_program, sizeof(uniform_program));
+    load_file(&nes_file);
+    cpu_reset();
+    reset_registers = cpu_registers;
+    reset_context = cpu_context;
+    memcpy(reset_ram, ram, RAM_SIZE);
+
+    static struct cpu_batch batch;
+    cpu_batch_init(&batch);
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        batch.ram[SEED_ADDR][lane] = lane_seed(lane);
+    }
+
+    struct perf_counters counters;
+    struct perf_counts batch_counts = { 0 };
+    struct perf_counts scalar_counts = { 0 };
+    bool counting = perf && perf_counters_open(&counters);
+
+    uint64_t start_ns = clock_now_ns();
+    if (counting)
+        perf_counters_start(&counters);
+    uint64_t halted = cpu_batch_run(&batch, cycles);
+    if (counting)
+        perf_counters_stop(&counters, &batch_counts);
+    uint64_t batch_ns = clock_now_ns() - start_ns;
+
+    // Scalar reference: lane 0's seed, for exactly as many cycles as lane 0 ran
+    ram[SEED_ADDR] = lane_seed(0);
+    start_ns = clock_now_ns();
+    if (counting)
+        perf_counters_start(&counters);
+    for (uint64_t i = 0; i < batch.cycles[0]; ++i)
+    {
+        cpu_cycle();
+    }
+    if (counting)
+        perf_counters_stop(&counters, &scalar_counts);
+    uint64_t scalar_ns = clock_now_ns() - start_ns;
+
+    uint64_t mismatched = 0;
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        if (!lane_matches_scalar(&batch, lane))
+            mismatched |= (uint64_t) 1 << lane;
+    }
+
+    uint64_t batch_cycles = 0;
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        batch_cycles += batch.cycles[lane];
+    }
+    double batch_rate = batch_cycles / (batch_ns / 1e9);
+    double scalar_rate = batch.cycles[0] / (scalar_ns / 1e9);
+
+    printf("lanes:                 %d\n", CPU_BATCH_LANES);
+    printf("program:               %s\n", divergent ? "divergent" : "uniform");
+    printf("vector / scalar steps: %llu / %llu\n",
+           (unsigned long long) batch.vector_steps, (unsigned long long) batch.scalar_steps);
+    printf("batched:               %.1f M cpu cycles/s aggregate\n", batch_rate / 1e6);
+    printf("scalar core:           %.1f M cpu cycles/s\n", scalar_rate / 1e6);
+    printf("speedup:               %.2fx\n", batch_rate / scalar_rate);
+    if (mismatched == 0)
+        printf("lanes match scalar:    yes\n");
+    else
+        printf("lanes match scalar:    NO, lanes %llx differ\n", (unsigned long long) mismatched);
+    if (halted != 0)
+        printf("halted lanes:          %llx\n", (unsigned long long) halted);
+    if (counting)
+    {
+        printf("perf counters, batched:\n");
+        perf_counts_print(stdout, &batch_counts, 0, batch_cycles, "  ");
+        printf("perf counters, scalar core:\n");
+        perf_counts_print(stdout, &scalar_counts, 0, batch.cycles[0], "  ");
+        perf_counters_close(&counters);
+    }
+    else if (perf)
+    {
+        printf("perf counters:         unavailable, %s\n", perf_counters_error(&counters));
+    }
+
+    nes_file_free(&nes_file);
+    return mismatched == 0 && halted == 0 ? 0 : 1;
+}
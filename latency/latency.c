@@ -0,0 +1,505 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Input latency measurement. Plays a movie and, for every frame whose input differs from the frame before, finds the
+// first frame that responds to it, then reports histograms of the latencies over the whole movie.
+//
+// Usage: nes_latency ROM MOVIE [--max-frames N] [--watch ADDR[-ADDR]] [--bin-us N] [--host]
+//
+// Emulation is deterministic, so the response is found by experiment rather than guessed from what changes on screen
+// (which, with animation, is most frames): from a save state taken before the frame, the movie is run again with
+// that input change arriving one frame later, and the first frame whose picture rows differ between the two runs is
+// the one that shows the response. With --watch, the CPU RAM at the end of each frame is compared instead, over the
+// given (hex) address range, e.g. the player's position. Changes with no response within --max-frames frames, such as
+// a button the game ignores at that point, are counted separately.
+//
+// For each response it reports:
+//   - frames from the frame that polled the input to the one showing the response (0: the same frame);
+//   - emulated microseconds from the controller read that gave the game the new buttons to the scan-out of the first
+//     picture row that differs (or, with --watch, to the end of the frame), as a console on a zero-lag display would
+//     show it.
+// With --host, the movie is then played again through the emulation thread and a presentation loop like
+// nes_emulator's, and it also reports host microseconds from the input poll to the presentation of a frame that shows
+// the response, which covers the thread handoffs. Emulation runs uncapped, so these measure the pipeline, not pacing.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "load.h"
+#include "emu.h"
+#include "clock.h"
+#include "io.h"
+#include "movie.h"
+#include "state.h"
+#include "triple_buffer.h"
+#include "exit_codes.h"
+
+
+#define DEFAULT_MAX_FRAMES 30
+#define DEFAULT_BIN_US 2000
+
+/// NTSC CPU clock: 236.25 MHz / 11 / 12
+#define CPU_CYCLES_PER_US (236.25 / 11 / 12)
+#define PPU_DOTS_PER_SCANLINE 341
+#define PPU_DOTS_PER_CPU_CYCLE 3
+/// Frames end at dot 1 of scanline 241, when vertical blanking starts
+#define FRAME_END_SCANLINE 241
+
+#define HISTOGRAM_BAR_WIDTH 50
+
+/// An input change waiting for its response
+struct latency_event
+{
+    uint64_t frame;                              /// ppu_frame_count of the frame that polled the change
+    uint8_t buttons[IO_NUM_CONTROLLERS];         /// The new buttons
+    uint8_t changed[IO_NUM_CONTROLLERS];         /// Bits that changed
+    uint64_t read_cycle;                         /// Read that gave the game the change, 0 until it happens
+    uint64_t* signatures;                        /// Per frame of the run with the change delayed, see signature()
+};
+
+/// A measured response
+struct latency_result
+{
+    uint64_t frame;
+    uint64_t response_frame;
+    double emulated_us;
+};
+
+static size_t max_frames = DEFAULT_MAX_FRAMES;
+static bool watch_ram = false;
+static uint16_t watch_first;
+static uint16_t watch_last;
+
+/// Words of signature per frame: the row hashes of the picture, or the watched RAM, one byte per word
+static size_t signature_size;
+
+/// Bits read from each controller since the strobe fell, as io_trace_hook reports them
+static uint8_t read_bits[IO_NUM_CONTROLLERS];
+static uint8_t read_count[IO_NUM_CONTROLLERS];
+
+/// Controller bytes the game read in full during the frame being run
+#define MAX_READS_PER_FRAME 64
+static struct
+{
+    uint8_t port;
+    uint8_t buttons;
+    uint64_t cycle;
+} frame_reads[MAX_READS_PER_FRAME];
+static size_t num_frame_reads;
+
+/// Frame timestamps of the --host run, by frame number
+static uint64_t* poll_ns;
+static uint64_t* present_ns;
+
+
+static void trace_controller(enum io_trace_event event, uint8_t port, uint8_t value)
+{
+    if (event == IO_TRACE_STROBE)
+    {
+        // Reading starts over with button A once the strobe falls
+        for (size_t i = 0; i < IO_NUM_CONTROLLERS; ++i)
+        {
+            read_bits[i] = 0;
+            read_count[i] = 0;
+        }
+        return;
+    }
+    if (read_count[port] >= 8)
+        return;
+    read_bits[port] |= (value & 1) << read_count[port];
+    if (++read_count[port] == 8 && num_frame_reads < MAX_READS_PER_FRAME)
+    {
+        frame_reads[num_frame_reads].port = port;
+        frame_reads[num_frame_reads].buttons = read_bits[port];
+        frame_reads[num_frame_reads].cycle = clock_cpu_cycles;
+        num_frame_reads++;
+    }
+}
+
+
+/**
+ * What a response is looked for in, after a frame: the row hashes of the picture, or the watched RAM.
+ */
+static void signature(uint64_t* out)
+{
+    if (!watch_ram)
+    {
+        memcpy(out, ppu_row_hashes, FRAME_HEIGHT * sizeof(uint64_t));
+        return;
+    }
+    for (size_t i = 0; i < signature_size; ++i)
+    {
+        out[i] = ram[(watch_first + i) & (RAM_SIZE - 1)];
+    }
+}
+
+
+/**
+ * Runs one frame with the given buttons.
+ */
+static void run_frame(const uint8_t buttons[IO_NUM_CONTROLLERS])
+{
+    memcpy(io_buttons, buttons, IO_NUM_CONTROLLERS);
+    num_frame_reads = 0;
+    if (!emu_run_frame())
+    {
+        fprintf(stderr, "Emulation stopped at frame %llu", (unsigned long long) ppu_frame_count);
+        exit(ERROR_CODE__OH_NO);
+    }
+}
+
+
+/**
+ * Emulated time at which the response is seen: when the PPU outputs the first differing picture row, or at the end of
+ * the frame for a RAM watch. The frame just ended, at dot 1 of scanline 241.
+ */
+static uint64_t response_cycle(const uint64_t* real, const uint64_t* delayed)
+{
+    if (watch_ram)
+        return clock_cpu_cycles;
+    size_t row = 0;
+    while (real[row] == delayed[row])
+    {
+        row++;
+    }
+    return clock_cpu_cycles - (FRAME_END_SCANLINE - row) * PPU_DOTS_PER_SCANLINE / PPU_DOTS_PER_CPU_CYCLE;
+}
+
+
+/**
+ * Plays the movie once, running each input change a second time delayed by a frame to find its response.
+ *
+ * @return Number of input changes; the responses found are in results
+ */
+static size_t measure(const struct movie* movie, struct latency_result* results, size_t* num_results)
+{
+    size_t state_bytes = state_size();
+    uint8_t* before = malloc(state_bytes);
+    // At most one event starts per frame, and each lives for max_frames frames
+    struct latency_event* events = calloc(max_frames, sizeof(struct latency_event));
+    uint64_t* signatures = malloc(max_frames * max_frames * signature_size * sizeof(uint64_t));
+    uint64_t* real = malloc(signature_size * sizeof(uint64_t));
+    if (before == NULL || events == NULL || signatures == NULL || real == NULL)
+    {
+        fprintf(stderr, "Out of memory for latency measurement");
+        exit(ERROR_CODE__OH_NO);
+    }
+    for (size_t i = 0; i < max_frames; ++i)
+    {
+        events[i].signatures = signatures + i * max_frames * signature_size;
+    }
+
+    size_t num_changes = 0;
+    size_t num_pending = 0;
+    *num_results = 0;
+    static const uint8_t no_buttons[IO_NUM_CONTROLLERS] = { 0 };
+    for (size_t index = 0; index < movie->num_frames; ++index)
+    {
+        const uint8_t* buttons = movie->frames[index];
+        const uint8_t* previous = index == 0 ? no_buttons : movie->frames[index - 1];
+        if (memcmp(buttons, previous, IO_NUM_CONTROLLERS) != 0)
+        {
+            // The slot of the event that started max_frames ago, which has just been given up on
+            struct latency_event* event = &events[num_changes % max_frames];
+            event->frame = ppu_frame_count + 1;
+            event->read_cycle = 0;
+            for (size_t port = 0; port < IO_NUM_CONTROLLERS; ++port)
+            {
+                event->buttons[port] = buttons[port];
+                event->changed[port] = buttons[port] ^ previous[port];
+            }
+
+            // The delayed run starts from the same state, controller reads in progress included
+            uint8_t bits[IO_NUM_CONTROLLERS];
+            uint8_t count[IO_NUM_CONTROLLERS];
+            memcpy(bits, read_bits, sizeof(bits));
+            memcpy(count, read_count, sizeof(count));
+            state_save(before, state_bytes);
+            for (size_t k = 0; k < max_frames && index + k < movie->num_frames; ++k)
+            {
+                run_frame(k == 0 ? previous : movie->frames[index + k]);
+                signature(event->signatures + k * signature_size);
+            }
+            state_load(before, state_bytes);
+            memcpy(read_bits, bits, sizeof(bits));
+            memcpy(read_count, count, sizeof(count));
+            num_changes++;
+            num_pending = num_pending < max_frames ? num_pending + 1 : max_frames;
+        }
+
+        run_frame(buttons);
+        signature(real);
+        for (size_t i = 0; i < num_pending; ++i)
+        {
+            struct latency_event* event = &events[(num_changes - 1 - i) % max_frames];
+            if (event->frame == 0)
+                continue;  // responded already
+            for (size_t r = 0; r < num_frame_reads && event->read_cycle == 0; ++r)
+            {
+                uint8_t port = frame_reads[r].port;
+                if (event->changed[port] != 0 && ((frame_reads[r].buttons ^ event->buttons[port]) &
+                                                  event->changed[port]) == 0)
+                    event->read_cycle = frame_reads[r].cycle;
+            }
+
+            uint64_t k = ppu_frame_count - event->frame;
+            const uint64_t* delayed = event->signatures + k * signature_size;
+            if (k < max_frames && memcmp(real, delayed, signature_size * sizeof(uint64_t)) != 0)
+            {
+                struct latency_result* result = &results[(*num_results)++];
+                result->frame = event->frame;
+                result->response_frame = ppu_frame_count;
+                // -1 if no full controller read gave the game the change, e.g. it only looks at bit 0 while strobing
+                result->emulated_us = -1;
+                if (event->read_cycle != 0)
+                {
+                    double cycles = (double) response_cycle(real, delayed) - (double) event->read_cycle;
+                    result->emulated_us = (cycles > 0 ? cycles : 0) / CPU_CYCLES_PER_US;
+                }
+                event->frame = 0;
+            }
+        }
+    }
+
+    free(real);
+    free(signatures);
+    free(events);
+    free(before);
+    return num_changes;
+}
+
+
+static void record_poll()
+{
+    poll_ns[ppu_frame_count] = io_input_poll_timestamp;
+}
+
+
+/**
+ * Plays the movie again through the emulation thread, presenting frames on this one, and notes when each frame's
+ * input was polled and when it was presented.
+ */
+static void measure_host(struct movie* movie, const void* start, size_t start_size)
+{
+    poll_ns = calloc(ppu_frame_count + movie->num_frames + 2, sizeof(uint64_t));
+    present_ns = calloc(ppu_frame_count + movie->num_frames + 2, sizeof(uint64_t));
+    if (poll_ns == NULL || present_ns == NULL)
+    {
+        fprintf(stderr, "Out of memory for latency measurement");
+        exit(ERROR_CODE__OH_NO);
+    }
+
+    state_load(start, start_size);
+    io_trace_hook = NULL;
+    io_input_source = movie_playback_source(movie);
+    emu_frame_hook = record_poll;
+
+    static struct triple_buffer output;
+    triple_buffer_init(&output);
+    emu_add_output(&output);
+    emu_start(0);
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = 100000 };
+    while (emu_running())
+    {
+        const struct frame* frame = triple_buffer_acquire(&output);
+        if (frame == NULL)
+        {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        present_ns[frame->frame_number] = clock_now_ns();
+    }
+    emu_join();
+}
+
+
+static int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return (x > y) - (x < y);
+}
+
+
+/**
+ * Number of the sorted values from *i on that are below limit; advances *i past them.
+ */
+static size_t count_below(const double* values, size_t count, size_t* i, double limit)
+{
+    size_t start = *i;
+    while (*i < count && values[*i] < limit)
+    {
+        (*i)++;
+    }
+    return *i - start;
+}
+
+
+/**
+ * Prints the distribution of values (sorted in place, none negative), in bins of bin_width, with a bar for each.
+ */
+static void print_histogram(const char* title, const char* unit, double* values, size_t count, double bin_width,
+                            int precision)
+{
+    printf("\n%s\n", title);
+    if (count == 0)
+    {
+        printf("  none\n");
+        return;
+    }
+    qsort(values, count, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (size_t i = 0; i < count; ++i)
+    {
+        sum += values[i];
+    }
+    printf("  min %.*f  median %.*f  p95 %.*f  max %.*f  avg %.*f %s\n", precision, values[0], precision,
+           values[count / 2], precision, values[count * 95 / 100], precision, values[count - 1], precision,
+           sum / count, unit);
+
+    size_t first_bin = (size_t) (values[0] / bin_width);
+    size_t last_bin = (size_t) (values[count - 1] / bin_width);
+    size_t most = 0;
+    for (size_t bin = first_bin, i = 0; bin <= last_bin; ++bin)
+    {
+        size_t in_bin = count_below(values, count, &i, (bin + 1) * bin_width);
+        most = in_bin > most ? in_bin : most;
+    }
+    for (size_t bin = first_bin, i = 0; bin <= last_bin; ++bin)
+    {
+        size_t in_bin = count_below(values, count, &i, (bin + 1) * bin_width);
+        if (bin_width == 1)
+            printf("  %8zu %s %6zu ", bin, unit, in_bin);
+        else
+            printf("  %8.0f-%-8.0f %s %6zu ", bin * bin_width, (bin + 1) * bin_width, unit, in_bin);
+        for (size_t j = 0; j < (in_bin * HISTOGRAM_BAR_WIDTH + most - 1) / most; ++j)
+        {
+            putchar('#');
+        }
+        putchar('\n');
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* rom_file = NULL;
+    const char* movie_file = NULL;
+    double bin_us = DEFAULT_BIN_US;
+    bool host = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc)
+            max_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--bin-us") == 0 && i + 1 < argc)
+            bin_us = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--host") == 0)
+            host = true;
+        else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc)
+        {
+            char* end;
+            watch_first = (uint16_t) strtoul(argv[++i], &end, 16);
+            watch_last = *end == '-' ? (uint16_t) strtoul(end + 1, NULL, 16) : watch_first;
+            watch_ram = true;
+        }
+        else if (rom_file == NULL)
+            rom_file = argv[i];
+        else
+            movie_file = argv[i];
+    }
+    if (movie_file == NULL || max_frames == 0 || bin_us <= 0 ||
+        (watch_ram && (watch_last < watch_first || watch_last >= RAM_SIZE)))
+    {
+        fprintf(stderr, "Usage: nes_latency ROM MOVIE [--max-frames N] [--watch ADDR[-ADDR]] [--bin-us N] [--host]\n");
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    signature_size = watch_ram ? (size_t) (watch_last - watch_first + 1) : FRAME_HEIGHT;
+
+    struct nes_file nes_file = open_file(rom_file);
+    load_file(&nes_file);
+    cpu_reset();
+
+    struct movie movie;
+    movie_load(&movie, movie_file);
+    if (movie.rom_crc32 != nes_file_crc32(&nes_file))
+    {
+        fprintf(stderr, "Movie was recorded on a different ROM (CRC-32 %08X)", movie.rom_crc32);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    if (movie.start_state != NULL && !state_load(movie.start_state, movie.start_state_size))
+    {
+        fprintf(stderr, "Movie start state is not from this build of the emulator: %s", movie_file);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    size_t start_size = state_size();
+    uint8_t* start = malloc(start_size);
+    struct latency_result* results = malloc((movie.num_frames + 1) * sizeof(struct latency_result));
+    double* values = malloc((movie.num_frames + 1) * sizeof(double));
+    if (start == NULL || results == NULL || values == NULL)
+    {
+        fprintf(stderr, "Out of memory for latency measurement");
+        exit(ERROR_CODE__OH_NO);
+    }
+    state_save(start, start_size);
+
+    io_trace_hook = trace_controller;
+    uint64_t start_ns = clock_now_ns();
+    size_t num_results;
+    size_t num_changes = measure(&movie, results, &num_results);
+    printf("%zu frames, %zu input changes: %zu with a response within %zu frames, %zu without (%.3f s)\n",
+           movie.num_frames, num_changes, num_results, max_frames, num_changes - num_results,
+           (clock_now_ns() - start_ns) / 1e9);
+    printf("response: first %s that differs from a run with the change a frame later\n",
+           watch_ram ? "watched RAM" : "picture row");
+
+    for (size_t i = 0; i < num_results; ++i)
+    {
+        values[i] = (double) (results[i].response_frame - results[i].frame);
+    }
+    print_histogram("Input poll to response, frames", "frames", values, num_results, 1, 0);
+
+    size_t num_values = 0;
+    for (size_t i = 0; i < num_results; ++i)
+    {
+        if (results[i].emulated_us >= 0)
+            values[num_values++] = results[i].emulated_us;
+    }
+    print_histogram(watch_ram ? "Controller read to end of responding frame, emulated us" :
+                    "Controller read to scan-out of the first responding row, emulated us", "us", values, num_values,
+                    bin_us, 0);
+    if (num_values != num_results)
+        printf("  %zu responses came without a controller read of the change\n", num_results - num_values);
+
+    if (host)
+    {
+        measure_host(&movie, start, start_size);
+        uint64_t last_frame = ppu_frame_count;
+        num_values = 0;
+        for (size_t i = 0; i < num_results; ++i)
+        {
+            // The first frame presented from the response on; the triple buffer drops the frames it passes over
+            uint64_t frame = results[i].response_frame;
+            while (frame <= last_frame && present_ns[frame] == 0)
+            {
+                frame++;
+            }
+            if (frame <= last_frame && poll_ns[results[i].frame] != 0)
+                values[num_values++] = (present_ns[frame] - poll_ns[results[i].frame]) / 1e3;
+        }
+        print_histogram("Input poll to presentation of the response, host us", "us", values, num_values, bin_us, 0);
+        free(present_ns);
+        free(poll_ns);
+    }
+
+    free(values);
+    free(results);
+    free(start);
+    movie_free(&movie);
+    nes_file_free(&nes_file);
+    return 0;
+}
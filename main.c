@@ -1,36 +1,466 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "cpu/cpu.h"
 #include "ppu.h"
+#include "ppu_render.h"
 #include "load.h"
+#include "emu.h"
+#include "screen.h"
+#include "clock.h"
+#include "io.h"
+#include "movie.h"
+#include "state.h"
+#include "debug.h"
+#include "boot_cache.h"
+#include "battery.h"
+#include "telemetry.h"
+#include "exit_codes.h"
+#include "utils.h"
 
 
-const size_t ppu_cycles_per_cpu_cycle = 3;
+/// Frames a game boots for before a --boot-cache entry is taken: three seconds
+#define DEFAULT_BOOT_FRAMES 180
 
+#define SAVE_PATH_SIZE 4096
 
-int main() {
+
+static struct triple_buffer screen_output;
+/// The presented picture: the frame cropped and scaled (--crop, --scale), screen_scale_width() pixels per row
+static uint32_t* screen_rgb;
+static struct screen_scale screen_scale_config = { .factor = 1, .filter = SCREEN_SCALE_NEAREST };
+/// Row hashes of the frame in screen_rgb
+static uint64_t screen_row_hashes[FRAME_HEIGHT];
+
+static FILE* ram_trace = NULL;
+
+/// Shared-memory export, for analysis processes (--shm)
+static struct shm_export shm_output;
+
+/// Recording for external encoders (--dump)
+static struct video_dump dump_output;
+
+/// Where --telemetry writes the trace at exit
+static const char* telemetry_file = NULL;
+
+static struct movie movie;
+static uint64_t random_input_state = 0;
+
+
+/**
+ * The save file of a ROM: its path with the extension replaced by .sav.
+ */
+static void default_save_path(const char* rom_file, char* path)
+{
+    snprintf(path, SAVE_PATH_SIZE, "%s", rom_file);
+    char* extension = strrchr(path, '.');
+    if (extension != NULL && strpbrk(extension, "/\\") == NULL)
+        *extension = '\0';
+    size_t length = strlen(path);
+    snprintf(path + length, SAVE_PATH_SIZE - length, ".sav");
+}
+
+
+/**
+ * Appends CPU RAM after every frame. Two runs that differ only in --frameskip must produce identical traces.
+ */
+static void write_ram_trace()
+{
+    fwrite(ram, sizeof(uint8_t), RAM_SIZE, ram_trace);
+}
+
+
+/**
+ * Presses pseudo-random buttons (xorshift64), holding each combination for a few frames. Deterministic for a given
+ * seed, for generating sessions to record.
+ */
+static bool random_input(void* user, uint8_t buttons[IO_NUM_CONTROLLERS])
+{
+    (void) user;
+    static uint8_t held[IO_NUM_CONTROLLERS];
+    random_input_state ^= random_input_state << 13;
+    random_input_state ^= random_input_state >> 7;
+    random_input_state ^= random_input_state << 17;
+    if ((random_input_state & 0x7) == 0)
+    {
+        for (size_t i = 0; i < IO_NUM_CONTROLLERS; ++i)
+        {
+            held[i] = (uint8_t) (random_input_state >> (8 * (i + 1)));
+        }
+    }
+    memcpy(buttons, held, IO_NUM_CONTROLLERS);
+    return true;
+}
+
+
+static void print_hit(const struct debug_hit* hit)
+{
+    const char* access = hit->access == DEBUG_READ ? "read" : hit->access == DEBUG_WRITE ? "write" : "execute";
+    fprintf(stderr, "watch %d: %s $%04X = $%02X, pc $%04X, cycle %llu\n",
+            hit->watch, access, hit->addr, hit->value, hit->pc, (unsigned long long) hit->cycle);
+}
+
+
+/**
+ * Parses a watch as [rwx]+:ADDR[-ADDR][=VALUE], addresses and value in hex, e.g. "w:0300-03FF" or "x:C123".
+ */
+static void add_watch(const char* text, bool stop)
+{
+    const char* spec = text;
+    uint8_t access = 0;
+    for (; *spec != ':' && *spec != '\0'; ++spec)
+    {
+        if (*spec == 'r') access |= DEBUG_READ;
+        else if (*spec == 'w') access |= DEBUG_WRITE;
+        else if (*spec == 'x') access |= DEBUG_EXECUTE;
+        else access = 0xFF;
+    }
+
+    char* end = NULL;
+    unsigned long first = *spec == ':' ? strtoul(spec + 1, &end, 16) : 0;
+    unsigned long last = first;
+    unsigned long value = 0;
+    uint8_t value_mask = 0;
+    if (end != NULL && *end == '-')
+        last = strtoul(end + 1, &end, 16);
+    if (end != NULL && *end == '=')
+    {
+        value = strtoul(end + 1, &end, 16);
+        value_mask = 0xFF;
+    }
+
+    if (access == 0 || access == 0xFF || end == NULL || *end != '\0' || last < first || last > 0xFFFF || value > 0xFF)
+    {
+        fprintf(stderr, "Invalid watch: %s\n", text);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    if (debug_add_watch(first, last, access, value_mask, value, stop) < 0)
+    {
+        fprintf(stderr, "Too many watches\n");
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+}
+
+
+/**
+ * @return Exit code of the process
+ */
+static int finish(struct nes_file* nes_file, const char* record_file)
+{
+    if (cpu_halted)
+    {
+        fprintf(stderr, "Unimplemented opcode encountered: %02X at $%04X\n", cpu_ir,
+                (uint16_t) (cpu_registers.pc - 1));
+    }
+    if (debug_break)
+    {
+        fprintf(stderr, "Stopped at cycle %llu: pc $%04X a $%02X x $%02X y $%02X p $%02X sp $%02X\n",
+                (unsigned long long) clock_cpu_cycles, cpu_registers.pc, cpu_registers.acc, cpu_registers.idx_x,
+                cpu_registers.idx_y, cpu_get_status(), cpu_registers.sp);
+    }
+
+    if (record_file != NULL)
+        movie_save(&movie, record_file);
+    movie_free(&movie);
+
+    if (ram_trace != NULL)
+        fclose(ram_trace);
+    shm_export_close(&shm_output);
+    if (dump_output.video != NULL)
+    {
+        if (!video_dump_close(&dump_output))
+            fprintf(stderr, "Could not write the whole dump\n");
+        fprintf(stderr, "Dumped %llu frames, %llu repeats, emulation waited on the dump %llu times\n",
+                (unsigned long long) dump_output.frames, (unsigned long long) dump_output.repeats,
+                (unsigned long long) dump_output.producer_waits);
+    }
+    battery_close();
+    if (telemetry_file != NULL && !telemetry_write(telemetry_file))
+        fprintf(stderr, "Could not write telemetry file: %s\n", telemetry_file);
+    nes_file_free(nes_file);
+    return cpu_halted ? ERROR_CODE__UNIMPLEMENTED : 0;
+}
+
+
+static void usage()
+{
+    fprintf(stderr, "Usage: nes_emulator [rom] [--frames N] [--frameskip N] [--ram-trace FILE] [--headless]\n"
+                    "                    [--record FILE] [--play FILE] [--random-input SEED] [--parallel-ppu]\n"
+                    "                    [--watch [rwx]:ADDR[-ADDR][=VALUE]] [--break [rwx]:ADDR[-ADDR][=VALUE]]\n"
+                    "                    [--shm NAME] [--shm-rgb] [--boot-cache DIR] [--boot-frames N]\n"
+                    "                    [--telemetry FILE] [--save FILE] [--save-interval MS]\n"
+                    "                    [--dump FILE|-|'|COMMAND'] [--dump-rgb] [--dump-timestamps FILE]\n"
+                    "                    [--dump-audio FILE|-|'|COMMAND'] [--scale 1-6] [--scale-edges]\n"
+                    "                    [--crop TOP,BOTTOM,LEFT,RIGHT]\n");
+    exit(ERROR_CODE__INVALID_FILE);
+}
+
+
+/**
+ * --crop: overscan to cut off each side, e.g. 8,8,0,0 for the lines NTSC TVs hide.
+ */
+static void parse_crop(const char* value, struct screen_scale* scale)
+{
+    unsigned top, bottom, left, right;
+    if (sscanf(value, "%u,%u,%u,%u", &top, &bottom, &left, &right) != 4 || top + bottom >= FRAME_HEIGHT ||
+        left + right >= FRAME_WIDTH)
+        usage();
+    scale->crop_top = (uint8_t) top;
+    scale->crop_bottom = (uint8_t) bottom;
+    scale->crop_left = (uint8_t) left;
+    scale->crop_right = (uint8_t) right;
+}
+
+
+int main(int argc, char** argv) {
     const char* rom_file = "C:\\Users\\quate\\nes-emulator\\rom\\build\\rom.nes";
+    uint64_t max_frames = 0;
+    const char* ram_trace_file = NULL;
+    const char* record_file = NULL;
+    const char* play_file = NULL;
+    bool headless = false;
+    bool parallel_ppu = false;
+    const char* shm_name = NULL;
+    enum shm_export_format shm_format = SHM_EXPORT_INDICES;
+    const char* boot_cache_dir = NULL;
+    uint64_t boot_frames = DEFAULT_BOOT_FRAMES;
+    const char* save_file = NULL;
+    uint64_t save_interval_ms = BATTERY_DEFAULT_FLUSH_INTERVAL_MS;
+    const char* dump_file = NULL;
+    enum video_dump_format dump_format = VIDEO_DUMP_Y4M;
+    const char* dump_timestamps_file = NULL;
+    const char* dump_audio_file = NULL;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--frames") == 0 && has_value)
+            max_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--frameskip") == 0 && has_value)
+            ppu_frame_skip = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--ram-trace") == 0 && has_value)
+            ram_trace_file = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && has_value)
+            record_file = argv[++i];
+        else if (strcmp(argv[i], "--play") == 0 && has_value)
+            play_file = argv[++i];
+        else if (strcmp(argv[i], "--random-input") == 0 && has_value)
+            random_input_state = strtoull(argv[++i], NULL, 10) | 1;  // xorshift state must be nonzero
+        else if (strcmp(argv[i], "--watch") == 0 && has_value)
+            add_watch(argv[++i], false);
+        else if (strcmp(argv[i], "--break") == 0 && has_value)
+            add_watch(argv[++i], true);
+        else if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--parallel-ppu") == 0)
+            parallel_ppu = true;
+        else if (strcmp(argv[i], "--shm") == 0 && has_value)
+            shm_name = argv[++i];
+        else if (strcmp(argv[i], "--shm-rgb") == 0)
+            shm_format = SHM_EXPORT_RGB;
+        else if (strcmp(argv[i], "--boot-cache") == 0 && has_value)
+            boot_cache_dir = argv[++i];
+        else if (strcmp(argv[i], "--boot-frames") == 0 && has_value)
+            boot_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--telemetry") == 0 && has_value)
+            telemetry_file = argv[++i];
+        else if (strcmp(argv[i], "--save") == 0 && has_value)
+            save_file = argv[++i];
+        else if (strcmp(argv[i], "--save-interval") == 0 && has_value)
+            save_interval_ms = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dump") == 0 && has_value)
+            dump_file = argv[++i];
+        else if (strcmp(argv[i], "--dump-rgb") == 0)
+            dump_format = VIDEO_DUMP_RGB24;
+        else if (strcmp(argv[i], "--dump-timestamps") == 0 && has_value)
+            dump_timestamps_file = argv[++i];
+        else if (strcmp(argv[i], "--dump-audio") == 0 && has_value)
+            dump_audio_file = argv[++i];
+        else if (strcmp(argv[i], "--scale") == 0 && has_value)
+        {
+            unsigned long factor = strtoul(argv[++i], NULL, 10);
+            screen_scale_config.factor = factor <= SCREEN_SCALE_MAX_FACTOR ? (uint8_t) factor : 0;
+        }
+        else if (strcmp(argv[i], "--scale-edges") == 0)
+            screen_scale_config.filter = SCREEN_SCALE_EDGES;
+        else if (strcmp(argv[i], "--crop") == 0 && has_value)
+            parse_crop(argv[++i], &screen_scale_config);
+        else if (argv[i][0] != '-')
+            rom_file = argv[i];
+        else
+            usage();
+    }
+    // A dump gets every frame, so none can be skipped, and its audio is written along with its frames
+    if ((dump_file != NULL && ppu_frame_skip != 0) ||
+        (dump_file == NULL && (dump_timestamps_file != NULL || dump_audio_file != NULL)) ||
+        !screen_scale_valid(&screen_scale_config))
+        usage();
+
     struct nes_file nes_file = open_file(rom_file);
     load_file(&nes_file);
 
+    // Movies start from a cartridge with empty RAM, so they play back the same whatever the player has saved
+    size_t battery_size = load_battery_size(&nes_file);
+    uint32_t boot_key = nes_file_crc32(&nes_file);
+    if (battery_size != 0 && play_file == NULL && record_file == NULL)
+    {
+        char default_path[SAVE_PATH_SIZE];
+        if (save_file == NULL)
+            default_save_path(rom_file, default_path);
+        uint8_t* battery_ram = battery_open(save_file != NULL ? save_file : default_path, battery_size);
+        load_attach_battery(&nes_file, battery_ram);
+        // The boot depends on the save the game finds, and a cached boot restores the RAM it was taken with
+        boot_key = crc32_update(boot_key, battery_ram, battery_size);
+    }
+
     cpu_reset();
 
-    size_t ttl = 500;
-    size_t ppu_counter = 0;
-    while (ttl != 0)
+    debug_on_hit = print_hit;
+
+    // A movie starts where it was recorded from, so it never boots from the cache
+    bool booted_from_cache = boot_cache_dir != NULL && play_file == NULL;
+    if (booted_from_cache && !boot_cache_boot(boot_cache_dir, boot_key, boot_frames))
+        return finish(&nes_file, NULL);
+
+    if (random_input_state != 0)
+        io_input_source = (struct io_input_source) { .poll = random_input, .user = NULL };
+
+    if (play_file != NULL)
     {
-        cpu_cycle();
+        movie_load(&movie, play_file);
+        if (movie.rom_crc32 != nes_file_crc32(&nes_file))
+        {
+            fprintf(stderr, "Movie was recorded on a different ROM (CRC-32 %08X)", movie.rom_crc32);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+        if (movie.start_state != NULL && !state_load(movie.start_state, movie.start_state_size))
+        {
+            fprintf(stderr, "Movie start state is not from this build of the emulator: %s", play_file);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+        io_input_source = movie_playback_source(&movie);
+    }
+    else if (record_file != NULL)
+    {
+        movie_init(&movie, nes_file_crc32(&nes_file));
+        if (booted_from_cache)
+        {
+            movie.start_state_size = state_size();
+            movie.start_state = malloc(movie.start_state_size);
+            if (movie.start_state == NULL)
+            {
+                fprintf(stderr, "Out of memory for movie start state");
+                exit(ERROR_CODE__OH_NO);
+            }
+            state_save(movie.start_state, movie.start_state_size);
+        }
+        io_input_source = movie_record_source(&movie, io_input_source);
+    }
 
-        if (++ppu_counter == ppu_cycles_per_cpu_cycle)
+    if (ram_trace_file != NULL)
+    {
+        ram_trace = fopen(ram_trace_file, "wb");
+        if (ram_trace == NULL)
         {
-            ppu_cycle();
-            ppu_counter = 0;
+            fprintf(stderr, "Could not open RAM trace file: %s", ram_trace_file);
+            exit(ERROR_CODE__INVALID_FILE);
         }
+        emu_frame_hook = write_ram_trace;
+    }
+
+    if (shm_name != NULL)
+    {
+        shm_export_open(&shm_output, shm_name, shm_format);
+        emu_add_shm_output(&shm_output);
+    }
 
-        ttl--;
+    if (dump_file != NULL)
+    {
+        video_dump_open(&dump_output, dump_file, dump_format, dump_timestamps_file, dump_audio_file);
+        emu_add_dump_output(&dump_output);
+    }
+
+    battery_start_flush(save_interval_ms);
+
+    if (telemetry_file != NULL)
+    {
+        telemetry_start(TELEMETRY_DEFAULT_CAPACITY);
+        telemetry_name_thread("presentation");
+    }
+
+    if (parallel_ppu)
+        ppu_render_start();
+
+    if (headless)
+    {
+        // No presentation: the emulation thread runs at full core speed, feeding only the shared-memory export, if any
+        emu_start(max_frames);
+        emu_join();
+        ppu_render_stop();
+        return finish(&nes_file, record_file);
+    }
+
+    size_t screen_width = screen_scale_width(&screen_scale_config);
+    screen_rgb = malloc(screen_width * screen_scale_height(&screen_scale_config) * sizeof(uint32_t));
+    if (screen_rgb == NULL)
+    {
+        fprintf(stderr, "Out of memory for screen");
+        exit(ERROR_CODE__OH_NO);
+    }
+
+    triple_buffer_init(&screen_output);
+    emu_add_output(&screen_output);
+    emu_start(max_frames);
+
+    // Presentation runs here, on the main thread, taking whichever frame is newest
+    uint64_t presented = 0;
+    uint64_t total_latency_ns = 0;
+    uint64_t max_latency_ns = 0;
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = 1000000 };
+    uint64_t wait_begin_ns = 0;
+    while (emu_running())
+    {
+        const struct frame* frame = triple_buffer_acquire(&screen_output);
+        if (frame == NULL)
+        {
+            if (wait_begin_ns == 0)
+                wait_begin_ns = telemetry_begin();
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        if (wait_begin_ns != 0)
+            telemetry_end(TELEMETRY_WAIT_FRAME, wait_begin_ns, frame->frame_number);
+        wait_begin_ns = 0;
+
+        uint64_t convert_begin_ns = telemetry_begin();
+        if (presented == 0)
+        {
+            screen_scale_frame(frame, &screen_scale_config, screen_rgb, screen_width * sizeof(uint32_t));
+            memcpy(screen_row_hashes, frame->row_hashes, sizeof(screen_row_hashes));
+        }
+        else
+        {
+            screen_scale_changed_rows(frame, &screen_scale_config, screen_rgb, screen_width * sizeof(uint32_t),
+                                      screen_row_hashes);
+        }
+        telemetry_end(TELEMETRY_CONVERT, convert_begin_ns, frame->frame_number);
+
+        uint64_t latency_ns = clock_now_ns() - frame->input_timestamp_ns;
+        total_latency_ns += latency_ns;
+        if (latency_ns > max_latency_ns)
+            max_latency_ns = latency_ns;
+        presented++;
+    }
+    emu_join();
+    ppu_render_stop();
+
+    if (presented != 0)
+    {
+        fprintf(stderr, "Presented %llu frames, input-to-present latency avg %.3f ms, max %.3f ms\n",
+                (unsigned long long) presented, total_latency_ns / 1e6 / presented, max_latency_ns / 1e6);
     }
 
-    nes_file_free(&nes_file);
-    return 0;
+    return finish(&nes_file, record_file);
 }
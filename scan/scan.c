@@ -0,0 +1,123 @@
+//
+// Created by quate on 10/19/2026.
+//
+// ROM library scanner. Brings an index of the .nes files under the given directories up to date (see rom_scan.h) and
+// prints what it did; the index then answers which board a ROM is and whether this build runs it without reading
+// the ROM itself.
+//
+// Usage: nes_scan INDEX [DIR...] [--jobs N] [--list] [--lookup ROM|CRC32]
+//
+// With directories, they are scanned into INDEX. Without, INDEX is only read. --list prints every ROM in the index,
+// --lookup the one at that path or with that CRC-32 (hex); it exits with 1 if there is none.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rom_scan.h"
+#include "clock.h"
+#include "exit_codes.h"
+
+
+#define MAX_DIRS 64
+
+
+static void print_rom(const struct rom_info* rom)
+{
+    printf("%08X ", rom->crc32);
+    for (size_t i = 0; i < ROM_SHA1_SIZE; ++i)
+    {
+        printf("%02x", rom->sha1[i]);
+    }
+    if ((rom->flags & ROM_INFO_HEADER) == 0)
+    {
+        printf("  no iNES header                                      %s\n", rom->path);
+        return;
+    }
+    const char* mirroring = rom->flags & ROM_INFO_FOUR_SCREEN ? "4" : rom->flags & ROM_INFO_V_MIRROR ? "V" : "H";
+    printf("  %s mapper %3u.%-2u PRG %4uk CHR %4uk RAM %3uk %s%s%s%s  %-11s %s\n",
+           rom->flags & ROM_INFO_NES2 ? "2.0" : "1.0", rom->mapper, rom->submapper, rom->prg_rom_size / 1024,
+           rom->chr_rom_size / 1024, rom->prg_ram_size / 1024, mirroring,
+           rom->flags & ROM_INFO_BATTERY ? "B" : "-", rom->flags & ROM_INFO_TRAINER ? "T" : "-",
+           rom->flags & ROM_INFO_TRUNCATED ? "!" : "-", rom_info_supported(rom) ? "supported" : "unsupported",
+           rom->path);
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* index_path = NULL;
+    const char* dirs[MAX_DIRS];
+    size_t num_dirs = 0;
+    unsigned jobs = 0;
+    bool list = false;
+    const char* lookup = NULL;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = (unsigned) strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--list") == 0)
+            list = true;
+        else if (strcmp(argv[i], "--lookup") == 0 && i + 1 < argc)
+            lookup = argv[++i];
+        else if (index_path == NULL)
+            index_path = argv[i];
+        else if (num_dirs < MAX_DIRS)
+            dirs[num_dirs++] = argv[i];
+        else
+        {
+            fprintf(stderr, "At most %d directories can be scanned at once: %s\n", MAX_DIRS, argv[i]);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+    }
+    if (index_path == NULL)
+    {
+        fprintf(stderr, "Usage: nes_scan INDEX [DIR...] [--jobs N] [--list] [--lookup ROM|CRC32]\n");
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    struct rom_index index;
+    if (num_dirs != 0)
+    {
+        struct rom_scan_stats stats;
+        uint64_t start_ns = clock_now_ns();
+        if (!nes_scan(index_path, dirs, num_dirs, jobs, &index, &stats))
+        {
+            fprintf(stderr, "Could not write index: %s\n", index_path);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+        fprintf(stderr, "%zu ROMs in %.3f s: %zu read, %zu unchanged, %zu removed, %zu unreadable\n", index.count,
+                (clock_now_ns() - start_ns) / 1e9, stats.hashed, stats.reused, stats.removed, stats.unreadable);
+    }
+    else if (!rom_index_load(&index, index_path))
+    {
+        fprintf(stderr, "Not an index from this build: %s\n", index_path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    if (list)
+    {
+        for (size_t i = 0; i < index.count; ++i)
+        {
+            print_rom(&index.roms[i]);
+        }
+    }
+
+    int status = 0;
+    if (lookup != NULL)
+    {
+        const struct rom_info* rom = rom_index_find_path(&index, lookup);
+        char* end = NULL;
+        unsigned long crc32 = strtoul(lookup, &end, 16);
+        if (rom == NULL && *end == '\0' && end - lookup == 8)
+            rom = rom_index_find_crc32(&index, (uint32_t) crc32);
+        if (rom != NULL)
+            print_rom(rom);
+        else
+            fprintf(stderr, "Not in the index: %s\n", lookup);
+        status = rom != NULL ? 0 : 1;
+    }
+
+    rom_index_free(&index);
+    return status;
+}
@@ -3,5 +3,165 @@
 //
 
 #include "apu.h"
+#include "cpu/cpu.h"
+#include "clock.h"
+#include "state.h"
 
-union apu_registers apu_registers;
\ No newline at end of file
+#define APU_DMC_FREQ 0x10
+#define APU_DMC_START 0x12
+#define APU_DMC_LEN 0x13
+#define APU_STATUS 0x15
+#define APU_FRAME_COUNTER 0x17
+
+#define DMC_FREQ_IRQ 0x80
+#define DMC_FREQ_LOOP 0x40
+#define DMC_FREQ_RATE 0x0F
+#define APU_STATUS_DMC 0x10
+#define APU_STATUS_FRAME_IRQ 0x40
+#define APU_STATUS_DMC_IRQ 0x80
+#define FRAME_COUNTER_5_STEP 0x80
+#define FRAME_COUNTER_IRQ_INHIBIT 0x40
+
+/// CPU cycles the CPU is halted for while the DMC fetches a sample byte (worst case; 1-3 in some alignments)
+#define DMC_DMA_STALL_CYCLES 4
+
+// https://www.nesdev.org/wiki/APU_Frame_Counter
+/// CPU cycles from a frame counter reset to the IRQ at the end of the 4-step sequence, and the sequence's length (NTSC)
+#define FRAME_IRQ_CYCLE 29828
+#define FRAME_SEQUENCE_CYCLES 29830
+/// A write to 0x4017 resets the frame counter 3 or 4 CPU cycles later, depending on where the APU cycle is
+#define FRAME_COUNTER_RESET_DELAY 3
+
+union apu_registers apu_registers;
+
+// https://www.nesdev.org/wiki/APU_DMC
+/// CPU cycles per output bit, NTSC
+static const uint16_t dmc_rate_table[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+static struct
+{
+    uint16_t address;
+    uint16_t bytes_remaining;
+    uint8_t sample_buffer;
+} dmc;
+
+
+static void apu_dmc_restart()
+{
+    dmc.address = 0xC000 | ((uint16_t) apu_registers.array[APU_DMC_START] << 6);
+    dmc.bytes_remaining = ((uint16_t) apu_registers.array[APU_DMC_LEN] << 4) + 1;
+}
+
+static void apu_dmc_fetch();
+
+/**
+ * The output unit empties the sample buffer every 8 output bits, at which point the next byte is fetched.
+ * Rather than clocking the DMC timer every cycle, that point in time is posted to the scheduler.
+ */
+static void apu_dmc_schedule_fetch(uint64_t cycle)
+{
+    clock_schedule(CLOCK_EVENT_DMC_FETCH, cycle, apu_dmc_fetch);
+}
+
+static void apu_dmc_fetch()
+{
+    dmc.sample_buffer = cpu_dma_read(dmc.address);
+    clock_stall_cpu(DMC_DMA_STALL_CYCLES);
+
+    dmc.address = dmc.address == 0xFFFF ? 0x8000 : dmc.address + 1;
+    if (--dmc.bytes_remaining == 0)
+    {
+        if (!(apu_registers.array[APU_DMC_FREQ] & DMC_FREQ_LOOP))
+        {
+            if (apu_registers.array[APU_DMC_FREQ] & DMC_FREQ_IRQ)
+                cpu_irq_assert(CPU_IRQ_DMC);
+            return;
+        }
+        apu_dmc_restart();
+    }
+
+    uint16_t rate = dmc_rate_table[apu_registers.array[APU_DMC_FREQ] & DMC_FREQ_RATE];
+    apu_dmc_schedule_fetch(clock_cpu_cycles + 8 * rate);
+}
+
+
+static void apu_frame_irq();
+
+/**
+ * The frame counter isn't clocked either: only its IRQ has an effect so far, and the cycle where the 4-step sequence
+ * raises it is posted to the scheduler.
+ */
+static void apu_frame_counter_reset(uint64_t cycle)
+{
+    uint8_t mode = apu_registers.array[APU_FRAME_COUNTER];
+    if (mode & (FRAME_COUNTER_5_STEP | FRAME_COUNTER_IRQ_INHIBIT))
+        clock_cancel(CLOCK_EVENT_APU_FRAME_IRQ);
+    else
+        clock_schedule(CLOCK_EVENT_APU_FRAME_IRQ, cycle + FRAME_IRQ_CYCLE, apu_frame_irq);
+}
+
+static void apu_frame_irq()
+{
+    cpu_irq_assert(CPU_IRQ_APU_FRAME);
+    clock_schedule(CLOCK_EVENT_APU_FRAME_IRQ, clock_cpu_cycles + FRAME_SEQUENCE_CYCLES, apu_frame_irq);
+}
+
+
+void apu_register_write(uint8_t reg, uint8_t value)
+{
+    apu_registers.array[reg] = value;
+    switch (reg)
+    {
+        case APU_DMC_FREQ:
+            if (!(value & DMC_FREQ_IRQ))
+                cpu_irq_release(CPU_IRQ_DMC);
+            break;
+        case APU_FRAME_COUNTER:
+            if (value & FRAME_COUNTER_IRQ_INHIBIT)
+                cpu_irq_release(CPU_IRQ_APU_FRAME);
+            apu_frame_counter_reset(clock_cpu_cycles + FRAME_COUNTER_RESET_DELAY + (clock_cpu_cycles & 1));
+            break;
+        case APU_STATUS:
+            cpu_irq_release(CPU_IRQ_DMC);
+            if (!(value & APU_STATUS_DMC))
+            {
+                dmc.bytes_remaining = 0;
+                clock_cancel(CLOCK_EVENT_DMC_FETCH);
+            }
+            else if (dmc.bytes_remaining == 0)
+            {
+                apu_dmc_restart();
+                apu_dmc_schedule_fetch(clock_cpu_cycles + 1);  // buffer is empty, so the first byte comes right away
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+uint8_t apu_status_read()
+{
+    uint8_t value = (dmc.bytes_remaining != 0 ? APU_STATUS_DMC : 0) |
+                    (cpu_irq_lines & CPU_IRQ_APU_FRAME ? APU_STATUS_FRAME_IRQ : 0) |
+                    (cpu_irq_lines & CPU_IRQ_DMC ? APU_STATUS_DMC_IRQ : 0);
+    cpu_irq_release(CPU_IRQ_APU_FRAME);
+    return value;
+}
+
+
+void apu_reset()
+{
+    apu_register_write(APU_STATUS, 0);
+    cpu_irq_release(CPU_IRQ_APU_FRAME);
+    apu_frame_counter_reset(clock_cpu_cycles);
+}
+
+
+void apu_state(struct state* state)
+{
+    STATE_FIELD(state, apu_registers);
+    STATE_FIELD(state, dmc);
+}
@@ -10,7 +10,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define APU_IO_REGISTER_SIZE 18
+#define APU_IO_REGISTER_SIZE 0x18  // 0x4000-0x4017
 
 // https://www.nesdev.org/wiki/2A03
 // TODO: again, sus bit fields and reliance on specific struct memory layout
@@ -44,4 +44,26 @@ extern union apu_registers
     uint8_t array[APU_IO_REGISTER_SIZE];
 } apu_registers;
 
+/**
+ * CPU-side write to an APU/IO register, including its side effects.
+ *
+ * @param reg Register index (address - 0x4000).
+ */
+void apu_register_write(uint8_t reg, uint8_t value);
+
+/**
+ * CPU-side read of the status register (0x4015). Clears the frame interrupt flag.
+ */
+uint8_t apu_status_read();
+
+/**
+ * Silences the channels and restarts the frame counter, as the 2A03's reset line does.
+ */
+void apu_reset();
+
+struct state;
+
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void apu_state(struct state* state);
+
 #endif //NES_EMULATOR_APU_H
@@ -0,0 +1,161 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "battery.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "exit_codes.h"
+
+
+static int battery_fd = -1;
+static uint8_t* battery_ram = NULL;
+static size_t battery_size = 0;
+static size_t page_size = 0;
+
+/// Contents of battery_ram as of the last flush, to find the pages changed since. Only the flushing thread uses it.
+static uint8_t* flushed_ram = NULL;
+
+static pthread_t flush_thread;
+static bool flush_thread_running = false;
+static pthread_mutex_t flush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t flush_cond;
+static bool flush_stop_requested = false;
+static uint64_t flush_interval_ms = 0;
+
+
+/**
+ * Writes the pages that differ from flushed_ram to the file. The emulation thread may be writing them meanwhile: a
+ * page caught mid-write is written as it was at that moment, like a power cut would leave a real cartridge, and again
+ * on the next pass.
+ */
+static void flush_changed_pages()
+{
+    for (size_t offset = 0; offset < battery_size; offset += page_size)
+    {
+        size_t length = battery_size - offset < page_size ? battery_size - offset : page_size;
+        if (memcmp(battery_ram + offset, flushed_ram + offset, length) == 0)
+            continue;
+        memcpy(flushed_ram + offset, battery_ram + offset, length);
+        if (msync(battery_ram + offset, length, MS_SYNC) != 0)
+            fprintf(stderr, "Could not write save file page at offset %zu\n", offset);
+    }
+}
+
+static void* flush_thread_main(void* arg)
+{
+    (void) arg;
+    pthread_mutex_lock(&flush_mutex);
+    while (!flush_stop_requested)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t) (flush_interval_ms / 1000);
+        deadline.tv_nsec += (long) (flush_interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        if (pthread_cond_timedwait(&flush_cond, &flush_mutex, &deadline) == 0 || flush_stop_requested)
+            continue;
+
+        pthread_mutex_unlock(&flush_mutex);
+        flush_changed_pages();
+        pthread_mutex_lock(&flush_mutex);
+    }
+    pthread_mutex_unlock(&flush_mutex);
+    return NULL;
+}
+
+
+uint8_t* battery_open(const char* path, size_t size)
+{
+    battery_fd = open(path, O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (battery_fd < 0 || fstat(battery_fd, &info) != 0)
+    {
+        fprintf(stderr, "Could not open save file: %s", path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    if ((size_t) info.st_size < size && ftruncate(battery_fd, (off_t) size) != 0)
+    {
+        fprintf(stderr, "Could not extend save file: %s", path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, battery_fd, 0);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map save file: %s", path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    // Keeps the CPU from ever waiting on the disk to read a page back in; the mapping works without it
+    mlock(data, size);
+
+    battery_ram = data;
+    battery_size = size;
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+    flushed_ram = malloc(size);
+    if (flushed_ram == NULL)
+    {
+        fprintf(stderr, "Out of memory for save file copy");
+        exit(ERROR_CODE__OH_NO);
+    }
+    memcpy(flushed_ram, battery_ram, size);
+    return battery_ram;
+}
+
+void battery_start_flush(uint64_t interval_ms)
+{
+    if (battery_ram == NULL || interval_ms == 0)
+        return;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&flush_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    flush_interval_ms = interval_ms;
+    flush_stop_requested = false;
+    if (pthread_create(&flush_thread, NULL, flush_thread_main, NULL) != 0)
+    {
+        fprintf(stderr, "Could not start save file thread");
+        exit(ERROR_CODE__OH_NO);
+    }
+    flush_thread_running = true;
+}
+
+void battery_close()
+{
+    if (battery_ram == NULL)
+        return;
+
+    if (flush_thread_running)
+    {
+        pthread_mutex_lock(&flush_mutex);
+        flush_stop_requested = true;
+        pthread_cond_signal(&flush_cond);
+        pthread_mutex_unlock(&flush_mutex);
+        pthread_join(flush_thread, NULL);
+        pthread_cond_destroy(&flush_cond);
+        flush_thread_running = false;
+    }
+
+    flush_changed_pages();
+    munmap(battery_ram, battery_size);
+    close(battery_fd);
+    free(flushed_ram);
+    battery_ram = NULL;
+    flushed_ram = NULL;
+    battery_fd = -1;
+}
@@ -0,0 +1,39 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Battery-backed cartridge RAM kept in a save file. The file is mapped shared and handed to the cartridge as its
+// PRG-RAM (load_attach_battery()), so the CPU writes it through its page table like any RAM and nothing is copied on
+// the emulation thread. A background thread finds the pages the game changed since its last pass, by comparing them
+// with a copy, and msyncs just those to disk; frames never wait on it.
+//
+
+#ifndef NES_EMULATOR_BATTERY_H
+#define NES_EMULATOR_BATTERY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/// How often the flush thread looks for changed pages by default
+#define BATTERY_DEFAULT_FLUSH_INTERVAL_MS 1000
+
+/**
+ * Maps `size` bytes of the save file at `path`, creating it zero-filled (or extending it) if it is shorter. Exits if
+ * the file can't be opened or mapped. Only one save file can be open at a time.
+ *
+ * @return The mapped RAM, valid until battery_close()
+ */
+uint8_t* battery_open(const char* path, size_t size);
+
+/**
+ * Starts the flush thread, which writes changed pages every `interval_ms`. With 0 they are only written by
+ * battery_close().
+ */
+void battery_start_flush(uint64_t interval_ms);
+
+/**
+ * Stops the flush thread, writes what is left and unmaps the save file. Does nothing if none is open. The emulation
+ * must not be running.
+ */
+void battery_close();
+
+#endif //NES_EMULATOR_BATTERY_H
@@ -0,0 +1,87 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "boot_cache.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ppu.h"
+#include "io.h"
+#include "emu.h"
+#include "state.h"
+
+
+#define BOOT_CACHE_PATH_SIZE 4096
+
+
+static bool boot_cache_load(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    bool loaded = false;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void* data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED)
+        {
+            loaded = state_load(data, (size_t) info.st_size);
+            munmap(data, (size_t) info.st_size);
+        }
+    }
+    close(fd);
+    return loaded;
+}
+
+static void boot_cache_store(const char* dir, const char* path)
+{
+    size_t size = state_size();
+    uint8_t* data = malloc(size);
+    if (data == NULL)
+        return;
+    state_save(data, size);
+
+    mkdir(dir, 0755);
+    char temp_path[BOOT_CACHE_PATH_SIZE + 32];  // path, pid and suffix
+    snprintf(temp_path, sizeof(temp_path), "%s.%ld.tmp", path, (long) getpid());
+    FILE* file = fopen(temp_path, "wb");
+    bool written = file != NULL && fwrite(data, 1, size, file) == size;
+    if (file != NULL && fclose(file) != 0)
+        written = false;
+    if (!written || rename(temp_path, path) != 0)
+    {
+        fprintf(stderr, "Could not write boot cache entry: %s\n", path);
+        remove(temp_path);
+    }
+    free(data);
+}
+
+
+bool boot_cache_boot(const char* dir, uint32_t rom_crc32, uint64_t frames)
+{
+    char path[BOOT_CACHE_PATH_SIZE];
+    snprintf(path, sizeof(path), "%s/%08X-%llu.state", dir, rom_crc32, (unsigned long long) frames);
+    if (boot_cache_load(path))
+        return true;
+
+    // Nobody looks at the boot, so don't draw it
+    unsigned int frame_skip = ppu_frame_skip;
+    ppu_frame_skip = (unsigned int) frames;
+    bool booted = true;
+    for (uint64_t i = 0; i < frames && booted; ++i)
+    {
+        memset(io_buttons, 0, IO_NUM_CONTROLLERS);
+        booted = emu_run_frame();
+    }
+    ppu_frame_skip = frame_skip;
+
+    if (booted)
+        boot_cache_store(dir, path);
+    return booted;
+}
@@ -0,0 +1,30 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Warm-start cache. Games spend their first seconds after power-on on PPU warm-up waits and intro logic, the same
+// every time when no buttons are pressed. The cache keeps the save state a ROM reaches after booting for a given
+// number of frames, so that later runs start from there instead.
+//
+// Entries are files named <ROM CRC-32>-<frames>.state in the cache directory, read through mmap. They are written to
+// a temporary file and renamed into place, so instances can share a directory. An entry saved by another build of
+// the emulator fails to load and is simply booted and written again.
+//
+
+#ifndef NES_EMULATOR_BOOT_CACHE_H
+#define NES_EMULATOR_BOOT_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * Brings a console that was just loaded and reset to where it is after `frames` frames with no buttons held, from the
+ * cache if it has the entry, otherwise by running the frames and then adding the entry. Problems with the cache are
+ * reported on stderr and otherwise ignored.
+ *
+ * @param rom_crc32 nes_file_crc32() of the loaded cartridge; for one with a save file, folded with the CRC-32 of the
+ *                  saved RAM, as the boot (and the RAM a cached boot restores) depends on it
+ * @return false if emulation stopped during the boot (see emu_run_frame()); nothing is cached then.
+ */
+bool boot_cache_boot(const char* dir, uint32_t rom_crc32, uint64_t frames);
+
+#endif //NES_EMULATOR_BOOT_CACHE_H
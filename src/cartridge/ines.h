@@ -5,6 +5,7 @@
 #ifndef NES_EMULATOR_INES_H
 #define NES_EMULATOR_INES_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -12,13 +13,27 @@
 
 #define PRG_PAGE_SIZE 0x4000  // 16 kB
 #define CHR_PAGE_SIZE 0x2000  // 8 kB
+#define TRAINER_SIZE 0x200
 
 struct nes_file
 {
     /// Vertical mirroring? Otherwise horizontal
-//    bool v_mirror;
+    bool v_mirror;
+    /// Cartridge provides its own VRAM for four independent nametables; overrides v_mirror
+    bool four_screen;
+    /// Cartridge has battery-backed PRG-RAM at 0x6000-0x7FFF, which games keep their saves in
+    bool battery;
+    /// 512-byte trainer between the header and PRG ROM (not kept; it was for copiers)
+    bool trainer;
+    /// Header is in the NES 2.0 format
+    bool nes2;
     /// 12-bit index for mapper behavior class
     uint16_t mapper_idx;
+    /// Variant of the mapper (NES 2.0 only, otherwise 0)
+    uint8_t submapper;
+
+    /// PRG-RAM size in bytes, battery-backed or not; 0 if the header doesn't say (iNES 1.0 often doesn't)
+    size_t prg_ram_bytes;
 
     /// PRG size in units of 16 kB
     size_t prg_size;
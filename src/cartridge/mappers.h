@@ -0,0 +1,26 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Mappers the emulation core is specialized for. The PPU cycle function and the frame loop are compiled once per
+// mapper listed here, calling that mapper's hooks directly so they inline, and once more generically, going through
+// the function pointers in ppu.h for every other cartridge. load_file() selects the core (emu_select_core()).
+//
+// Adding a mapper to the list takes three edits:
+//   1. its row below;
+//   2. in its header, the hooks the specialized cores call:
+//        static inline uint8_t* <name>_ppu_pattern(uint16_t addr)   byte of pattern table memory, addr < 0x2000
+//        static inline void <name>_ppu_a12_rise()                  its reaction to PPU A12 rising (IRQ counters)
+//   3. in ppu.c, an #include of that header, and its core: #define PPU_MAPPER <name> followed by
+//      #include "ppu_cycle.h". A template instantiated by #include can't be expanded from the list, so this one is
+//      by hand; ppu.c fails to compile if it is missing.
+// The frame loop in emu.c and the declarations in ppu.h follow from the list.
+//
+
+#ifndef NES_EMULATOR_MAPPERS_H
+#define NES_EMULATOR_MAPPERS_H
+
+/// X(name, iNES mapper number)
+#define NES_MAPPERS(X) \
+    X(nrom, 0)
+
+#endif //NES_EMULATOR_MAPPERS_H
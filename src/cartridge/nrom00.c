@@ -3,43 +3,61 @@
 //
 
 #include "nrom00.h"
+#include <string.h>
 #include "cpu/cpu.h"
 #include "ppu.h"
 #include "exit_codes.h"
+#include "state.h"
 
 
+#define PRG_RAM_ADDR_LOWER 0x6000
 #define PRG_ROM_ADDR_LOWER 0x8000
 
 
 struct nes_file* nes_file = NULL;
+uint8_t* nrom_chr = NULL;
+
+static uint8_t internal_prg_ram[NROM_PRG_RAM_SIZE];
+uint8_t* nrom_prg_ram = internal_prg_ram;
 
 
 uint8_t* nrom_pattern_table_0(uint16_t addr)
 {
-    return &nes_file->chr_rom[addr & 0x1FFF];
+    return nrom_ppu_pattern(addr);
 }
 
 uint8_t* nrom_pattern_table_1(uint16_t addr)
 {
-    return &nes_file->chr_rom[addr & 0x1FFF];
+    return nrom_ppu_pattern(addr);
 }
 
 uint8_t* nrom128_cpu_cartridge_space_map(uint16_t addr)
 {
-    if (addr < PRG_ROM_ADDR_LOWER)
+    if (addr < PRG_RAM_ADDR_LOWER)
         return NULL;
+    else if (addr < PRG_ROM_ADDR_LOWER)
+        return &nrom_prg_ram[addr & (NROM_PRG_RAM_SIZE - 1)];
     else
         return &nes_file->prg_rom[addr & 0x3FFF];  // Mirroring between 0x8000-0xBFFF and 0xC000-0xFFFF
 }
 
 uint8_t* nrom256_cpu_cartridge_space_map(uint16_t addr)
 {
-    if (addr < PRG_ROM_ADDR_LOWER)
+    if (addr < PRG_RAM_ADDR_LOWER)
         return NULL;
+    else if (addr < PRG_ROM_ADDR_LOWER)
+        return &nrom_prg_ram[addr & (NROM_PRG_RAM_SIZE - 1)];
     else
         return &nes_file->prg_rom[addr & 0x7FFF];
 }
 
+uint8_t* nrom_cpu_cartridge_ram_map(uint16_t addr)
+{
+    if (addr >= PRG_RAM_ADDR_LOWER && addr < PRG_ROM_ADDR_LOWER)
+        return &nrom_prg_ram[addr & (NROM_PRG_RAM_SIZE - 1)];
+    return NULL;
+}
+
 void nrom_load(struct nes_file* file)
 {
     ppu_map_pattern_table_0 = &nrom_pattern_table_0;
@@ -50,6 +68,20 @@ void nrom_load(struct nes_file* file)
         cpu_cartridge_space_map = &nrom256_cpu_cartridge_space_map;
     else
         exit(ERROR_CODE__INVALID_FILE);
-    ppu_nametable_mirroring = MIRRORING_H;
+    cpu_cartridge_ram_map = &nrom_cpu_cartridge_ram_map;
+    nrom_prg_ram = internal_prg_ram;
+    memset(nrom_prg_ram, 0, NROM_PRG_RAM_SIZE);
+    ppu_set_mirroring(file->four_screen ? MIRRORING_FOUR_SCREEN : file->v_mirror ? MIRRORING_V : MIRRORING_H);
     nes_file = file;
+    nrom_chr = file->chr_rom;
+}
+
+void nrom_attach_prg_ram(uint8_t* ram)
+{
+    nrom_prg_ram = ram;
+}
+
+void nrom_state(struct state* state)
+{
+    state_field(state, nrom_prg_ram, NROM_PRG_RAM_SIZE);
 }
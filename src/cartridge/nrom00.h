@@ -9,7 +9,35 @@
 #include "ines.h"
 
 
+/// PRG-RAM at 0x6000-0x7FFF. Boards without it are emulated with it anyway, as test ROMs report results there.
+#define NROM_PRG_RAM_SIZE 0x2000
+
+/// CHR ROM (or RAM) of the loaded cartridge, 8kB
+extern uint8_t* nrom_chr;
+
+/// NROM_PRG_RAM_SIZE bytes: the cartridge's own, cleared by nrom_load(), or the one given to nrom_attach_prg_ram()
+extern uint8_t* nrom_prg_ram;
+
+
 void nrom_load(struct nes_file* nes_file);
 
+/// Hooks for the cores specialized for NROM (see mappers.h): fixed 8kB of CHR, nothing watching A12
+static inline uint8_t* nrom_ppu_pattern(uint16_t addr)
+{
+    return &nrom_chr[addr & 0x1FFF];
+}
+
+static inline void nrom_ppu_a12_rise()
+{
+}
+
+/// Uses `ram` (NROM_PRG_RAM_SIZE bytes, kept as they are) as PRG-RAM from now on. Call cpu_map_pages() after.
+void nrom_attach_prg_ram(uint8_t* ram);
+
+struct state;
+
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void nrom_state(struct state* state);
+
 
 #endif //NES_EMULATOR_NROM00_H
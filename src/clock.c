@@ -3,3 +3,103 @@
 //
 
 #include "clock.h"
+#include <time.h>
+#include <stddef.h>
+#include "state.h"
+#include "telemetry.h"
+
+#define CLOCK_NEVER UINT64_MAX
+
+
+uint64_t clock_now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+
+uint64_t clock_cpu_cycles = 0;
+uint32_t clock_cpu_stall = 0;
+uint64_t clock_next_event_cycle = CLOCK_NEVER;
+
+static struct
+{
+    uint64_t cycle;
+    void (*handler)();
+} clock_events[NUM_CLOCK_EVENTS] = {
+    [0 ... NUM_CLOCK_EVENTS - 1] = { .cycle = CLOCK_NEVER, .handler = NULL }
+};
+
+
+static void clock_update_next_event()
+{
+    clock_next_event_cycle = CLOCK_NEVER;
+    for (size_t i = 0; i < NUM_CLOCK_EVENTS; ++i)
+    {
+        if (clock_events[i].cycle < clock_next_event_cycle)
+            clock_next_event_cycle = clock_events[i].cycle;
+    }
+}
+
+
+void clock_stall_cpu(uint32_t cycles)
+{
+    clock_cpu_stall += cycles;
+    telemetry_dma_stall_cycles += cycles;
+}
+
+
+void clock_schedule(enum clock_event event, uint64_t cycle, void (*handler)())
+{
+    clock_events[event].cycle = cycle;
+    clock_events[event].handler = handler;
+    if (cycle < clock_next_event_cycle)
+        clock_next_event_cycle = cycle;
+}
+
+
+void clock_cancel(enum clock_event event)
+{
+    clock_events[event].cycle = CLOCK_NEVER;
+    clock_update_next_event();
+}
+
+
+void clock_run_events()
+{
+    for (size_t i = 0; i < NUM_CLOCK_EVENTS; ++i)
+    {
+        if (clock_events[i].cycle <= clock_cpu_cycles)
+        {
+            clock_events[i].cycle = CLOCK_NEVER;
+            clock_events[i].handler();
+        }
+    }
+    clock_update_next_event();
+}
+
+
+void clock_reset()
+{
+    clock_cpu_cycles = 0;
+    clock_cpu_stall = 0;
+    for (size_t i = 0; i < NUM_CLOCK_EVENTS; ++i)
+    {
+        clock_events[i].cycle = CLOCK_NEVER;
+    }
+    clock_next_event_cycle = CLOCK_NEVER;
+}
+
+
+void clock_state(struct state* state)
+{
+    STATE_FIELD(state, clock_cpu_cycles);
+    STATE_FIELD(state, clock_cpu_stall);
+    STATE_FIELD(state, clock_next_event_cycle);
+    for (size_t i = 0; i < NUM_CLOCK_EVENTS; ++i)
+    {
+        STATE_FIELD(state, clock_events[i].cycle);
+        STATE_CODE_POINTER(state, clock_events[i].handler);
+    }
+}
@@ -5,4 +5,62 @@
 #ifndef TINY_EMULATOR_CLOCK_H
 #define TINY_EMULATOR_CLOCK_H
 
+#include <stdint.h>
+
+/**
+ * Monotonic wall-clock time in nanoseconds. Only meaningful as a difference between two calls.
+ */
+uint64_t clock_now_ns();
+
+/// Scheduler
+// Work that happens at a known future CPU cycle (DMA fetches, IRQ assertions, ...) is posted here instead of being
+// polled every cycle. The emulation loop only compares clock_cpu_cycles against clock_next_event_cycle.
+
+/// CPU cycles elapsed since power-on, including stalled ones
+extern uint64_t clock_cpu_cycles;
+
+/// Remaining CPU cycles the CPU is halted for (DMA). The PPU and APU keep running.
+extern uint32_t clock_cpu_stall;
+
+/// Earliest cycle at which some event is due
+extern uint64_t clock_next_event_cycle;
+
+enum clock_event
+{
+    CLOCK_EVENT_DMC_FETCH,
+    CLOCK_EVENT_APU_FRAME_IRQ,
+    CLOCK_EVENT_DEBUG_BREAK,
+    CLOCK_EVENT_CPU_HALT,
+    NUM_CLOCK_EVENTS
+};
+
+/**
+ * Halts the CPU for the given number of cycles, starting with the next one.
+ */
+void clock_stall_cpu(uint32_t cycles);
+
+/**
+ * Schedules (or reschedules) an event. Each event has a single pending occurrence.
+ *
+ * @param cycle Value of clock_cpu_cycles at which the handler runs, before that cycle's CPU step.
+ */
+void clock_schedule(enum clock_event event, uint64_t cycle, void (*handler)());
+
+void clock_cancel(enum clock_event event);
+
+/**
+ * Runs every event that is due. Handlers may schedule further events.
+ */
+void clock_run_events();
+
+/**
+ * Resets the cycle counter and drops all pending events and stalls.
+ */
+void clock_reset();
+
+struct state;
+
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void clock_state(struct state* state);
+
 #endif //TINY_EMULATOR_CLOCK_H
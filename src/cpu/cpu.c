@@ -8,9 +8,11 @@
 #include "stdlib.h"
 #include "cpu.h"
 #include "utils.h"
-#include "exit_codes.h"
 #include "ppu.h"
 #include "apu.h"
+#include "io.h"
+#include "clock.h"
+#include "state.h"
 
 
 // TODO: https://www.nesdev.org/wiki/CPU_power_up_state
@@ -20,20 +22,22 @@ struct cpu_registers cpu_registers = {
     .acc = 0,
     .idx_x = 0,
     .idx_y = 0,
-    .sr = {
-        .c = 0,
-        .z = 0,
-        .i = 0,
-        .d = 0,
-        .b = 0,
-        .v = 0,
-        .n = 0
-    }
+    .flag_c = 0,
+    .flag_i = 0,
+    .flag_d = 0,
+    .flag_z_src = 1,
+    .flag_n_src = 0,
+    .flag_v_a = 0,
+    .flag_v_b = 0,
+    .flag_v_r = 0,
 };
 
 
+struct cpu_context cpu_context = { .resume = RESUME_POINT_START };
+
 uint8_t cpu_ir = 0;
 uint16_t cpu_addr_latch = 0;
+bool cpu_halted = false;
 
 
 #define INTERNAL_RAM_UPPER 0x2000
@@ -41,8 +45,17 @@ uint16_t cpu_addr_latch = 0;
 #define PPU_REG_SPACE_UPPER 0x4000
 #define PPU_REG_MASK 0x7
 #define APU_IO_REG_SPACE_UPPER 0x4018
-#define APU_IO_REG_MASK 0xFF
-#define RAM_SIZE 0x0800  // 2kB
+#define APU_IO_REG_MASK 0x1F
+#define CARTRIDGE_SPACE_LOWER 0x4020
+#define OAM_DMA_ADDR 0x4014
+#define JOY1_ADDR 0x4016
+#define JOY2_ADDR 0x4017
+#define APU_STATUS_ADDR 0x4015
+#define OPEN_BUS_MASK 0xE0  // controller reads only drive the low bits
+#define APU_STATUS_OPEN_BUS_MASK 0x20
+
+/// CPU cycles taken by OAM DMA, plus one more if it starts on an odd cycle
+#define OAM_DMA_STALL_CYCLES 513
 
 uint8_t ram[RAM_SIZE];
 uint16_t addr_bus = 0;
@@ -83,30 +96,282 @@ uint8_t* cpu_mem_map(uint16_t addr)
 
 
 uint8_t* (*cpu_cartridge_space_map)(uint16_t addr) = NULL;
+uint8_t* (*cpu_cartridge_ram_map)(uint16_t addr) = NULL;
 
 
-void cpu_read()
+uint8_t* cpu_read_pages[CPU_NUM_PAGES];
+uint8_t* cpu_write_pages[CPU_NUM_PAGES];
+uint8_t* cpu_fetch_pages[CPU_NUM_PAGES];
+
+uint8_t* cpu_mapped_read_pages[CPU_NUM_PAGES];
+static uint8_t* mapped_write_pages[CPU_NUM_PAGES];
+
+uint8_t cpu_page_traps[CPU_NUM_PAGES];
+void (*cpu_trap_handler)(uint8_t trap, uint16_t addr, uint8_t value) = NULL;
+
+
+void cpu_map_pages()
+{
+    for (size_t page = 0; page < CPU_NUM_PAGES; ++page)
+    {
+        uint16_t addr = page << 8;
+        if (addr < INTERNAL_RAM_UPPER)
+        {
+            cpu_mapped_read_pages[page] = &ram[addr & RAM_MASK];
+            mapped_write_pages[page] = cpu_mapped_read_pages[page];
+        }
+        else if (addr < CARTRIDGE_SPACE_LOWER)
+        {
+            // Registers with side effects
+            cpu_mapped_read_pages[page] = NULL;
+            mapped_write_pages[page] = NULL;
+        }
+        else
+        {
+            // Cartridge writes usually go to mapper registers, so only reads are direct, and writes to its RAM
+            cpu_mapped_read_pages[page] = cpu_cartridge_space_map(addr);
+            mapped_write_pages[page] = cpu_cartridge_ram_map != NULL ? cpu_cartridge_ram_map(addr) : NULL;
+        }
+    }
+    cpu_apply_page_traps();
+}
+
+
+void cpu_apply_page_traps()
 {
+    for (size_t page = 0; page < CPU_NUM_PAGES; ++page)
+    {
+        uint8_t traps = cpu_page_traps[page];
+        cpu_read_pages[page] = traps & CPU_TRAP_READ ? NULL : cpu_mapped_read_pages[page];
+        cpu_write_pages[page] = traps & CPU_TRAP_WRITE ? NULL : mapped_write_pages[page];
+        cpu_fetch_pages[page] = traps & CPU_TRAP_FETCH ? NULL : cpu_mapped_read_pages[page];
+    }
+}
+
+
+static void cpu_read_slow()
+{
+    const uint8_t* page = cpu_mapped_read_pages[addr_bus >> 8];
+    if (page != NULL) {
+        data_bus = page[addr_bus & 0xFF];
+        return;
+    }
+    if (addr_bus >= INTERNAL_RAM_UPPER && addr_bus < PPU_REG_SPACE_UPPER) {
+        data_bus = ppu_register_read(addr_bus & PPU_REG_MASK);
+        return;
+    }
+    if (addr_bus == JOY1_ADDR || addr_bus == JOY2_ADDR) {
+        data_bus = (data_bus & OPEN_BUS_MASK) | io_controller_read(addr_bus - JOY1_ADDR);
+        return;
+    }
+    if (addr_bus == APU_STATUS_ADDR) {
+        data_bus = (data_bus & APU_STATUS_OPEN_BUS_MASK) | apu_status_read();
+        return;
+    }
     if (cpu_mem_map(addr_bus) != NULL) {
         data_bus = *cpu_mem_map(addr_bus);
     }
     // Default open bus
 }
 
-void cpu_write()
+void cpu_read()
 {
+    const uint8_t* page = cpu_read_pages[addr_bus >> 8];
+    if (page != NULL) {
+        data_bus = page[addr_bus & 0xFF];
+        return;
+    }
+    cpu_read_slow();
+    if (cpu_page_traps[addr_bus >> 8] & CPU_TRAP_READ)
+        cpu_trap_handler(CPU_TRAP_READ, addr_bus, data_bus);
+}
+
+static void cpu_write_slow()
+{
+    uint8_t* page = mapped_write_pages[addr_bus >> 8];
+    if (page != NULL) {
+        page[addr_bus & 0xFF] = data_bus;
+        return;
+    }
+    if (addr_bus >= INTERNAL_RAM_UPPER && addr_bus < PPU_REG_SPACE_UPPER) {
+        ppu_register_write(addr_bus & PPU_REG_MASK, data_bus);
+        return;
+    }
+    if (addr_bus == OAM_DMA_ADDR) {
+        cpu_oam_dma(data_bus);
+        return;
+    }
+    if (addr_bus == JOY1_ADDR) {
+        io_controller_write(data_bus);
+        return;
+    }
+    if (addr_bus >= PPU_REG_SPACE_UPPER && addr_bus < APU_IO_REG_SPACE_UPPER) {
+        apu_register_write(addr_bus & APU_IO_REG_MASK, data_bus);
+        return;
+    }
     if (cpu_mem_map(addr_bus) != NULL) {
         *cpu_mem_map(addr_bus) = data_bus;
     }
     // Default open bus
 }
 
+void cpu_write()
+{
+    uint8_t* page = cpu_write_pages[addr_bus >> 8];
+    if (page != NULL) {
+        page[addr_bus & 0xFF] = data_bus;
+        return;
+    }
+    cpu_write_slow();
+    if (cpu_page_traps[addr_bus >> 8] & CPU_TRAP_WRITE)
+        cpu_trap_handler(CPU_TRAP_WRITE, addr_bus, data_bus);
+}
 
 /**
- * Sets PC to the reset vector address and initiates CPU
+ * Opcode fetch: a read of PC through the fetch page table. Only reports CPU_TRAP_FETCH, not CPU_TRAP_READ.
+ */
+static void cpu_fetch()
+{
+    addr_bus = cpu_registers.pc;
+    const uint8_t* page = cpu_fetch_pages[addr_bus >> 8];
+    if (page != NULL) {
+        data_bus = page[addr_bus & 0xFF];
+        return;
+    }
+    cpu_read_slow();
+    if (cpu_page_traps[addr_bus >> 8] & CPU_TRAP_FETCH)
+        cpu_trap_handler(CPU_TRAP_FETCH, addr_bus, data_bus);
+}
+
+
+uint8_t cpu_dma_read(uint16_t addr)
+{
+    const uint8_t* page = cpu_mapped_read_pages[addr >> 8];
+    if (page != NULL)
+        return page[addr & 0xFF];
+    const uint8_t* mem = cpu_mem_map(addr);
+    return mem != NULL ? *mem : 0;
+}
+
+
+// https://www.nesdev.org/wiki/PPU_registers#OAMDMA
+void cpu_oam_dma(uint8_t page)
+{
+    const uint8_t* src = cpu_mapped_read_pages[page];
+    if (src != NULL)
+    {
+        ppu_oam_dma(src);
+    }
+    else
+    {
+        uint8_t buffer[CPU_PAGE_SIZE];
+        for (size_t i = 0; i < CPU_PAGE_SIZE; ++i)
+        {
+            buffer[i] = cpu_dma_read((page << 8) | i);
+        }
+        ppu_oam_dma(buffer);
+    }
+
+    // One dummy cycle, one more to align to a read cycle if needed, then 256 read/write pairs
+    clock_stall_cpu(OAM_DMA_STALL_CYCLES + (clock_cpu_cycles & 1));
+}
+
+
+uint8_t cpu_irq_lines = 0;
+uint8_t cpu_interrupt_pending = 0;
+
+/// Values of clock_cpu_cycles when the IRQ line was last asserted and the pending NMI edge was detected: the first
+/// cycles whose interrupt poll sees them
+static uint64_t irq_cycle = 0;
+static uint64_t nmi_cycle = 0;
+
+/// Keeps CPU_INTERRUPT_IRQ in step with the IRQ lines and I
+static inline void update_irq_pending()
+{
+    cpu_interrupt_pending = (cpu_interrupt_pending & ~CPU_INTERRUPT_IRQ) |
+                            (cpu_irq_lines != 0 && !cpu_registers.flag_i ? CPU_INTERRUPT_IRQ : 0);
+}
+
+void cpu_irq_assert(uint8_t source)
+{
+    if (cpu_irq_lines == 0)
+        irq_cycle = clock_cpu_cycles;
+    cpu_irq_lines |= source;
+    update_irq_pending();
+}
+
+void cpu_irq_release(uint8_t source)
+{
+    cpu_irq_lines &= ~source;
+    update_irq_pending();
+}
+
+void cpu_nmi()
+{
+    if (cpu_interrupt_pending & CPU_INTERRUPT_NMI)
+        return;
+    nmi_cycle = clock_cpu_cycles;
+    cpu_interrupt_pending |= CPU_INTERRUPT_NMI;
+}
+
+/// Whether the interrupt poll `poll_delay` cycles before the current one saw an NMI
+static bool cpu_nmi_polled(uint64_t poll_delay)
+{
+    return (cpu_interrupt_pending & CPU_INTERRUPT_NMI) && nmi_cycle + poll_delay <= clock_cpu_cycles;
+}
+
+/**
+ * Vector of the BRK sequence running, looked up on its 6th cycle. An NMI polled on the 4th takes over the sequence,
+ * even BRK's, and is serviced by it.
+ */
+static uint16_t cpu_interrupt_vector()
+{
+    if (!cpu_nmi_polled(2))
+        return IRQ_VEC_LO;
+    cpu_interrupt_pending &= ~CPU_INTERRUPT_NMI;
+    return NMI_VEC_LO;
+}
+
+/**
+ * Whether an interrupt sequence starts at this instruction boundary. Only called while cpu_interrupt_pending is
+ * non-zero, so none of this is on the common path.
+ *
+ * The 6502 polls its interrupt lines at the end of an instruction's second-to-last cycle, and what it saw there
+ * decides whether the next cycle fetches an opcode or starts an interrupt. An interrupt asserted later waits for the
+ * next boundary.
+ */
+static bool cpu_interrupt_due()
+{
+    uint8_t pending = cpu_interrupt_pending;
+    cpu_interrupt_pending &= ~(CPU_INTERRUPT_I_CHANGED | CPU_INTERRUPT_POLL_EARLY | CPU_INTERRUPT_SKIP_POLL);
+    if (pending & CPU_INTERRUPT_SKIP_POLL)
+        return false;
+
+    uint64_t poll_delay = pending & CPU_INTERRUPT_POLL_EARLY ? 3 : 2;
+    if (cpu_nmi_polled(poll_delay))
+        return true;
+    // CLI, SEI and PLP change I on their last cycle, so their poll saw the previous value
+    bool irq = pending & CPU_INTERRUPT_I_CHANGED ? cpu_irq_lines != 0 && cpu_registers.flag_i :
+                                                   (pending & CPU_INTERRUPT_IRQ) != 0;
+    return irq && irq_cycle + poll_delay <= clock_cpu_cycles;
+}
+
+
+/**
+ * Sets PC to the reset vector address and initiates CPU. Also works as the reset button mid-run: the instruction in
+ * progress is abandoned, and a halted CPU runs again.
  */
 void cpu_reset()
 {
+    // Reset is an interrupt too: it sets I, and resets the APU on the same chip
+    apu_reset();
+    cpu_registers.flag_i = 1;
+    cpu_interrupt_pending = 0;
+    update_irq_pending();
+    cpu_context.resume = RESUME_POINT_START;
+    cpu_context.hardware_interrupt = false;
+    cpu_halted = false;
+
     // Read reset vector and set pc to that address
     addr_bus = RST_VEC_LO;
     cpu_read();
@@ -121,99 +386,144 @@ uint16_t zero_page(uint8_t zp_addr) {
     return (uint16_t) zp_addr;
 }
 
-enum AddressingMode {
-    IMM = 0,  // R
-    ZP,       // RWM
-    ZP_X,     // RWM
-    ZP_Y,     // R
-    ABS,      // RWM
-    ABS_X,    // RWM
-    ABS_Y,    // RW
-    IND_X,    // RW
-    IND_Y,    // RW
-    ACC,      //   M
-    NUM_ADDRESSING_MODES
+#define OPCODE(instr, mode, rw, cycles) { true, instr, mode, rw, cycles }
+#define IMPLIED(cycles) { true, NUM_INSTRUCTIONS, IMPL, NONE, cycles }
+
+const struct cpu_opcode cpu_opcodes[0x100] = {
+    [0xA9] = OPCODE(LDA, IMM, READ, 2),
+    [0xA5] = OPCODE(LDA, ZP, READ, 3),
+    [0xB5] = OPCODE(LDA, ZP_X, READ, 4),
+    [0xAD] = OPCODE(LDA, ABS, READ, 4),
+    [0xBD] = OPCODE(LDA, ABS_X, READ, 4),
+    [0xB9] = OPCODE(LDA, ABS_Y, READ, 4),
+    [0xA1] = OPCODE(LDA, IND_X, READ, 6),
+    [0xB1] = OPCODE(LDA, IND_Y, READ, 5),
+
+    [0x69] = OPCODE(ADC, IMM, READ, 2),
+    [0x65] = OPCODE(ADC, ZP, READ, 3),
+    [0x75] = OPCODE(ADC, ZP_X, READ, 4),
+    [0x6D] = OPCODE(ADC, ABS, READ, 4),
+    [0x7D] = OPCODE(ADC, ABS_X, READ, 4),
+    [0x79] = OPCODE(ADC, ABS_Y, READ, 4),
+    [0x61] = OPCODE(ADC, IND_X, READ, 6),
+    [0x71] = OPCODE(ADC, IND_Y, READ, 5),
+
+    [0xA2] = OPCODE(LDX, IMM, READ, 2),
+    [0xA6] = OPCODE(LDX, ZP, READ, 3),
+    [0xB6] = OPCODE(LDX, ZP_Y, READ, 4),
+    [0xAE] = OPCODE(LDX, ABS, READ, 4),
+    [0xBE] = OPCODE(LDX, ABS_Y, READ, 4),
+
+    [0x86] = OPCODE(STX, ZP, WRITE, 3),
+    [0x96] = OPCODE(STX, ZP_Y, WRITE, 4),
+    [0x8E] = OPCODE(STX, ABS, WRITE, 4),
+
+    [0x24] = OPCODE(BIT, ZP, READ, 3),
+    [0x2C] = OPCODE(BIT, ABS, READ, 4),
+
+    [0x10] = OPCODE(BPL, REL, NONE, 2),
+    [0x30] = OPCODE(BMI, REL, NONE, 2),
+    [0x50] = OPCODE(BVC, REL, NONE, 2),
+    [0x70] = OPCODE(BVS, REL, NONE, 2),
+    [0x90] = OPCODE(BCC, REL, NONE, 2),
+    [0xB0] = OPCODE(BCS, REL, NONE, 2),
+    [0xD0] = OPCODE(BNE, REL, NONE, 2),
+    [0xF0] = OPCODE(BEQ, REL, NONE, 2),
+
+    [CLC] = IMPLIED(2), [SEC] = IMPLIED(2), [CLI] = IMPLIED(2), [SEI] = IMPLIED(2),
+    [CLV] = IMPLIED(2), [CLD] = IMPLIED(2), [SED] = IMPLIED(2),
+    [TAY] = IMPLIED(2), [TXA] = IMPLIED(2), [TAX] = IMPLIED(2), [TYA] = IMPLIED(2),
+    [TXS] = IMPLIED(2), [TSX] = IMPLIED(2),
+    [DEY] = IMPLIED(2), [INY] = IMPLIED(2), [INX] = IMPLIED(2), [DEX] = IMPLIED(2),
+    [NOP] = IMPLIED(2),
+    [PHP] = IMPLIED(3), [PLP] = IMPLIED(4),
+    [BRK] = IMPLIED(7), [RTI] = IMPLIED(6),
 };
 
-/**
- * All non-implied and non-relative address modes
- * @param opcode
- * @return
- */
-enum AddressingMode get_addressing_mode(uint8_t opcode)
+/// Lazy flags
+// Z, N and V are not stored as bits. Instead the operands that determine them are kept in plain bytes and the flags
+// are only derived when something looks at them (branches, PHP, interrupts, savestates).
+
+static inline void set_nz(uint8_t result)
 {
-    uint8_t addr_mode_bits = (opcode & 0b00011100) >> 2;
-    switch (addr_mode_bits)
-    {
-        case 0: return opcode & 1 ? IND_X : IMM;
-        case 1: return ZP;
-        case 2: return opcode & 1 ? IMM : ACC;
-        case 3: return ABS;
-        case 4: return IND_Y;
-        case 5: return ZP_X;
-        case 6: return ABS_Y;
-        case 7: return ABS_X;
-    }
-    exit(ERROR_CODE__OH_NO);
+    cpu_registers.flag_z_src = result;
+    cpu_registers.flag_n_src = result;
 }
 
-enum ReadWrite {
-    NONE = 0,
-    READ,
-    WRITE,
-    MODIFY,
-};
+/// Records the inputs of an addition; V is set iff both operands have the same sign and the result's sign differs
+static inline void set_v_inputs(uint8_t a, uint8_t b, uint8_t result)
+{
+    cpu_registers.flag_v_a = a;
+    cpu_registers.flag_v_b = b;
+    cpu_registers.flag_v_r = result;
+}
 
-enum Instruction
-{
-    LDX,
-    LDA,
-    LDY,
-    STX,
-    STA,
-    STY,
-    ADC,
-    BIT,
-    BPL,
-    BMI,
-    BVC,
-    BVS,
-    BCC,
-    BCS,
-    BNE,
-    BEQ,
-    NUM_INSTRUCTIONS
-};
+static inline void set_v(uint8_t v)
+{
+    set_v_inputs(v ? 0x80 : 0, v ? 0x80 : 0, 0);
+}
 
+static inline bool flag_z()
+{
+    return cpu_registers.flag_z_src == 0;
+}
 
-enum Instruction get_instr(const uint8_t opcode)
+static inline bool flag_n()
 {
-    if (!((opcode ^ 0b10100010) & 0b11100011)) { return LDX; }
-    if (!((opcode ^ 0b10100001) & 0b11100011)) { return LDA; }
-    if (!((opcode ^ 0b10000010) & 0b11100011)) { return STX; }
-    if (!((opcode ^ 0b01100001) & 0b11100011)) { return ADC; }
-    if (!((opcode ^ 0b00100100) & 0b11110111)) { return BIT; }
-    if (!((opcode ^ 0b00010000) & 0b00011111))  // Branching
-    {
-        switch (opcode >> 5)
-        {
-            case 0: return BPL;
-            case 1: return BMI;
-            case 2: return BVC;
-            case 3: return BVS;
-            case 4: return BCC;
-            case 5: return BCS;
-            case 6: return BNE;
-            case 7: return BEQ;
-        }
-    }
-    fprintf(stderr, "Unimplemented opcode encountered");
-    exit(ERROR_CODE__UNIMPLEMENTED);
+    return cpu_registers.flag_n_src >> 7;
+}
+
+static inline bool flag_v()
+{
+    return ((cpu_registers.flag_v_a ^ cpu_registers.flag_v_r) & (cpu_registers.flag_v_b ^ cpu_registers.flag_v_r)) >> 7;
 }
 
-bool is_branch_instr(const uint8_t opcode)
+uint8_t cpu_get_status()
 {
-    return !((opcode ^ 0b00010000) & 0b00011111);
+    flags sr = { .u8 = 0 };
+    sr.c = cpu_registers.flag_c;
+    sr.z = flag_z();
+    sr.i = cpu_registers.flag_i;
+    sr.d = cpu_registers.flag_d;
+    sr._ = 1;
+    sr.v = flag_v();
+    sr.n = flag_n();
+    return sr.u8;
+}
+
+void cpu_set_status(uint8_t status)
+{
+    flags sr = { .u8 = status };
+    cpu_registers.flag_c = sr.c;
+    cpu_registers.flag_z_src = !sr.z;
+    cpu_registers.flag_i = sr.i;
+    cpu_registers.flag_d = sr.d;
+    set_v(sr.v);
+    cpu_registers.flag_n_src = sr.n << 7;
+    update_irq_pending();
+}
+
+/// For CLI and SEI, which change I after their interrupt poll; PLP does the same around cpu_set_status()
+static inline void set_i_after_poll(uint8_t flag_i)
+{
+    if (flag_i != cpu_registers.flag_i)
+        cpu_interrupt_pending |= CPU_INTERRUPT_I_CHANGED;
+    cpu_registers.flag_i = flag_i;
+    update_irq_pending();
+}
+
+static inline void push(uint8_t value)
+{
+    addr_bus = STACK_PAGE_START | cpu_registers.sp;
+    data_bus = value;
+    cpu_write();
+    cpu_registers.sp--;
+}
+
+static inline void pull()
+{
+    addr_bus = STACK_PAGE_START | cpu_registers.sp;
+    cpu_read();
 }
 
 void read_pc() {
@@ -221,10 +531,12 @@ void read_pc() {
     cpu_read();
 }
 
-#define BEGIN_RESUMABLE static size_t resume_location = __LINE__; switch (resume_location) { case __LINE__:;
-#define END_CYCLE resume_location = __LINE__; return; case __LINE__:;
-#define RES_CALL(call_statement) resume_location = __LINE__; case __LINE__:; if (!call_statement) { return false; }
-#define END_RESUMABLE default: exit(-1); }
+/// Does nothing; being due is enough to make emu_run_frame() look at cpu_halted
+static void cpu_halt_event()
+{
+}
+
+
 /**
  * Runs a single cycle of the CPU.
  *
@@ -236,14 +548,28 @@ void read_pc() {
  */
 void cpu_cycle()
 {
-    BEGIN_RESUMABLE
+    struct cpu_context* ctx = &cpu_context;
+    BEGIN_RESUMABLE(ctx->resume)
     while (1) {
-        read_pc();
-        cpu_registers.pc++;
+        if (cpu_interrupt_pending != 0 && cpu_interrupt_due())
+        {
+            // IRQ and NMI run BRK's sequence, with the opcode fetch thrown away
+            read_pc();
+            ctx->hardware_interrupt = true;
 
-        END_CYCLE
+            END_CYCLE
 
-        cpu_ir = data_bus;
+            cpu_ir = BRK;
+        }
+        else
+        {
+            cpu_fetch();
+            cpu_registers.pc++;
+
+            END_CYCLE
+
+            cpu_ir = data_bus;
+        }
 
         // ================ Implied ================= //
         // NOTE: No switch statement because of END_CYCLE
@@ -251,57 +577,57 @@ void cpu_cycle()
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.c = 0;
+            cpu_registers.flag_c = 0;
             continue;
         }
         else if (cpu_ir == SEC)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.c = 1;
+            cpu_registers.flag_c = 1;
             continue;
         }
         else if (cpu_ir == CLI)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.i = 0;
+            set_i_after_poll(0);
             continue;
         }
         else if (cpu_ir == SEI)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.i = 1;
+            set_i_after_poll(1);
             continue;
         }
         else if (cpu_ir == CLV)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.v = 0;
+            set_v(0);
             continue;
         }
         else if (cpu_ir == CLD)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.d = 0;
+            cpu_registers.flag_d = 0;
             continue;
         }
         else if (cpu_ir == SED)
         {
             read_pc();
             END_CYCLE
-            cpu_registers.sr.d = 0;
+            cpu_registers.flag_d = 1;
             continue;
         }
         else if (cpu_ir == TAY)
         {
             read_pc();
+            END_CYCLE
             cpu_registers.idx_y = cpu_registers.acc;
-            cpu_registers.sr.z = cpu_registers.idx_y == 0;
-            cpu_registers.sr.n = cpu_registers.idx_y >> 7;
+            set_nz(cpu_registers.idx_y);
             continue;
         }  // NOTE: I'm not sure if flags are for the result of the copy or the value before the copy
         else if (cpu_ir == TXA)
@@ -309,8 +635,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.acc = cpu_registers.idx_x;
-            cpu_registers.sr.z = cpu_registers.acc == 0;
-            cpu_registers.sr.n = cpu_registers.acc >> 7;
+            set_nz(cpu_registers.acc);
             continue;
         }
         else if (cpu_ir == TAX)
@@ -318,8 +643,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_x = cpu_registers.acc;
-            cpu_registers.sr.z = cpu_registers.idx_x == 0;
-            cpu_registers.sr.n = cpu_registers.idx_x >> 7;
+            set_nz(cpu_registers.idx_x);
             continue;
         }
         else if (cpu_ir == TYA)
@@ -327,8 +651,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.acc = cpu_registers.idx_y;
-            cpu_registers.sr.z = cpu_registers.acc == 0;
-            cpu_registers.sr.n = cpu_registers.acc >> 7;
+            set_nz(cpu_registers.acc);
             continue;
         }
         else if (cpu_ir == TXS)
@@ -343,8 +666,30 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_x = cpu_registers.sp;
-            cpu_registers.sr.z = cpu_registers.idx_x == 0;
-            cpu_registers.sr.n = cpu_registers.idx_x >> 7;
+            set_nz(cpu_registers.idx_x);
+            continue;
+        }
+        else if (cpu_ir == PHP)
+        {
+            read_pc();
+            END_CYCLE
+            push(cpu_get_status() | STATUS_B);
+            END_CYCLE
+            continue;
+        }
+        else if (cpu_ir == PLP)
+        {
+            read_pc();
+            END_CYCLE
+            pull();  // dummy read while incrementing sp
+            cpu_registers.sp++;
+            END_CYCLE
+            pull();
+            END_CYCLE
+            uint8_t flag_i = cpu_registers.flag_i;
+            cpu_set_status(data_bus);
+            if (cpu_registers.flag_i != flag_i)
+                cpu_interrupt_pending |= CPU_INTERRUPT_I_CHANGED;
             continue;
         }
         else if (cpu_ir == DEY)
@@ -352,8 +697,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_y--;
-            cpu_registers.sr.z = cpu_registers.idx_y == 0;
-            cpu_registers.sr.n = cpu_registers.idx_y >> 7;
+            set_nz(cpu_registers.idx_y);
             continue;
         }
         else if (cpu_ir == INY)
@@ -361,8 +705,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_y++;
-            cpu_registers.sr.z = cpu_registers.idx_y == 0;
-            cpu_registers.sr.n = cpu_registers.idx_y >> 7;
+            set_nz(cpu_registers.idx_y);
             continue;
         }
         else if (cpu_ir == INX)
@@ -370,8 +713,7 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_x++;
-            cpu_registers.sr.z = cpu_registers.idx_x == 0;
-            cpu_registers.sr.n = cpu_registers.idx_x >> 7;
+            set_nz(cpu_registers.idx_x);
             continue;
         }
         else if (cpu_ir == DEX)
@@ -379,23 +721,75 @@ void cpu_cycle()
             read_pc();
             END_CYCLE
             cpu_registers.idx_x--;
-            cpu_registers.sr.z = cpu_registers.idx_x == 0;
-            cpu_registers.sr.n = cpu_registers.idx_x >> 7;
+            set_nz(cpu_registers.idx_x);
+            continue;
+        }
+        else if (cpu_ir == BRK)
+        {
+            read_pc();  // BRK skips the byte after it; IRQ and NMI return to the instruction they interrupted
+            if (!ctx->hardware_interrupt)
+                cpu_registers.pc++;
+            END_CYCLE
+            push(get_high_byte(cpu_registers.pc));
+            END_CYCLE
+            push(get_low_byte(cpu_registers.pc));
+            END_CYCLE
+            push(cpu_get_status() | (ctx->hardware_interrupt ? 0 : STATUS_B));
+            END_CYCLE
+            addr_bus = cpu_interrupt_vector();
+            cpu_read();
+            cpu_registers.flag_i = 1;
+            update_irq_pending();
+            END_CYCLE
+            set_low_byte(&cpu_addr_latch, data_bus);
+            addr_bus++;
+            cpu_read();
+            END_CYCLE
+            set_high_byte(&cpu_addr_latch, data_bus);
+            cpu_registers.pc = cpu_addr_latch;
+            ctx->hardware_interrupt = false;
+            cpu_interrupt_pending |= CPU_INTERRUPT_SKIP_POLL;
+            continue;
+        }
+        else if (cpu_ir == RTI)
+        {
+            read_pc();
+            END_CYCLE
+            pull();  // dummy read while incrementing sp
+            cpu_registers.sp++;
+            END_CYCLE
+            pull();
+            cpu_registers.sp++;
+            END_CYCLE
+            cpu_set_status(data_bus);  // unlike PLP, before the interrupt poll
+            pull();
+            cpu_registers.sp++;
+            END_CYCLE
+            set_low_byte(&cpu_registers.pc, data_bus);
+            pull();
+            END_CYCLE
+            set_high_byte(&cpu_registers.pc, data_bus);
             continue;
         }
 
 
-        enum AddressingMode addr_mode;
-        static enum Instruction instr;
-        static enum ReadWrite rw = NONE;
-
-        static bool page_cross = false;
-
-        addr_mode = get_addressing_mode(cpu_ir);
-        instr = get_instr(cpu_ir);
+        const struct cpu_opcode* opcode = &cpu_opcodes[cpu_ir];
+        if (!opcode->implemented)
+        {
+            // Hang here; the scheduler event gets emu_run_frame() to look at cpu_halted after this cycle
+            cpu_halted = true;
+            clock_schedule(CLOCK_EVENT_CPU_HALT, clock_cpu_cycles + 1, cpu_halt_event);
+            while (1)
+            {
+                END_CYCLE
+            }
+        }
+        ctx->instr = opcode->instr;
+        ctx->addr_mode = opcode->addr_mode;
+        ctx->rw = opcode->rw;
 
         // If branch instr, addressing mode is a branch-only mode called "relative"; forego usual control flow
-        if (is_branch_instr(cpu_ir))
+        if (ctx->addr_mode == REL)
         {
             // Fetch operand
             read_pc();
@@ -403,64 +797,47 @@ void cpu_cycle()
 
             END_CYCLE
 
-            if (instr == BPL && !cpu_registers.sr.n ||
-                instr == BMI && cpu_registers.sr.n ||
-                instr == BVC && !cpu_registers.sr.v ||
-                instr == BVS && cpu_registers.sr.v ||
-                instr == BCC && !cpu_registers.sr.c ||
-                instr == BCS && cpu_registers.sr.c ||
-                instr == BNE && !cpu_registers.sr.z ||
-                instr == BEQ && cpu_registers.sr.z)
+            if ((ctx->instr == BPL && !flag_n()) ||
+                (ctx->instr == BMI && flag_n()) ||
+                (ctx->instr == BVC && !flag_v()) ||
+                (ctx->instr == BVS && flag_v()) ||
+                (ctx->instr == BCC && !cpu_registers.flag_c) ||
+                (ctx->instr == BCS && cpu_registers.flag_c) ||
+                (ctx->instr == BNE && !flag_z()) ||
+                (ctx->instr == BEQ && flag_z()))
             {
                 int8_t offset = (int8_t) data_bus;
                 read_pc();  // dummy read
-                static uint16_t true_addr;
-                true_addr = cpu_registers.pc + offset;
-                set_low_byte(&cpu_registers.pc, get_low_byte(true_addr));
+                ctx->branch_target = cpu_registers.pc + offset;
+                set_low_byte(&cpu_registers.pc, get_low_byte(ctx->branch_target));
 
                 END_CYCLE
 
-                if (cpu_registers.pc != true_addr)
+                if (cpu_registers.pc != ctx->branch_target)
                 {
                     read_pc();  // dummy read
-                    set_high_byte(&cpu_registers.pc, get_high_byte(true_addr));
+                    set_high_byte(&cpu_registers.pc, get_high_byte(ctx->branch_target));
 
                     END_CYCLE
                 }
+                else if (cpu_interrupt_pending != 0)
+                {
+                    // Taken branches within the page only poll before their operand fetch
+                    cpu_interrupt_pending |= CPU_INTERRUPT_POLL_EARLY;
+                }
             }
 
             continue;
         }
 
-        rw = NONE;
-        if (instr == LDX)
-        {
-            rw = READ;
-            if (addr_mode == ZP_X) { addr_mode = ZP_Y; }
-            if (addr_mode == ABS_X) { addr_mode = ABS_Y; }
-        }
-        if (instr == STX)
-        {
-            rw = WRITE;
-            if (addr_mode == ZP_X) { addr_mode = ZP_Y; }
-            if (addr_mode == ABS_X || addr_mode == ACC || addr_mode == IND_Y || addr_mode == ABS_Y) {
-                exit(ERROR_CODE__UNIMPLEMENTED);
-            }
-        }
-        if (instr == BIT)
-        {
-            rw = READ;
-            if (addr_mode != ZP_X && addr_mode != ABS) { exit(ERROR_CODE__OH_NO); }
-        }
+        ctx->page_cross = false;
 
-        page_cross = false;
-
-        if (addr_mode == IMM)
+        if (ctx->addr_mode == IMM)
         {
             addr_bus = cpu_registers.pc;
             cpu_registers.pc++;
         }
-        else if (addr_mode == ZP)
+        else if (ctx->addr_mode == ZP)
         {
             read_pc();
             cpu_registers.pc++;
@@ -469,7 +846,7 @@ void cpu_cycle()
 
             addr_bus = zero_page(data_bus);
         }
-        else if (addr_mode == ABS)
+        else if (ctx->addr_mode == ABS)
         {
             read_pc();
             cpu_registers.pc++;
@@ -485,7 +862,7 @@ void cpu_cycle()
             set_high_byte(&cpu_addr_latch, data_bus);
             addr_bus = cpu_addr_latch;
         }
-        else if (addr_mode == ZP_X)
+        else if (ctx->addr_mode == ZP_X)
         {
             read_pc();
             cpu_registers.pc++;
@@ -500,7 +877,7 @@ void cpu_cycle()
 
             addr_bus = cpu_addr_latch;
         }
-        else if (addr_mode == ZP_Y)
+        else if (ctx->addr_mode == ZP_Y)
         {
             read_pc();
             cpu_registers.pc++;
@@ -515,7 +892,7 @@ void cpu_cycle()
 
             addr_bus = cpu_addr_latch;
         }
-        else if (addr_mode == ABS_X)
+        else if (ctx->addr_mode == ABS_X)
         {
             read_pc();
             cpu_registers.pc++;
@@ -529,11 +906,12 @@ void cpu_cycle()
             END_CYCLE
 
             set_high_byte(&cpu_addr_latch, data_bus);
-            page_cross = get_low_byte(cpu_addr_latch) + cpu_registers.idx_x < get_low_byte(cpu_addr_latch);
-            set_low_byte(&cpu_addr_latch, get_low_byte(cpu_addr_latch) + cpu_registers.idx_x);
+            uint8_t low = get_low_byte(cpu_addr_latch) + cpu_registers.idx_x;
+            ctx->page_cross = low < get_low_byte(cpu_addr_latch);
+            set_low_byte(&cpu_addr_latch, low);
             addr_bus = cpu_addr_latch;
 
-            if (page_cross)
+            if (ctx->page_cross)
             {
                 cpu_read();
 
@@ -543,7 +921,7 @@ void cpu_cycle()
                 addr_bus = cpu_addr_latch;
             }
         }
-        else if (addr_mode == ABS_Y)
+        else if (ctx->addr_mode == ABS_Y)
         {
             read_pc();
             cpu_registers.pc++;
@@ -557,11 +935,12 @@ void cpu_cycle()
             END_CYCLE
 
             set_high_byte(&cpu_addr_latch, data_bus);
-            page_cross = get_low_byte(cpu_addr_latch) + cpu_registers.idx_y < get_low_byte(cpu_addr_latch);
-            set_low_byte(&cpu_addr_latch, get_low_byte(cpu_addr_latch) + cpu_registers.idx_y);
+            uint8_t low = get_low_byte(cpu_addr_latch) + cpu_registers.idx_y;
+            ctx->page_cross = low < get_low_byte(cpu_addr_latch);
+            set_low_byte(&cpu_addr_latch, low);
             addr_bus = cpu_addr_latch;
 
-            if (page_cross)
+            if (ctx->page_cross)
             {
                 cpu_read();
 
@@ -571,7 +950,7 @@ void cpu_cycle()
                 addr_bus = cpu_addr_latch;
             }
         }
-        else if (addr_mode == IND_X)
+        else if (ctx->addr_mode == IND_X)
         {
             read_pc();
             cpu_registers.pc++;
@@ -598,7 +977,7 @@ void cpu_cycle()
             set_high_byte(&cpu_addr_latch, data_bus);
             addr_bus = cpu_addr_latch;
         }
-        else if (addr_mode == IND_Y)
+        else if (ctx->addr_mode == IND_Y)
         {
             read_pc();
             cpu_registers.pc++;
@@ -610,7 +989,7 @@ void cpu_cycle()
 
             END_CYCLE
 
-            page_cross = data_bus + cpu_registers.idx_y < data_bus;
+            ctx->page_cross = (uint8_t) (data_bus + cpu_registers.idx_y) < data_bus;
             set_low_byte(&cpu_addr_latch, data_bus + cpu_registers.idx_y);
             addr_bus++;
             cpu_read();
@@ -620,7 +999,7 @@ void cpu_cycle()
             set_high_byte(&cpu_addr_latch, data_bus);
             addr_bus = cpu_addr_latch;
 
-            if (page_cross)
+            if (ctx->page_cross)
             {
                 cpu_read();
                 set_high_byte(&cpu_addr_latch, get_high_byte(cpu_addr_latch) + 1);
@@ -635,18 +1014,18 @@ void cpu_cycle()
             // FIXME: erm
         }
 
-        if (rw == READ)
+        if (ctx->rw == READ)
         {
             cpu_read();
         }
 
         // Load write instruction values into data_bus
-        if (instr == STX)
+        if (ctx->instr == STX)
         {
             data_bus = cpu_registers.idx_x;
         }
 
-        if (rw == WRITE)
+        if (ctx->rw == WRITE)
         {
             cpu_write();
         }
@@ -654,31 +1033,56 @@ void cpu_cycle()
         END_CYCLE
 
         // Read instruction last-cycle behaviors
-        if (instr == ADC)
+        if (ctx->instr == ADC)
         {
-            cpu_registers.sr.v = (cpu_registers.acc + data_bus + cpu_registers.sr.c < cpu_registers.acc);
-            cpu_registers.acc += data_bus + cpu_registers.sr.c;
-            cpu_registers.sr.z = cpu_registers.acc == 0;
-            cpu_registers.sr.c = cpu_registers.sr.v;
-            cpu_registers.sr.n = cpu_registers.acc >> 7;
+            uint16_t sum = cpu_registers.acc + data_bus + cpu_registers.flag_c;
+            set_v_inputs(cpu_registers.acc, data_bus, (uint8_t) sum);
+            cpu_registers.flag_c = sum >> 8;
+            cpu_registers.acc = (uint8_t) sum;
+            set_nz(cpu_registers.acc);
         }
 
-        else if (instr == LDA)
+        else if (ctx->instr == LDA)
         {
             cpu_registers.acc = data_bus;
+            set_nz(cpu_registers.acc);
         }
 
-        else if (instr == LDX)
+        else if (ctx->instr == LDX)
         {
             cpu_registers.idx_x = data_bus;
+            set_nz(cpu_registers.idx_x);
         }
 
-        else if (instr == BIT)
+        else if (ctx->instr == BIT)
         {
-            cpu_registers.sr.z = ((cpu_registers.acc & data_bus) == 0);
-            cpu_registers.sr.v = (data_bus & 0x40) >> 6;
-            cpu_registers.sr.n = data_bus >> 7;
+            cpu_registers.flag_z_src = cpu_registers.acc & data_bus;
+            cpu_registers.flag_n_src = data_bus;
+            set_v((data_bus & 0x40) >> 6);
         }
     }
     END_RESUMABLE
-}
\ No newline at end of file
+}
+
+
+void cpu_state(struct state* state)
+{
+    STATE_FIELD(state, cpu_registers);
+    STATE_CODE_POINTER(state, cpu_context.resume);
+    STATE_FIELD(state, cpu_context.instr);
+    STATE_FIELD(state, cpu_context.rw);
+    STATE_FIELD(state, cpu_context.addr_mode);
+    STATE_FIELD(state, cpu_context.page_cross);
+    STATE_FIELD(state, cpu_context.branch_target);
+    STATE_FIELD(state, cpu_context.hardware_interrupt);
+    STATE_FIELD(state, cpu_irq_lines);
+    STATE_FIELD(state, cpu_interrupt_pending);
+    STATE_FIELD(state, irq_cycle);
+    STATE_FIELD(state, nmi_cycle);
+    STATE_FIELD(state, cpu_ir);
+    STATE_FIELD(state, cpu_addr_latch);
+    STATE_FIELD(state, cpu_halted);
+    STATE_FIELD(state, addr_bus);
+    STATE_FIELD(state, data_bus);
+    STATE_FIELD(state, ram);
+}
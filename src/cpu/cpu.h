@@ -6,6 +6,8 @@
 #define NES_EMULATOR__CPU_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include "resumable.h"
 // TODO: sort out private and public variables, organize
 
 /// Instruction bytes
@@ -33,6 +35,12 @@
 
 #define NOP 0xEA
 
+#define PHP 0x08
+#define PLP 0x28
+
+#define BRK 0x00
+#define RTI 0x40
+
 /// ===================== READ Instructions ======================
 
 #define NMI_VEC_LO 0xFFFA
@@ -44,6 +52,65 @@ static const uint16_t RST_VEC_HI = 0xFFFD;
 
 #define STACK_PAGE_START 0x0100
 
+enum AddressingMode {
+    IMM = 0,  // R
+    ZP,       // RWM
+    ZP_X,     // RWM
+    ZP_Y,     // R
+    ABS,      // RWM
+    ABS_X,    // RWM
+    ABS_Y,    // RW
+    IND_X,    // RW
+    IND_Y,    // RW
+    ACC,      //   M
+    IMPL,     // implied: no operand
+    REL,      // branches
+    NUM_ADDRESSING_MODES
+};
+
+enum ReadWrite {
+    NONE = 0,
+    READ,
+    WRITE,
+    MODIFY,
+};
+
+/// Instructions with a memory operand or a branch offset. Implied instructions are identified by their opcode.
+enum Instruction
+{
+    LDX,
+    LDA,
+    LDY,
+    STX,
+    STA,
+    STY,
+    ADC,
+    BIT,
+    BPL,
+    BMI,
+    BVC,
+    BVS,
+    BCC,
+    BCS,
+    BNE,
+    BEQ,
+    NUM_INSTRUCTIONS
+};
+
+/**
+ * Opcode decode table entry
+ */
+struct cpu_opcode
+{
+    bool implemented;
+    uint8_t instr;      /// enum Instruction; NUM_INSTRUCTIONS for implied instructions
+    uint8_t addr_mode;  /// enum AddressingMode
+    uint8_t rw;         /// enum ReadWrite of the memory operand
+    uint8_t cycles;     /// Without the page-crossing and taken-branch penalties
+};
+
+extern const struct cpu_opcode cpu_opcodes[0x100];
+
 /**
  * CPU status register flags
  */
@@ -63,8 +130,15 @@ typedef union
     uint8_t u8;
 } flags;
 
+/// Status register bits that only exist when the status is pushed to the stack
+#define STATUS_B 0x10
+
 /**
  * CPU registers
+ *
+ * The status register is not stored as a byte. C, I and D are plain 0/1 bytes, while Z, N and V are kept as the
+ * values they are derived from, so instructions don't have to update bitfields. Use cpu_get_status() and
+ * cpu_set_status() for the architectural P byte.
  */
 struct cpu_registers
 {
@@ -73,11 +147,41 @@ struct cpu_registers
     uint8_t acc;    /// accumulator
     uint8_t idx_x;  /// index x
     uint8_t idx_y;  /// index y
-    flags sr;       /// flags
+
+    uint8_t flag_c;      /// carry (0 or 1)
+    uint8_t flag_i;      /// interrupt disable (0 or 1)
+    uint8_t flag_d;      /// decimal (0 or 1)
+    uint8_t flag_z_src;  /// Z is set iff this is 0
+    uint8_t flag_n_src;  /// N is bit 7 of this
+    uint8_t flag_v_a;    /// V is bit 7 of (flag_v_a ^ flag_v_r) & (flag_v_b ^ flag_v_r), i.e. signed overflow of a + b
+    uint8_t flag_v_b;
+    uint8_t flag_v_r;
 };
 
 extern struct cpu_registers cpu_registers;
 
+/**
+ * Where cpu_cycle() is within the current instruction, plus the in-flight instruction state that has to survive
+ * from one cycle to the next.
+ */
+struct cpu_context
+{
+    resume_point resume;
+    uint8_t instr;           /// enum Instruction being executed
+    uint8_t rw;              /// enum ReadWrite of its memory operand
+    uint8_t addr_mode;       /// enum AddressingMode of its memory operand
+    bool page_cross;         /// Indexed address crossed a page; needs the fix-up cycle
+    uint16_t branch_target;  /// Destination of a taken branch
+    bool hardware_interrupt; /// The BRK sequence running is an IRQ or NMI
+};
+
+extern struct cpu_context cpu_context;
+
+#define RAM_SIZE 0x0800  // 2kB
+
+/// Internal CPU RAM (0x0000-0x07FF)
+extern uint8_t ram[RAM_SIZE];
+
 /// Instruction register
 extern uint8_t cpu_ir;
 
@@ -89,6 +193,93 @@ extern uint16_t cpu_addr_latch;
 
 uint8_t* cpu_mem_map(uint16_t addr);
 extern uint8_t* (*cpu_cartridge_space_map)(uint16_t addr);
+/// Cartridge RAM the CPU writes to directly (PRG-RAM), NULL elsewhere and when unset; all other writes to cartridge
+/// space take the slow path, where mappers see them
+extern uint8_t* (*cpu_cartridge_ram_map)(uint16_t addr);
+
+#define CPU_PAGE_SIZE 0x100
+#define CPU_NUM_PAGES 0x100
+
+/**
+ * Page table of the CPU address space. A non-NULL entry points at the 256 bytes backing that page and is accessed
+ * directly; NULL pages (registers, mapper ports, open bus, trapped pages) go through cpu_mem_map() and the register
+ * handlers. Opcode fetches use their own table so that execution can be trapped separately from reads.
+ */
+extern uint8_t* cpu_read_pages[CPU_NUM_PAGES];
+extern uint8_t* cpu_write_pages[CPU_NUM_PAGES];
+extern uint8_t* cpu_fetch_pages[CPU_NUM_PAGES];
+
+/// Read page table as mapped by the cartridge, without traps. For accesses that must not trigger them (DMA).
+extern uint8_t* cpu_mapped_read_pages[CPU_NUM_PAGES];
+
+/**
+ * Rebuilds the page table. Call after loading a cartridge and whenever the mapper switches banks.
+ */
+void cpu_map_pages();
+
+/// Trap bits: accesses of that kind to a page take the slow path and are reported to cpu_trap_handler
+#define CPU_TRAP_READ 0x01
+#define CPU_TRAP_WRITE 0x02
+#define CPU_TRAP_FETCH 0x04
+
+extern uint8_t cpu_page_traps[CPU_NUM_PAGES];
+
+/**
+ * Called after every access to a trapped page, with the value read or written (the opcode, for fetches). Runs in the
+ * middle of a CPU cycle.
+ */
+extern void (*cpu_trap_handler)(uint8_t trap, uint16_t addr, uint8_t value);
+
+/**
+ * Re-applies cpu_page_traps to the page table. Call after changing them.
+ */
+void cpu_apply_page_traps();
+
+/// Interrupts
+// https://www.nesdev.org/wiki/CPU_interrupts
+// Sources assert and release their lines here when their state changes (from the PPU, or from scheduler events), and
+// cpu_cycle() looks at cpu_interrupt_pending once per instruction boundary, only doing more when it is non-zero.
+
+/// IRQ sources. IRQ is level-triggered: it is taken while any of them is asserted and I is clear.
+#define CPU_IRQ_APU_FRAME 0x01
+#define CPU_IRQ_DMC 0x02
+#define CPU_IRQ_MAPPER 0x04
+
+/// cpu_interrupt_pending bits
+#define CPU_INTERRUPT_IRQ 0x01         /// Some IRQ source is asserted and I is clear
+#define CPU_INTERRUPT_NMI 0x02         /// An NMI edge was detected and not serviced yet
+#define CPU_INTERRUPT_I_CHANGED 0x04   /// The last instruction (CLI, SEI, PLP) changed I after its interrupt poll
+#define CPU_INTERRUPT_POLL_EARLY 0x08  /// The last instruction (a taken branch) polled a cycle earlier than usual
+#define CPU_INTERRUPT_SKIP_POLL 0x10   /// An interrupt sequence just ended; its handler's first instruction runs first
+
+/// Asserted IRQ sources
+extern uint8_t cpu_irq_lines;
+
+/// Non-zero when the next instruction boundary has to look at interrupts
+extern uint8_t cpu_interrupt_pending;
+
+/**
+ * Asserts an IRQ source's line. It stays asserted until released, whether or not the IRQ is taken.
+ */
+void cpu_irq_assert(uint8_t source);
+
+void cpu_irq_release(uint8_t source);
+
+/**
+ * Signals an NMI edge (the PPU's /NMI output going low). It is serviced once, at the next instruction boundary that
+ * polled it.
+ */
+void cpu_nmi();
+
+/**
+ * Reads a byte on behalf of a DMA unit: no register side effects and no change to the CPU's buses.
+ */
+uint8_t cpu_dma_read(uint16_t addr);
+
+/**
+ * OAM DMA (write to 0x4014): copies the given CPU page into OAM and halts the CPU for 513/514 cycles.
+ */
+void cpu_oam_dma(uint8_t page);
 
 /// Sends read signal to memory bus
 void cpu_read();
@@ -98,7 +289,33 @@ void cpu_write();
 
 /** =================================================== */
 
+/**
+ * Materializes the P register (B clear, unused bit set).
+ */
+uint8_t cpu_get_status();
+
+/**
+ * Loads the P register, e.g. from a savestate. B and the unused bit are ignored.
+ */
+void cpu_set_status(uint8_t status);
+
+/**
+ * Power-on or reset button: jumps through the reset vector with I set. Between cpu_cycle() calls, abandoning the
+ * instruction in progress.
+ */
 void cpu_reset();
 void cpu_cycle();
 
+/**
+ * Set when the CPU fetches an opcode it does not implement. Instead of ending the process, it stays on that
+ * instruction, and emu_run_frame() returns false, until cpu_reset() or loading a state saved before it. cpu_ir holds
+ * the opcode, and cpu_registers.pc points one past it.
+ */
+extern bool cpu_halted;
+
+struct state;
+
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void cpu_state(struct state* state);
+
 #endif //NES_EMULATOR__CPU_H
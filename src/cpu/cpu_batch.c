@@ -0,0 +1,537 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "cpu_batch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exit_codes.h"
+
+
+#define BATCH_RAM_UPPER 0x2000
+#define BATCH_RAM_MASK (RAM_SIZE - 1)
+
+/// Comparison results: all bits set in lanes where the comparison holds
+typedef int8_t batch_mask __attribute__((vector_size(CPU_BATCH_LANES)));
+typedef int16_t batch_mask16 __attribute__((vector_size(2 * CPU_BATCH_LANES)));
+
+#define BROADCAST_U8(value) ((batch_u8) { 0 } + (uint8_t) (value))
+#define BROADCAST_U16(value) ((batch_u16) { 0 } + (uint16_t) (value))
+
+
+/// ================ Single lane ================
+
+static uint8_t lane_read(struct cpu_batch* batch, unsigned lane, uint16_t addr)
+{
+    if (addr < BATCH_RAM_UPPER)
+        return batch->ram[addr & BATCH_RAM_MASK][lane];
+    const uint8_t* page = cpu_mapped_read_pages[addr >> 8];
+    if (page != NULL)
+        return page[addr & 0xFF];
+    return batch->io_read != NULL ? batch->io_read(batch->user, lane, addr) : 0;
+}
+
+static void lane_write(struct cpu_batch* batch, unsigned lane, uint16_t addr, uint8_t value)
+{
+    if (addr < BATCH_RAM_UPPER)
+        batch->ram[addr & BATCH_RAM_MASK][lane] = value;
+    else if (batch->io_write != NULL)
+        batch->io_write(batch->user, lane, addr, value);
+}
+
+static uint16_t lane_read_u16(struct cpu_batch* batch, unsigned lane, uint16_t addr)
+{
+    return lane_read(batch, lane, addr) | (uint16_t) (lane_read(batch, lane, addr + 1) << 8);
+}
+
+/// Pointer in zero page; the high byte wraps around within it
+static uint16_t lane_read_zp_u16(struct cpu_batch* batch, unsigned lane, uint8_t zp_addr)
+{
+    return lane_read(batch, lane, zp_addr) | (uint16_t) (lane_read(batch, lane, (uint8_t) (zp_addr + 1)) << 8);
+}
+
+static void lane_set_nz(struct cpu_batch* batch, unsigned lane, uint8_t result)
+{
+    batch->flag_z_src[lane] = result;
+    batch->flag_n_src[lane] = result;
+}
+
+static bool lane_flag_v(const struct cpu_batch* batch, unsigned lane)
+{
+    uint8_t r = batch->flag_v_r[lane];
+    return ((batch->flag_v_a[lane] ^ r) & (batch->flag_v_b[lane] ^ r)) >> 7;
+}
+
+uint8_t cpu_batch_get_status(const struct cpu_batch* batch, unsigned lane)
+{
+    flags sr = { .u8 = 0 };
+    sr.c = batch->flag_c[lane];
+    sr.z = batch->flag_z_src[lane] == 0;
+    sr.i = batch->flag_i[lane];
+    sr.d = batch->flag_d[lane];
+    sr._ = 1;
+    sr.v = lane_flag_v(batch, lane);
+    sr.n = batch->flag_n_src[lane] >> 7;
+    return sr.u8;
+}
+
+static void lane_set_status(struct cpu_batch* batch, unsigned lane, uint8_t status)
+{
+    flags sr = { .u8 = status };
+    batch->flag_c[lane] = sr.c;
+    batch->flag_z_src[lane] = !sr.z;
+    batch->flag_i[lane] = sr.i;
+    batch->flag_d[lane] = sr.d;
+    batch->flag_v_a[lane] = sr.v ? 0x80 : 0;
+    batch->flag_v_b[lane] = sr.v ? 0x80 : 0;
+    batch->flag_v_r[lane] = 0;
+    batch->flag_n_src[lane] = sr.n << 7;
+}
+
+static bool lane_branch_taken(const struct cpu_batch* batch, unsigned lane, uint8_t instr)
+{
+    switch (instr)
+    {
+        case BPL: return !(batch->flag_n_src[lane] >> 7);
+        case BMI: return batch->flag_n_src[lane] >> 7;
+        case BVC: return !lane_flag_v(batch, lane);
+        case BVS: return lane_flag_v(batch, lane);
+        case BCC: return !batch->flag_c[lane];
+        case BCS: return batch->flag_c[lane];
+        case BNE: return batch->flag_z_src[lane] != 0;
+        case BEQ: return batch->flag_z_src[lane] == 0;
+        default: exit(ERROR_CODE__OH_NO);
+    }
+}
+
+/// @return false, having changed nothing, if this core does not implement the instruction
+static bool lane_implied(struct cpu_batch* batch, unsigned lane, uint8_t opcode)
+{
+    switch (opcode)
+    {
+        case CLC: batch->flag_c[lane] = 0; break;
+        case SEC: batch->flag_c[lane] = 1; break;
+        case CLI: batch->flag_i[lane] = 0; break;
+        case SEI: batch->flag_i[lane] = 1; break;
+        case CLD: batch->flag_d[lane] = 0; break;
+        case SED: batch->flag_d[lane] = 1; break;
+        case CLV:
+            batch->flag_v_a[lane] = 0;
+            batch->flag_v_b[lane] = 0;
+            batch->flag_v_r[lane] = 0;
+            break;
+        case TAY: batch->idx_y[lane] = batch->acc[lane]; lane_set_nz(batch, lane, batch->idx_y[lane]); break;
+        case TXA: batch->acc[lane] = batch->idx_x[lane]; lane_set_nz(batch, lane, batch->acc[lane]); break;
+        case TAX: batch->idx_x[lane] = batch->acc[lane]; lane_set_nz(batch, lane, batch->idx_x[lane]); break;
+        case TYA: batch->acc[lane] = batch->idx_y[lane]; lane_set_nz(batch, lane, batch->acc[lane]); break;
+        case TXS: batch->sp[lane] = batch->idx_x[lane]; break;
+        case TSX: batch->idx_x[lane] = batch->sp[lane]; lane_set_nz(batch, lane, batch->idx_x[lane]); break;
+        case DEY: batch->idx_y[lane]--; lane_set_nz(batch, lane, batch->idx_y[lane]); break;
+        case INY: batch->idx_y[lane]++; lane_set_nz(batch, lane, batch->idx_y[lane]); break;
+        case INX: batch->idx_x[lane]++; lane_set_nz(batch, lane, batch->idx_x[lane]); break;
+        case DEX: batch->idx_x[lane]--; lane_set_nz(batch, lane, batch->idx_x[lane]); break;
+        case NOP: break;
+        case PHP:
+            lane_write(batch, lane, STACK_PAGE_START | batch->sp[lane], cpu_batch_get_status(batch, lane) | STATUS_B);
+            batch->sp[lane]--;
+            break;
+        case PLP:
+            batch->sp[lane]++;
+            lane_set_status(batch, lane, lane_read(batch, lane, STACK_PAGE_START | batch->sp[lane]));
+            break;
+        default: return false;
+    }
+    return true;
+}
+
+/**
+ * Executes one instruction for a single lane.
+ *
+ * @return false if the lane reached an instruction this core does not implement; its pc and cycles are left as they
+ *         were.
+ */
+static bool lane_step(struct cpu_batch* batch, unsigned lane)
+{
+    uint16_t pc = batch->pc[lane];
+    uint8_t opcode_byte = lane_read(batch, lane, pc++);
+    const struct cpu_opcode* opcode = &cpu_opcodes[opcode_byte];
+    if (!opcode->implemented)
+        return false;
+    unsigned cycles = opcode->cycles;
+
+    if (opcode_byte == BRK)
+    {
+        // No IRQ or NMI here, but BRK still goes through the IRQ vector
+        pc++;
+        lane_write(batch, lane, STACK_PAGE_START | batch->sp[lane]--, pc >> 8);
+        lane_write(batch, lane, STACK_PAGE_START | batch->sp[lane]--, pc & 0xFF);
+        lane_write(batch, lane, STACK_PAGE_START | batch->sp[lane]--, cpu_batch_get_status(batch, lane) | STATUS_B);
+        batch->flag_i[lane] = 1;
+        pc = lane_read_u16(batch, lane, IRQ_VEC_LO);
+    }
+    else if (opcode_byte == RTI)
+    {
+        lane_set_status(batch, lane, lane_read(batch, lane, STACK_PAGE_START | ++batch->sp[lane]));
+        pc = lane_read(batch, lane, STACK_PAGE_START | ++batch->sp[lane]);
+        pc |= lane_read(batch, lane, STACK_PAGE_START | ++batch->sp[lane]) << 8;
+    }
+    else if (opcode->addr_mode == IMPL)
+    {
+        if (!lane_implied(batch, lane, opcode_byte))
+            return false;
+    }
+    else if (opcode->addr_mode == REL)
+    {
+        int8_t offset = (int8_t) lane_read(batch, lane, pc++);
+        if (lane_branch_taken(batch, lane, opcode->instr))
+        {
+            uint16_t target = pc + offset;
+            cycles += 1 + ((target ^ pc) > 0xFF);
+            pc = target;
+        }
+    }
+    else
+    {
+        uint16_t addr;
+        uint16_t base;
+        switch (opcode->addr_mode)
+        {
+            case IMM: addr = pc++; break;
+            case ZP: addr = lane_read(batch, lane, pc++); break;
+            case ZP_X: addr = (uint8_t) (lane_read(batch, lane, pc++) + batch->idx_x[lane]); break;
+            case ZP_Y: addr = (uint8_t) (lane_read(batch, lane, pc++) + batch->idx_y[lane]); break;
+            case ABS: addr = lane_read_u16(batch, lane, pc); pc += 2; break;
+            case ABS_X:
+            case ABS_Y:
+                base = lane_read_u16(batch, lane, pc);
+                pc += 2;
+                addr = base + (opcode->addr_mode == ABS_X ? batch->idx_x[lane] : batch->idx_y[lane]);
+                cycles += opcode->rw == READ && (addr ^ base) > 0xFF;
+                break;
+            case IND_X:
+                addr = lane_read_zp_u16(batch, lane, lane_read(batch, lane, pc++) + batch->idx_x[lane]);
+                break;
+            case IND_Y:
+                base = lane_read_zp_u16(batch, lane, lane_read(batch, lane, pc++));
+                addr = base + batch->idx_y[lane];
+                cycles += opcode->rw == READ && (addr ^ base) > 0xFF;
+                break;
+            default:
+                return false;
+        }
+
+        uint8_t value = opcode->rw == READ ? lane_read(batch, lane, addr) : 0;
+        switch (opcode->instr)
+        {
+            case LDA:
+                batch->acc[lane] = value;
+                lane_set_nz(batch, lane, value);
+                break;
+            case LDX:
+                batch->idx_x[lane] = value;
+                lane_set_nz(batch, lane, value);
+                break;
+            case STX:
+                lane_write(batch, lane, addr, batch->idx_x[lane]);
+                break;
+            case ADC:
+            {
+                uint8_t acc = batch->acc[lane];
+                uint16_t sum = acc + value + batch->flag_c[lane];
+                batch->flag_v_a[lane] = acc;
+                batch->flag_v_b[lane] = value;
+                batch->flag_v_r[lane] = (uint8_t) sum;
+                batch->flag_c[lane] = sum >> 8;
+                batch->acc[lane] = (uint8_t) sum;
+                lane_set_nz(batch, lane, (uint8_t) sum);
+                break;
+            }
+            case BIT:
+                batch->flag_z_src[lane] = batch->acc[lane] & value;
+                batch->flag_n_src[lane] = value;
+                batch->flag_v_a[lane] = value & 0x40 ? 0x80 : 0;
+                batch->flag_v_b[lane] = value & 0x40 ? 0x80 : 0;
+                batch->flag_v_r[lane] = 0;
+                break;
+            default:
+                return false;  // decoded by the scalar CPU's table, not implemented here yet
+        }
+    }
+
+    batch->pc[lane] = pc;
+    batch->cycles[lane] += cycles;
+    return true;
+}
+
+
+/// ================ All lanes ================
+
+/// Code shared by every lane: the instruction at addr (up to 3 bytes) is in cartridge ROM
+static bool batch_shared_code(uint16_t addr)
+{
+    return addr >= BATCH_RAM_UPPER && addr <= 0xFFFD &&
+           cpu_mapped_read_pages[addr >> 8] != NULL && cpu_mapped_read_pages[(addr + 2) >> 8] != NULL;
+}
+
+static uint8_t code_read(uint16_t addr)
+{
+    return cpu_mapped_read_pages[addr >> 8][addr & 0xFF];
+}
+
+/// The same address in every lane
+static batch_u8 batch_read(struct cpu_batch* batch, uint16_t addr)
+{
+    if (addr < BATCH_RAM_UPPER)
+        return batch->ram[addr & BATCH_RAM_MASK];
+
+    const uint8_t* page = cpu_mapped_read_pages[addr >> 8];
+    if (page != NULL)
+        return BROADCAST_U8(page[addr & 0xFF]);
+
+    batch_u8 value = { 0 };
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        value[lane] = batch->io_read != NULL ? batch->io_read(batch->user, lane, addr) : 0;
+    }
+    return value;
+}
+
+static void batch_write(struct cpu_batch* batch, uint16_t addr, batch_u8 value)
+{
+    if (addr < BATCH_RAM_UPPER)
+    {
+        batch->ram[addr & BATCH_RAM_MASK] = value;
+        return;
+    }
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES && batch->io_write != NULL; ++lane)
+    {
+        batch->io_write(batch->user, lane, addr, value[lane]);
+    }
+}
+
+static void batch_set_nz(struct cpu_batch* batch, batch_u8 result)
+{
+    batch->flag_z_src = result;
+    batch->flag_n_src = result;
+}
+
+static batch_u8 batch_flag_v(const struct cpu_batch* batch)
+{
+    return ((batch->flag_v_a ^ batch->flag_v_r) & (batch->flag_v_b ^ batch->flag_v_r)) >> 7;
+}
+
+static batch_mask batch_branch_taken(const struct cpu_batch* batch, uint8_t instr)
+{
+    switch (instr)
+    {
+        case BPL: return (batch->flag_n_src >> 7) == 0;
+        case BMI: return (batch->flag_n_src >> 7) != 0;
+        case BVC: return batch_flag_v(batch) == 0;
+        case BVS: return batch_flag_v(batch) != 0;
+        case BCC: return batch->flag_c == 0;
+        case BCS: return batch->flag_c != 0;
+        case BNE: return batch->flag_z_src != 0;
+        case BEQ: return batch->flag_z_src == 0;
+        default: exit(ERROR_CODE__OH_NO);
+    }
+}
+
+/// @return false if the instruction needs per-lane execution
+static bool batch_implied(struct cpu_batch* batch, uint8_t opcode)
+{
+    const batch_u8 zero = { 0 };
+    switch (opcode)
+    {
+        case CLC: batch->flag_c = zero; break;
+        case SEC: batch->flag_c = BROADCAST_U8(1); break;
+        case CLI: batch->flag_i = zero; break;
+        case SEI: batch->flag_i = BROADCAST_U8(1); break;
+        case CLD: batch->flag_d = zero; break;
+        case SED: batch->flag_d = BROADCAST_U8(1); break;
+        case CLV:
+            batch->flag_v_a = zero;
+            batch->flag_v_b = zero;
+            batch->flag_v_r = zero;
+            break;
+        case TAY: batch->idx_y = batch->acc; batch_set_nz(batch, batch->idx_y); break;
+        case TXA: batch->acc = batch->idx_x; batch_set_nz(batch, batch->acc); break;
+        case TAX: batch->idx_x = batch->acc; batch_set_nz(batch, batch->idx_x); break;
+        case TYA: batch->acc = batch->idx_y; batch_set_nz(batch, batch->acc); break;
+        case TXS: batch->sp = batch->idx_x; break;
+        case TSX: batch->idx_x = batch->sp; batch_set_nz(batch, batch->idx_x); break;
+        case DEY: batch->idx_y -= 1; batch_set_nz(batch, batch->idx_y); break;
+        case INY: batch->idx_y += 1; batch_set_nz(batch, batch->idx_y); break;
+        case INX: batch->idx_x += 1; batch_set_nz(batch, batch->idx_x); break;
+        case DEX: batch->idx_x -= 1; batch_set_nz(batch, batch->idx_x); break;
+        case NOP: break;
+        default: return false;  // stack accesses land on a different address in each lane
+    }
+    return true;
+}
+
+/**
+ * Executes the instruction at pc for every lane, all of which must be at pc.
+ *
+ * @return false, having changed nothing, if the instruction needs per-lane execution.
+ */
+static bool batch_step(struct cpu_batch* batch, uint16_t pc)
+{
+    uint8_t opcode_byte = code_read(pc);
+    const struct cpu_opcode* opcode = &cpu_opcodes[opcode_byte];
+    if (!opcode->implemented)
+        return false;
+    unsigned cycles = opcode->cycles;
+
+    if (opcode->addr_mode == IMPL)
+    {
+        if (!batch_implied(batch, opcode_byte))
+            return false;
+        batch->pc = BROADCAST_U16(pc + 1);
+    }
+    else if (opcode->addr_mode == REL)
+    {
+        uint16_t next = pc + 2;
+        uint16_t target = next + (int8_t) code_read(pc + 1);
+        unsigned taken_cycles = 1 + ((target ^ next) > 0xFF);
+
+        batch_mask taken = batch_branch_taken(batch, opcode->instr);
+        batch_u16 taken16 = (batch_u16) __builtin_convertvector(taken, batch_mask16);
+        batch->pc = (BROADCAST_U16(target) & taken16) | (BROADCAST_U16(next) & ~taken16);
+        for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+        {
+            batch->cycles[lane] += cycles + (taken[lane] & taken_cycles);
+        }
+        return true;
+    }
+    else
+    {
+        batch_u8 value = { 0 };
+        uint16_t addr = 0;
+        switch (opcode->addr_mode)
+        {
+            case IMM: value = BROADCAST_U8(code_read(pc + 1)); pc += 2; break;
+            case ZP: addr = code_read(pc + 1); pc += 2; break;
+            case ABS: addr = code_read(pc + 1) | (uint16_t) (code_read(pc + 2) << 8); pc += 3; break;
+            default: return false;  // indexed and indirect addresses differ per lane
+        }
+        if (opcode->addr_mode != IMM && opcode->rw == READ)
+            value = batch_read(batch, addr);
+
+        switch (opcode->instr)
+        {
+            case LDA:
+                batch->acc = value;
+                batch_set_nz(batch, value);
+                break;
+            case LDX:
+                batch->idx_x = value;
+                batch_set_nz(batch, value);
+                break;
+            case STX:
+                batch_write(batch, addr, batch->idx_x);
+                break;
+            case ADC:
+            {
+                batch_u16 sum = __builtin_convertvector(batch->acc, batch_u16) +
+                                __builtin_convertvector(value, batch_u16) +
+                                __builtin_convertvector(batch->flag_c, batch_u16);
+                batch_u8 result = __builtin_convertvector(sum, batch_u8);
+                batch->flag_v_a = batch->acc;
+                batch->flag_v_b = value;
+                batch->flag_v_r = result;
+                batch->flag_c = __builtin_convertvector(sum >> 8, batch_u8);
+                batch->acc = result;
+                batch_set_nz(batch, result);
+                break;
+            }
+            case BIT:
+                batch->flag_z_src = batch->acc & value;
+                batch->flag_n_src = value;
+                batch->flag_v_a = (value & 0x40) << 1;
+                batch->flag_v_b = batch->flag_v_a;
+                batch->flag_v_r = (batch_u8) { 0 };
+                break;
+            default:
+                return false;
+        }
+        batch->pc = BROADCAST_U16(pc);
+    }
+
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        batch->cycles[lane] += cycles;
+    }
+    return true;
+}
+
+
+void cpu_batch_init(struct cpu_batch* batch)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->pc = BROADCAST_U16(cpu_registers.pc);
+    batch->sp = BROADCAST_U8(cpu_registers.sp);
+    batch->acc = BROADCAST_U8(cpu_registers.acc);
+    batch->idx_x = BROADCAST_U8(cpu_registers.idx_x);
+    batch->idx_y = BROADCAST_U8(cpu_registers.idx_y);
+    batch->flag_c = BROADCAST_U8(cpu_registers.flag_c);
+    batch->flag_i = BROADCAST_U8(cpu_registers.flag_i);
+    batch->flag_d = BROADCAST_U8(cpu_registers.flag_d);
+    batch->flag_z_src = BROADCAST_U8(cpu_registers.flag_z_src);
+    batch->flag_n_src = BROADCAST_U8(cpu_registers.flag_n_src);
+    batch->flag_v_a = BROADCAST_U8(cpu_registers.flag_v_a);
+    batch->flag_v_b = BROADCAST_U8(cpu_registers.flag_v_b);
+    batch->flag_v_r = BROADCAST_U8(cpu_registers.flag_v_r);
+    for (size_t addr = 0; addr < RAM_SIZE; ++addr)
+    {
+        batch->ram[addr] = BROADCAST_U8(ram[addr]);
+    }
+}
+
+
+uint64_t cpu_batch_run(struct cpu_batch* batch, uint64_t cycles)
+{
+    uint64_t end[CPU_BATCH_LANES];
+    for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+    {
+        end[lane] = batch->cycles[lane] + cycles;
+    }
+
+    while (1)
+    {
+        bool all_running = true;
+        bool same_pc = true;
+        uint16_t pc = batch->pc[0];
+        uint32_t min_pc = UINT32_MAX;
+        for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+        {
+            bool running = batch->cycles[lane] < end[lane] && !(batch->halted >> lane & 1);
+            all_running &= running;
+            same_pc &= batch->pc[lane] == pc;
+            if (running && batch->pc[lane] < min_pc)
+                min_pc = batch->pc[lane];
+        }
+        if (min_pc == UINT32_MAX)
+            break;  // every lane is done or halted
+
+        if (all_running && same_pc && batch_shared_code(pc) && batch_step(batch, pc))
+        {
+            batch->vector_steps++;
+            continue;
+        }
+
+        // Diverged: step the lanes that are furthest behind, so that the others wait for them where the paths join
+        // (the end of an if, the bottom of a loop) and the lanes can go back to running together
+        for (unsigned lane = 0; lane < CPU_BATCH_LANES; ++lane)
+        {
+            if (batch->cycles[lane] < end[lane] && !(batch->halted >> lane & 1) && batch->pc[lane] == min_pc)
+            {
+                if (lane_step(batch, lane))
+                    batch->scalar_steps++;
+                else
+                    batch->halted |= (uint64_t) 1 << lane;
+            }
+        }
+    }
+    return batch->halted;
+}
@@ -0,0 +1,93 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Batched CPU: many instances of the same program stepped in lockstep, one per SIMD lane.
+//
+// Registers are kept structure-of-arrays, one vector per register with lane i belonging to instance i, and RAM is
+// interleaved so that the same address of every lane is one vector. While every lane is at the same PC in cartridge
+// ROM, an instruction is fetched and decoded once and executed for all lanes with vector operations. As soon as the
+// lanes diverge (different PCs, per-lane addresses from indexed modes, the stack, register ports) each lane steps
+// through the same instruction on its own until they agree again.
+//
+// Unlike cpu_cycle(), this core works an instruction at a time: cycle counts are exact, but the dummy reads within an
+// instruction are not performed, and there is no PPU, APU, DMA, IRQ or NMI. Cartridge space is shared by all lanes and
+// read through cpu_mapped_read_pages; everything else outside RAM goes to the io callbacks.
+//
+// The vector width is CPU_BATCH_LANES bytes per 8-bit register (16: SSE2/NEON, 32: AVX2, 64: AVX-512).
+//
+
+#ifndef NES_EMULATOR_CPU_BATCH_H
+#define NES_EMULATOR_CPU_BATCH_H
+
+#include <stdint.h>
+#include "cpu.h"
+
+#ifndef CPU_BATCH_LANES
+#define CPU_BATCH_LANES 16
+#endif
+
+_Static_assert(CPU_BATCH_LANES <= 64, "struct cpu_batch keeps a bit per lane in a uint64_t");
+
+typedef uint8_t batch_u8 __attribute__((vector_size(CPU_BATCH_LANES)));
+typedef uint16_t batch_u16 __attribute__((vector_size(2 * CPU_BATCH_LANES)));
+
+/**
+ * Register file and RAM of CPU_BATCH_LANES instances. Same meaning per lane as struct cpu_registers.
+ */
+struct cpu_batch
+{
+    batch_u16 pc;
+    batch_u8 sp;
+    batch_u8 acc;
+    batch_u8 idx_x;
+    batch_u8 idx_y;
+
+    batch_u8 flag_c;
+    batch_u8 flag_i;
+    batch_u8 flag_d;
+    batch_u8 flag_z_src;
+    batch_u8 flag_n_src;
+    batch_u8 flag_v_a;
+    batch_u8 flag_v_b;
+    batch_u8 flag_v_r;
+
+    uint64_t cycles[CPU_BATCH_LANES];  /// CPU cycles run by each lane
+
+    /**
+     * Lanes that reached an instruction this core does not implement, bit per lane. Such a lane stops with its pc on
+     * the opcode and is not stepped again, while the others keep running, one lane at a time from then on. Clear its
+     * bit after fixing the lane up to resume it.
+     */
+    uint64_t halted;
+
+    batch_u8 ram[RAM_SIZE];  /// ram[addr][lane]
+
+    /// Reads and writes outside RAM and cartridge ROM. When NULL, reads return 0 and writes are dropped.
+    uint8_t (*io_read)(void* user, unsigned lane, uint16_t addr);
+    void (*io_write)(void* user, unsigned lane, uint16_t addr, uint8_t value);
+    void* user;
+
+    uint64_t vector_steps;  /// Instructions executed for all lanes at once
+    uint64_t scalar_steps;  /// Instructions executed for a single lane
+};
+
+/**
+ * Copies the scalar CPU (cpu_registers and ram) into every lane and clears the io callbacks and counters. The scalar
+ * CPU must be between instructions, e.g. right after cpu_reset().
+ */
+void cpu_batch_init(struct cpu_batch* batch);
+
+/**
+ * Runs every lane for at least the given number of cycles. Lanes stop at the first instruction boundary at or past
+ * that point, so they may run over by a few cycles, or earlier if they halt.
+ *
+ * @return batch->halted: 0 unless some lane halted, now or in an earlier run
+ */
+uint64_t cpu_batch_run(struct cpu_batch* batch, uint64_t cycles);
+
+/**
+ * A lane's P register, as cpu_get_status() for the scalar CPU.
+ */
+uint8_t cpu_batch_get_status(const struct cpu_batch* batch, unsigned lane);
+
+#endif //NES_EMULATOR_CPU_BATCH_H
@@ -0,0 +1,142 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "debug.h"
+#include <stddef.h>
+#include "cpu/cpu.h"
+#include "clock.h"
+
+/// Internal RAM is decoded from the low 11 bits of the address, so it repeats four times below $2000
+#define DEBUG_RAM_MIRRORS_UPPER 0x2000
+#define DEBUG_RAM_MASK (RAM_SIZE - 1)
+#define DEBUG_RAM_PAGES (RAM_SIZE / CPU_PAGE_SIZE)
+
+_Static_assert(DEBUG_READ == CPU_TRAP_READ && DEBUG_WRITE == CPU_TRAP_WRITE && DEBUG_EXECUTE == CPU_TRAP_FETCH,
+               "debug access kinds must match the CPU trap bits");
+
+
+struct debug_watch debug_watches[DEBUG_MAX_WATCHES];
+struct debug_hit debug_last_hit;
+void (*debug_on_hit)(const struct debug_hit* hit) = NULL;
+bool debug_break = false;
+
+
+/// Does nothing; being due is enough to make emu_run_frame() look at debug_break
+static void debug_break_event()
+{
+}
+
+
+/**
+ * Whether an access to addr is one to the watch's range, counting RAM through any of its mirrors: a watch on $0300
+ * also sees accesses to $0B00, $1300 and $1B00.
+ */
+static bool debug_watch_covers(const struct debug_watch* watch, uint16_t addr)
+{
+    if (addr >= watch->first && addr <= watch->last)
+        return true;
+    if (addr >= DEBUG_RAM_MIRRORS_UPPER || watch->first >= DEBUG_RAM_MIRRORS_UPPER)
+        return false;
+    for (uint32_t mirror = addr & DEBUG_RAM_MASK; mirror < DEBUG_RAM_MIRRORS_UPPER; mirror += RAM_SIZE)
+    {
+        if (mirror >= watch->first && mirror <= watch->last)
+            return true;
+    }
+    return false;
+}
+
+
+static void debug_trap(uint8_t trap, uint16_t addr, uint8_t value)
+{
+    for (int i = 0; i < DEBUG_MAX_WATCHES; ++i)
+    {
+        struct debug_watch* watch = &debug_watches[i];
+        if (!watch->active || !(watch->access & trap) || !debug_watch_covers(watch, addr) ||
+            (value & watch->value_mask) != watch->value)
+        {
+            continue;
+        }
+
+        watch->hits++;
+        debug_last_hit = (struct debug_hit) {
+            .watch = i,
+            .access = trap,
+            .addr = addr,
+            .value = value,
+            .pc = cpu_registers.pc,
+            .cycle = clock_cpu_cycles,
+        };
+        if (debug_on_hit != NULL)
+            debug_on_hit(&debug_last_hit);
+        if (watch->stop)
+        {
+            debug_break = true;
+            clock_schedule(CLOCK_EVENT_DEBUG_BREAK, clock_cpu_cycles + 1, debug_break_event);
+        }
+    }
+}
+
+
+static void debug_update_traps()
+{
+    for (size_t page = 0; page < CPU_NUM_PAGES; ++page)
+    {
+        cpu_page_traps[page] = 0;
+    }
+    // RAM pages are trapped through every mirror
+    uint8_t ram_traps[DEBUG_RAM_PAGES] = { 0 };
+    for (int i = 0; i < DEBUG_MAX_WATCHES; ++i)
+    {
+        const struct debug_watch* watch = &debug_watches[i];
+        if (!watch->active)
+            continue;
+        for (size_t page = watch->first >> 8; page <= (size_t) (watch->last >> 8); ++page)
+        {
+            if (page < DEBUG_RAM_MIRRORS_UPPER / CPU_PAGE_SIZE)
+                ram_traps[page % DEBUG_RAM_PAGES] |= watch->access;
+            else
+                cpu_page_traps[page] |= watch->access;
+        }
+    }
+    for (size_t page = 0; page < DEBUG_RAM_MIRRORS_UPPER / CPU_PAGE_SIZE; ++page)
+    {
+        cpu_page_traps[page] = ram_traps[page % DEBUG_RAM_PAGES];
+    }
+    cpu_trap_handler = debug_trap;
+    cpu_apply_page_traps();
+}
+
+
+int debug_add_watch(uint16_t first, uint16_t last, uint8_t access, uint8_t value_mask, uint8_t value, bool stop)
+{
+    for (int i = 0; i < DEBUG_MAX_WATCHES; ++i)
+    {
+        if (debug_watches[i].active)
+            continue;
+
+        debug_watches[i] = (struct debug_watch) {
+            .active = true,
+            .first = first,
+            .last = last,
+            .access = access,
+            .value_mask = value_mask,
+            .value = value & value_mask,
+            .stop = stop,
+            .hits = 0,
+        };
+        debug_update_traps();
+        return i;
+    }
+    return -1;
+}
+
+
+bool debug_remove_watch(int id)
+{
+    if (id < 0 || id >= DEBUG_MAX_WATCHES || !debug_watches[id].active)
+        return false;
+    debug_watches[id].active = false;
+    debug_update_traps();
+    return true;
+}
@@ -0,0 +1,75 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Breakpoints and watchpoints.
+//
+// A watch traps the pages it covers in the CPU page table (see cpu_page_traps), so accesses to every other page keep
+// the direct path and cost nothing extra. Accesses to a trapped page are checked against the exact address ranges and
+// value conditions of the watches here. A watch on internal RAM also covers its mirrors at $0800-$1FFF.
+//
+
+#ifndef NES_EMULATOR_DEBUG_H
+#define NES_EMULATOR_DEBUG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define DEBUG_MAX_WATCHES 32
+
+/// Kinds of access a watch triggers on (same bits as the CPU page traps)
+enum debug_access
+{
+    DEBUG_READ = 0x01,
+    DEBUG_WRITE = 0x02,
+    DEBUG_EXECUTE = 0x04,  /// Opcode fetch
+};
+
+struct debug_watch
+{
+    bool active;
+    uint16_t first;      /// Address range, inclusive
+    uint16_t last;
+    uint8_t access;      /// enum debug_access bits
+    uint8_t value_mask;  /// Only trigger if (value & value_mask) == value; a mask of 0 matches anything
+    uint8_t value;
+    bool stop;           /// Stop emulation when triggered; otherwise only count and report
+    uint64_t hits;
+};
+
+struct debug_hit
+{
+    int watch;
+    uint8_t access;
+    uint16_t addr;
+    uint8_t value;
+    uint16_t pc;     /// PC at the time of the access; it advances as the instruction's bytes are fetched
+    uint64_t cycle;  /// clock_cpu_cycles
+};
+
+extern struct debug_watch debug_watches[DEBUG_MAX_WATCHES];
+
+/// The most recent hit
+extern struct debug_hit debug_last_hit;
+
+/// Called on the emulation thread for every hit
+extern void (*debug_on_hit)(const struct debug_hit* hit);
+
+/**
+ * Set by a hit on a stopping watch. emu_run_frame() returns early when it is set, right after the CPU cycle that made
+ * the access; clear it and call emu_run_frame() again to continue from there.
+ */
+extern bool debug_break;
+
+/**
+ * Adds a watch. See struct debug_watch for the parameters.
+ *
+ * @return Watch id, or -1 if DEBUG_MAX_WATCHES watches are active.
+ */
+int debug_add_watch(uint16_t first, uint16_t last, uint8_t access, uint8_t value_mask, uint8_t value, bool stop);
+
+/**
+ * @return false if id is not that of an active watch.
+ */
+bool debug_remove_watch(int id);
+
+#endif //NES_EMULATOR_DEBUG_H
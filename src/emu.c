@@ -0,0 +1,271 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "emu.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "ppu_render.h"
+#include "io.h"
+#include "clock.h"
+#include "debug.h"
+#include "telemetry.h"
+#include "exit_codes.h"
+
+
+#define PPU_CYCLES_PER_CPU_CYCLE 3
+
+
+void (*emu_frame_hook)() = NULL;
+
+static struct triple_buffer* outputs[EMU_MAX_OUTPUTS];
+static size_t num_outputs = 0;
+static struct shm_export* shm_outputs[EMU_MAX_OUTPUTS];
+static size_t num_shm_outputs = 0;
+static struct video_dump* dump_outputs[EMU_MAX_OUTPUTS];
+static size_t num_dump_outputs = 0;
+
+static pthread_t emu_thread;
+static uint64_t emu_max_frames = 0;
+static atomic_bool emu_stop_requested = false;
+static atomic_bool emu_thread_running = false;
+
+/**
+ * What publishing needs about the frames in flight, taken at the start of vertical blanking. Only drawn frames are
+ * recorded, in turn, and the render thread is at most one drawn frame behind, so two slots are enough.
+ *
+ * In parallel mode the render thread looks for its frame's slot while the emulation thread may be refilling the other
+ * one, so frame_number is atomic. The rest of a slot is only read once its frame has been handed off, and isn't
+ * rewritten until that frame has been published.
+ */
+static struct frame_in_flight
+{
+    _Atomic uint64_t frame_number;
+    uint64_t input_timestamp_ns;
+    uint8_t ram[RAM_SIZE];  /// Only taken for the shared-memory outputs
+} frames_in_flight[2];
+static size_t next_frame_in_flight = 0;
+
+
+/**
+ * The frame loop, instantiated once per emulation core with ppu_step a constant, so that its PPU calls are direct.
+ */
+static inline __attribute__((always_inline)) bool emu_run_frame_with(void (*ppu_step)())
+{
+    while (!ppu_frame_complete)
+    {
+        if (clock_cpu_cycles >= clock_next_event_cycle)
+        {
+            clock_run_events();
+            if (debug_break || cpu_halted)
+                return false;
+        }
+
+        if (clock_cpu_stall != 0)
+            clock_cpu_stall--;  // CPU halted for DMA
+        else
+            cpu_cycle();
+        clock_cpu_cycles++;
+
+        for (size_t i = 0; i < PPU_CYCLES_PER_CPU_CYCLE; ++i)
+        {
+            ppu_step();
+        }
+    }
+    ppu_frame_complete = false;
+    return true;
+}
+
+static bool emu_run_frame_generic()
+{
+    return emu_run_frame_with(ppu_cycle);
+}
+
+#define EMU_DEFINE_RUN_FRAME(name, number) \
+    static bool emu_run_frame_##name() \
+    { \
+        return emu_run_frame_with(ppu_cycle_##name); \
+    }
+NES_MAPPERS(EMU_DEFINE_RUN_FRAME)
+#undef EMU_DEFINE_RUN_FRAME
+
+static bool (*emu_core)() = emu_run_frame_generic;
+const char* emu_core_name = "generic";
+int emu_core_id = EMU_GENERIC_CORE;
+
+
+const char* emu_select_core(int mapper_idx)
+{
+    emu_core = emu_run_frame_generic;
+    emu_core_name = "generic";
+    emu_core_id = EMU_GENERIC_CORE;
+#define EMU_SELECT_CORE(name, number) \
+    if (mapper_idx == (number)) \
+    { \
+        emu_core = emu_run_frame_##name; \
+        emu_core_name = #name; \
+        emu_core_id = (number); \
+    }
+    NES_MAPPERS(EMU_SELECT_CORE)
+#undef EMU_SELECT_CORE
+    return emu_core_name;
+}
+
+
+bool emu_run_frame()
+{
+    if (cpu_halted)
+        return false;
+    return emu_core();
+}
+
+
+bool emu_add_output(struct triple_buffer* output)
+{
+    if (num_outputs == EMU_MAX_OUTPUTS)
+        return false;
+    outputs[num_outputs++] = output;
+    return true;
+}
+
+
+bool emu_add_shm_output(struct shm_export* output)
+{
+    if (num_shm_outputs == EMU_MAX_OUTPUTS)
+        return false;
+    shm_outputs[num_shm_outputs++] = output;
+    return true;
+}
+
+
+bool emu_add_dump_output(struct video_dump* output)
+{
+    if (num_dump_outputs == EMU_MAX_OUTPUTS)
+        return false;
+    dump_outputs[num_dump_outputs++] = output;
+    return true;
+}
+
+
+static void snapshot_frame()
+{
+    if (ppu_skip_rendering)
+        return;
+    struct frame_in_flight* snapshot = &frames_in_flight[next_frame_in_flight];
+    next_frame_in_flight ^= 1;
+    snapshot->input_timestamp_ns = io_input_poll_timestamp;
+    if (num_shm_outputs != 0)
+        memcpy(snapshot->ram, ram, RAM_SIZE);
+    atomic_store_explicit(&snapshot->frame_number, ppu_frame_count, memory_order_release);
+}
+
+
+static void publish_frame(uint64_t frame_number)
+{
+    uint64_t begin_ns = telemetry_begin();
+    uint64_t now = clock_now_ns();
+    const struct frame_in_flight* snapshot = &frames_in_flight[0];
+    if (atomic_load_explicit(&snapshot->frame_number, memory_order_acquire) != frame_number)
+        snapshot = &frames_in_flight[1];
+    for (size_t i = 0; i < num_outputs; ++i)
+    {
+        struct frame* frame = triple_buffer_back(outputs[i]);
+        frame->frame_number = frame_number;
+        frame->input_timestamp_ns = snapshot->input_timestamp_ns;
+        frame->publish_timestamp_ns = now;
+        // The back buffer holds an older frame; rows that match it are already in place
+        for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+        {
+            if (frame->row_hashes[y] == ppu_row_hashes[y])
+                continue;
+            memcpy(frame->pixels[y], ppu_dot_array[y], FRAME_WIDTH);
+            frame->row_hashes[y] = ppu_row_hashes[y];
+        }
+        triple_buffer_publish(outputs[i]);
+    }
+    for (size_t i = 0; i < num_shm_outputs; ++i)
+    {
+        shm_export_publish(shm_outputs[i], frame_number, snapshot->input_timestamp_ns, now, ppu_dot_array,
+                           ppu_row_hashes, snapshot->ram);
+    }
+    for (size_t i = 0; i < num_dump_outputs; ++i)
+    {
+        video_dump_frame(dump_outputs[i], frame_number, ppu_dot_array, ppu_row_hashes);
+    }
+    telemetry_end(TELEMETRY_PUBLISH, begin_ns, frame_number);
+}
+
+
+static void* emu_thread_main(void* arg)
+{
+    (void) arg;
+    telemetry_name_thread("emulation");
+    uint64_t frames = 0;
+    while (!atomic_load_explicit(&emu_stop_requested, memory_order_relaxed))
+    {
+        uint64_t begin_ns = telemetry_begin();
+        if (!io_poll_input())
+            break;  // out of input, e.g. at the end of a movie
+        telemetry_end(TELEMETRY_INPUT_POLL, begin_ns, ppu_frame_count + 1);
+
+        begin_ns = telemetry_begin();
+        if (!emu_run_frame())
+            break;  // stopped by a watch (see debug_last_hit) or the CPU halted
+        telemetry_end(TELEMETRY_EMULATE, begin_ns, ppu_frame_count);
+        if (telemetry_enabled)
+        {
+            telemetry_count(TELEMETRY_DMA_STALL, telemetry_dma_stall_cycles);
+            telemetry_dma_stall_cycles = 0;
+        }
+
+        // In parallel mode the render thread publishes instead, once it has drawn the frame
+        if (!ppu_skip_rendering && !ppu_render_parallel)
+            publish_frame(ppu_frame_count);
+        if (emu_frame_hook != NULL)
+            emu_frame_hook();
+
+        if (++frames == emu_max_frames)
+            break;
+    }
+    ppu_render_flush();
+    atomic_store(&emu_thread_running, false);
+    return NULL;
+}
+
+
+void emu_start(uint64_t max_frames)
+{
+    emu_max_frames = max_frames;
+    ppu_render_on_frame = publish_frame;
+    ppu_on_vblank = snapshot_frame;
+    atomic_store(&emu_stop_requested, false);
+    atomic_store(&emu_thread_running, true);
+    if (pthread_create(&emu_thread, NULL, emu_thread_main, NULL) != 0)
+    {
+        fprintf(stderr, "Could not start emulation thread");
+        exit(ERROR_CODE__OH_NO);
+    }
+}
+
+
+void emu_stop()
+{
+    atomic_store(&emu_stop_requested, true);
+}
+
+
+bool emu_running()
+{
+    return atomic_load(&emu_thread_running);
+}
+
+
+void emu_join()
+{
+    pthread_join(emu_thread, NULL);
+}
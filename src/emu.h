@@ -0,0 +1,94 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Emulation thread. Runs the CPU and PPU and publishes each completed frame to the registered output buffers, so
+// that presentation and other frame consumers run on their own threads and never hold up emulation.
+//
+
+#ifndef NES_EMULATOR_EMU_H
+#define NES_EMULATOR_EMU_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "triple_buffer.h"
+#include "shm_export.h"
+#include "video_dump.h"
+
+#define EMU_MAX_OUTPUTS 4
+
+/// Called on the emulation thread after every frame, including skipped ones. Must be set before emu_start().
+extern void (*emu_frame_hook)();
+
+/// Passed to emu_select_core() for the generic core
+#define EMU_GENERIC_CORE (-1)
+
+/// Name of the core emu_run_frame() runs: "generic", or the name of the mapper it is specialized for
+extern const char* emu_core_name;
+
+/// The core emu_run_frame() runs: the iNES mapper number it is specialized for, or EMU_GENERIC_CORE
+extern int emu_core_id;
+
+/**
+ * Selects the emulation core for a cartridge's mapper: the one specialized for it if it is in NES_MAPPERS (see
+ * cartridge/mappers.h), otherwise the generic one. load_file() does this; call it again only before the first frame
+ * of the cartridge, as the PPU's resume point belongs to the core that set it. Save states record the core, and
+ * state_load() refuses those of another one.
+ *
+ * @param mapper_idx iNES mapper number, or EMU_GENERIC_CORE
+ * @return emu_core_name
+ */
+const char* emu_select_core(int mapper_idx);
+
+/**
+ * Runs the CPU and PPU until the PPU completes a frame.
+ *
+ * @return false if a watch stopped emulation before the frame was complete (see debug_break), or the CPU is halted on
+ *         an opcode it does not implement (see cpu_halted).
+ */
+bool emu_run_frame();
+
+/**
+ * Registers a triple buffer that receives every completed frame that was not skipped (see ppu_frame_skip). Must be
+ * called before emu_start().
+ *
+ * @return false if EMU_MAX_OUTPUTS outputs are already registered.
+ */
+bool emu_add_output(struct triple_buffer* output);
+
+/**
+ * Registers a shared-memory segment that receives every completed frame that was not skipped, with CPU RAM as of
+ * that frame's start of vertical blanking. Must be called before emu_start().
+ *
+ * @return false if EMU_MAX_OUTPUTS shared-memory outputs are already registered.
+ */
+bool emu_add_shm_output(struct shm_export* output);
+
+/**
+ * Registers a video dump that receives every completed frame that was not skipped; dumps are meant to run without
+ * frame skipping. Must be called before emu_start().
+ *
+ * @return false if EMU_MAX_OUTPUTS video dumps are already registered.
+ */
+bool emu_add_dump_output(struct video_dump* output);
+
+/**
+ * Starts the emulation thread. The cartridge must already be loaded and the CPU reset. For parallel rendering, call
+ * ppu_render_start() first; the render thread then publishes the frames.
+ *
+ * Frames run back to back, as fast as the core can go. Emulation also stops when io_input_source runs out of input,
+ * a watch stops it or the CPU halts.
+ *
+ * @param max_frames Number of frames to run before stopping, or 0 to run until emu_stop().
+ */
+void emu_start(uint64_t max_frames);
+
+/// Asks the emulation thread to stop after the current frame.
+void emu_stop();
+
+/// Whether the emulation thread is still producing frames.
+bool emu_running();
+
+/// Waits for the emulation thread to finish.
+void emu_join();
+
+#endif //NES_EMULATOR_EMU_H
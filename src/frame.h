@@ -0,0 +1,33 @@
+//
+// Created by quate on 10/19/2026.
+//
+// A completed PPU frame as handed from the emulation thread to output consumers.
+//
+
+#ifndef NES_EMULATOR_FRAME_H
+#define NES_EMULATOR_FRAME_H
+
+#include <stdint.h>
+
+#define FRAME_WIDTH 256
+#define FRAME_HEIGHT 240
+
+struct frame
+{
+    /// Number of frames the PPU had completed when this one was published (first frame is 1)
+    uint64_t frame_number;
+
+    /// clock_now_ns() of the input poll that fed this frame; latency = display time - this
+    uint64_t input_timestamp_ns;
+
+    /// clock_now_ns() at which the emulation thread published the frame
+    uint64_t publish_timestamp_ns;
+
+    /// Palette indices (0x00-0x3F) as output by the PPU, one byte per pixel
+    uint8_t pixels[FRAME_HEIGHT][FRAME_WIDTH];
+
+    /// ppu_row_hashes of the rows in pixels. Publishing rewrites only the rows whose hash changed.
+    uint64_t row_hashes[FRAME_HEIGHT];
+};
+
+#endif //NES_EMULATOR_FRAME_H
@@ -3,3 +3,79 @@
 //
 
 #include "io.h"
+#include <stddef.h>
+#include "clock.h"
+#include "state.h"
+
+
+static bool io_no_input(void* user, uint8_t buttons[IO_NUM_CONTROLLERS])
+{
+    (void) user;
+    for (size_t i = 0; i < IO_NUM_CONTROLLERS; ++i)
+    {
+        buttons[i] = 0;
+    }
+    return true;
+}
+
+
+struct io_input_source io_input_source = { .poll = io_no_input, .user = NULL };
+uint8_t io_buttons[IO_NUM_CONTROLLERS] = { 0 };
+uint64_t io_input_poll_timestamp = 0;
+void (*io_trace_hook)(enum io_trace_event event, uint8_t port, uint8_t value) = NULL;
+
+static bool controller_strobe = false;
+static uint8_t controller_shift[IO_NUM_CONTROLLERS] = { 0 };
+
+
+bool io_poll_input()
+{
+    io_input_poll_timestamp = clock_now_ns();
+    return io_input_source.poll(io_input_source.user, io_buttons);
+}
+
+
+static void io_controller_reload()
+{
+    for (size_t i = 0; i < IO_NUM_CONTROLLERS; ++i)
+    {
+        controller_shift[i] = io_buttons[i];
+    }
+}
+
+
+void io_controller_write(uint8_t value)
+{
+    // Reload while the strobe is high and once more as it falls, so the latched state is the latest one
+    if (controller_strobe || (value & 1))
+        io_controller_reload();
+    controller_strobe = value & 1;
+    if (io_trace_hook != NULL)
+        io_trace_hook(IO_TRACE_STROBE, 0, value);
+}
+
+
+uint8_t io_controller_read(uint8_t port)
+{
+    uint8_t bit;
+    if (controller_strobe)
+    {
+        bit = io_buttons[port] & IO_BUTTON_A;
+    }
+    else
+    {
+        bit = controller_shift[port] & 1;
+        controller_shift[port] = (controller_shift[port] >> 1) | 0x80;
+    }
+    if (io_trace_hook != NULL)
+        io_trace_hook(IO_TRACE_READ, port, bit);
+    return bit;
+}
+
+
+void io_state(struct state* state)
+{
+    STATE_FIELD(state, io_buttons);
+    STATE_FIELD(state, controller_strobe);
+    STATE_FIELD(state, controller_shift);
+}
@@ -5,8 +5,82 @@
 #ifndef TINY_EMULATOR_IO_H
 #define TINY_EMULATOR_IO_H
 
+#include <stdint.h>
+#include <stdbool.h>
+
 // https://www.nesdev.org/wiki/2A03
+// https://www.nesdev.org/wiki/Standard_controller
+
+#define IO_NUM_CONTROLLERS 2
+
+/// Standard controller buttons, as bits in the order the shift register reports them (A first)
+enum io_button
+{
+    IO_BUTTON_A = 0x01,
+    IO_BUTTON_B = 0x02,
+    IO_BUTTON_SELECT = 0x04,
+    IO_BUTTON_START = 0x08,
+    IO_BUTTON_UP = 0x10,
+    IO_BUTTON_DOWN = 0x20,
+    IO_BUTTON_LEFT = 0x40,
+    IO_BUTTON_RIGHT = 0x80,
+};
+
+/**
+ * Where controller state comes from. poll() is called on the emulation thread once before every frame and fills in
+ * the buttons held on each controller for that frame. It returns false when the source has run out of input (e.g. the
+ * end of a movie), which stops emulation.
+ */
+struct io_input_source
+{
+    bool (*poll)(void* user, uint8_t buttons[IO_NUM_CONTROLLERS]);
+    void* user;
+};
+
+/// Current input source. Defaults to no buttons held, forever. Must be set before emu_start().
+extern struct io_input_source io_input_source;
+
+/// Buttons held on each controller during the current frame, as returned by the last poll
+extern uint8_t io_buttons[IO_NUM_CONTROLLERS];
+
+/// clock_now_ns() of the most recent input poll. Published alongside each frame for latency measurement.
+extern uint64_t io_input_poll_timestamp;
+
+/// Controller port accesses reported to io_trace_hook
+enum io_trace_event
+{
+    IO_TRACE_STROBE,  /// CPU write to $4016; value is the byte written, port is 0
+    IO_TRACE_READ,    /// CPU read of $4016 or $4017; value is the button bit returned
+};
+
+/**
+ * Called on the emulation thread on every controller strobe and read, for instrumentation (e.g. input latency
+ * measurement); NULL for none. The bits read after the strobe falls are the buttons the game consumes, A first.
+ */
+extern void (*io_trace_hook)(enum io_trace_event event, uint8_t port, uint8_t value);
+
+/**
+ * Samples the input source for the upcoming frame.
+ *
+ * @return false if the input source has no more input.
+ */
+bool io_poll_input();
+
+/**
+ * CPU write to $4016. Bit 0 is the strobe: while it is high the controllers continuously reload their shift registers
+ * from the buttons held.
+ */
+void io_controller_write(uint8_t value);
+
+/**
+ * CPU read of $4016 (port 0) or $4017 (port 1). Returns the next button in bit 0 and shifts; after all 8 buttons have
+ * been read, official controllers return 1.
+ */
+uint8_t io_controller_read(uint8_t port);
 
+struct state;
 
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void io_state(struct state* state);
 
 #endif //TINY_EMULATOR_IO_H
@@ -5,9 +5,49 @@
 #include "load.h"
 #include "stdio.h"
 #include "stdlib.h"
-#include "mem.h"
+#include <string.h>
 #include "exit_codes.h"
 #include "cartridge/nrom00.h"
+#include "cpu/cpu.h"
+#include "emu.h"
+#include "utils.h"
+
+// https://www.nesdev.org/wiki/INES and https://www.nesdev.org/wiki/NES_2.0
+bool load_parse_header(const uint8_t header[NES_FILE_HEADER_SIZE], struct nes_file* file)
+{
+    if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A)
+        return false;
+
+    file->nes2 = (header[7] & 0x0C) == 0x08;
+    file->mapper_idx = header[6] >> 4;
+    // Old dumping tools signed bytes 7-15 ("DiskDude!"), which can only be told apart by bytes 12-15 not being 0
+    if (file->nes2 || (header[12] | header[13] | header[14] | header[15]) == 0)
+        file->mapper_idx |= header[7] & 0xF0;
+    file->submapper = 0;
+    file->prg_size = header[4];
+    file->chr_size = header[5];
+    file->prg_ram_bytes = 0;
+    if (file->nes2)
+    {
+        // An MSB nibble of 0xF selects the exponent-multiplier size notation, for sizes no actual board has
+        if ((header[9] & 0x0F) == 0x0F || (header[9] & 0xF0) == 0xF0)
+            return false;
+        file->mapper_idx |= (header[8] & 0x0F) << 8;
+        file->submapper = header[8] >> 4;
+        file->prg_size |= (size_t) (header[9] & 0x0F) << 8;
+        file->chr_size |= (size_t) (header[9] >> 4) << 8;
+        // Shift counts: 64 << n bytes, for volatile RAM and battery-backed RAM
+        if ((header[10] & 0x0F) != 0)
+            file->prg_ram_bytes += (size_t) 64 << (header[10] & 0x0F);
+        if ((header[10] >> 4) != 0)
+            file->prg_ram_bytes += (size_t) 64 << (header[10] >> 4);
+    }
+    file->v_mirror = header[6] & 0x01;
+    file->battery = header[6] & 0x02;
+    file->trainer = header[6] & 0x04;
+    file->four_screen = header[6] & 0x08;
+    return true;
+}
 
 // TODO: header validation per mapping format
 struct nes_file open_file(const char* file_path)
@@ -24,17 +64,13 @@ struct nes_file open_file(const char* file_path)
         exit(ERROR_CODE__INVALID_FILE);
     }
 
-    fread(header_buffer, sizeof(header_buffer), 1, file_ptr);
-
-    if (header_buffer[0] != 'N' || header_buffer[1] != 'E' || header_buffer[2] != 'S' || header_buffer[3] != 0x1A)
+    if (fread(header_buffer, sizeof(header_buffer), 1, file_ptr) != 1 || !load_parse_header(header_buffer, &ret))
     {
         fprintf(stderr, "File has incorrect header: %s", file_path);
         exit(ERROR_CODE__INVALID_FILE);
     }
-
-    ret.mapper_idx = (header_buffer[6] >> 4) | (header_buffer[7] & 0xF0);
-    ret.prg_size = header_buffer[4];
-    ret.chr_size = header_buffer[5];
+    if (ret.trainer)
+        fseek(file_ptr, TRAINER_SIZE, SEEK_CUR);
 
     ret.prg_rom = calloc(get_prg_size_bytes(ret.prg_size), sizeof(uint8_t));
     ret.chr_rom = calloc(get_chr_size_bytes(ret.chr_size), sizeof(uint8_t));
@@ -46,6 +82,35 @@ struct nes_file open_file(const char* file_path)
     return ret;
 }
 
+bool open_memory(const uint8_t* data, size_t size, struct nes_file* file)
+{
+    if (size < NES_FILE_HEADER_SIZE || !load_parse_header(data, file))
+        return false;
+
+    size_t prg_offset = NES_FILE_HEADER_SIZE + (file->trainer ? TRAINER_SIZE : 0);
+    size_t prg_bytes = get_prg_size_bytes(file->prg_size);
+    size_t chr_bytes = get_chr_size_bytes(file->chr_size);
+    if (size < prg_offset + prg_bytes + chr_bytes)
+        return false;
+
+    file->prg_rom = calloc(prg_bytes, sizeof(uint8_t));
+    file->chr_rom = calloc(chr_bytes, sizeof(uint8_t));
+    memcpy(file->prg_rom, data + prg_offset, prg_bytes);
+    memcpy(file->chr_rom, data + prg_offset + prg_bytes, chr_bytes);
+    return true;
+}
+
+bool load_file_supported(const struct nes_file* file)
+{
+    switch (file->mapper_idx)
+    {
+        case 00:  // NROM
+            return file->prg_size == 1 || file->prg_size == 2;
+        default:
+            return false;
+    }
+}
+
 void load_file(struct nes_file* file)
 {
     switch (file->mapper_idx)
@@ -57,4 +122,40 @@ void load_file(struct nes_file* file)
             fprintf(stderr, "No implementation for iNES file load with mapper %02d", file->mapper_idx);
             exit(ERROR_CODE__UNIMPLEMENTED);
     }
+    cpu_map_pages();
+    emu_select_core(file->mapper_idx);
+}
+
+size_t load_battery_size(const struct nes_file* file)
+{
+    if (!file->battery)
+        return 0;
+    switch (file->mapper_idx)
+    {
+        case 00:  // NROM
+            return NROM_PRG_RAM_SIZE;
+        default:
+            return 0;
+    }
+}
+
+void load_attach_battery(const struct nes_file* file, uint8_t* ram)
+{
+    switch (file->mapper_idx)
+    {
+        case 00:  // NROM
+            nrom_attach_prg_ram(ram);
+            break;
+        default:
+            fprintf(stderr, "No battery-backed RAM for mapper %02d", file->mapper_idx);
+            exit(ERROR_CODE__UNIMPLEMENTED);
+    }
+    cpu_map_pages();
+}
+
+
+uint32_t nes_file_crc32(const struct nes_file* file)
+{
+    uint32_t crc = crc32_update(0, file->prg_rom, get_prg_size_bytes(file->prg_size));
+    return crc32_update(crc, file->chr_rom, get_chr_size_bytes(file->chr_size));
 }
@@ -11,6 +11,13 @@
 #include "cartridge/ines.h"
 
 
+/**
+ * Reads an iNES 1.0 or NES 2.0 header into `file`, leaving its ROM pointers alone.
+ *
+ * @return false if it isn't one, or uses a ROM size notation this emulator doesn't take
+ */
+bool load_parse_header(const uint8_t header[NES_FILE_HEADER_SIZE], struct nes_file* file);
+
 /**
  * Allocates array of cartridge data into memory.
  * Only designed to work with cartridges with no mapper (bank switching).
@@ -20,6 +27,38 @@
  */
 struct nes_file open_file(const char* file_path);
 
+/**
+ * Like open_file(), from an iNES image already in memory. The data is copied.
+ *
+ * @return false if the image is truncated or has an incorrect header.
+ */
+bool open_memory(const uint8_t* data, size_t size, struct nes_file* file);
+
+/**
+ * Whether load_file() can load this cartridge (its mapper and bank layout are implemented).
+ */
+bool load_file_supported(const struct nes_file* file);
+
+/**
+ * Sets up the cartridge's mapper, maps it into the CPU's page table and selects the emulation core for it
+ * (emu_select_core()).
+ */
 void load_file(struct nes_file* file);
 
+/**
+ * Size of the battery-backed RAM of a cartridge, 0 if it has none (or its mapper doesn't implement one).
+ */
+size_t load_battery_size(const struct nes_file* file);
+
+/**
+ * Replaces the loaded cartridge's battery-backed RAM with `ram`, load_battery_size() bytes that it then reads and
+ * writes in place (a mapped save file, see battery.h). The contents of `ram` are kept.
+ */
+void load_attach_battery(const struct nes_file* file, uint8_t* ram);
+
+/**
+ * CRC-32 of the PRG and CHR data, without the iNES header (the same hash ROM databases use).
+ */
+uint32_t nes_file_crc32(const struct nes_file* file);
+
 #endif //TINY_EMULATOR_LOAD_H
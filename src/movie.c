@@ -0,0 +1,202 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "movie.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exit_codes.h"
+
+
+#define MOVIE_HEADER_SIZE 20
+#define MOVIE_MAX_RUN 0xFF
+#define MOVIE_INITIAL_CAPACITY 0x1000
+
+static const char movie_magic[4] = { 'N', 'E', 'S', 'M' };
+
+
+static void put_u32(uint8_t* dst, uint32_t value)
+{
+    dst[0] = (uint8_t) value;
+    dst[1] = (uint8_t) (value >> 8);
+    dst[2] = (uint8_t) (value >> 16);
+    dst[3] = (uint8_t) (value >> 24);
+}
+
+
+static uint32_t get_u32(const uint8_t* src)
+{
+    return (uint32_t) src[0] | ((uint32_t) src[1] << 8) | ((uint32_t) src[2] << 16) | ((uint32_t) src[3] << 24);
+}
+
+
+static void movie_reserve(struct movie* movie, size_t num_frames)
+{
+    if (num_frames <= movie->capacity)
+        return;
+
+    size_t capacity = movie->capacity != 0 ? movie->capacity : MOVIE_INITIAL_CAPACITY;
+    while (capacity < num_frames)
+    {
+        capacity *= 2;
+    }
+    movie->frames = realloc(movie->frames, capacity * sizeof(*movie->frames));
+    if (movie->frames == NULL)
+    {
+        fprintf(stderr, "Out of memory for movie of %zu frames", num_frames);
+        exit(ERROR_CODE__OH_NO);
+    }
+    movie->capacity = capacity;
+}
+
+
+void movie_init(struct movie* movie, uint32_t rom_crc32)
+{
+    memset(movie, 0, sizeof(*movie));
+    movie->rom_crc32 = rom_crc32;
+}
+
+
+void movie_free(struct movie* movie)
+{
+    free(movie->start_state);
+    free(movie->frames);
+    memset(movie, 0, sizeof(*movie));
+}
+
+
+static void movie_invalid(FILE* file_ptr, const char* file_path)
+{
+    fprintf(stderr, "Movie file is malformed: %s", file_path);
+    fclose(file_ptr);
+    exit(ERROR_CODE__INVALID_FILE);
+}
+
+
+void movie_load(struct movie* movie, const char* file_path)
+{
+    FILE* file_ptr = fopen(file_path, "rb");
+    if (file_ptr == NULL)
+    {
+        fprintf(stderr, "File could not be found: %s", file_path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    uint8_t header[MOVIE_HEADER_SIZE];
+    if (fread(header, sizeof(header), 1, file_ptr) != 1 ||
+        memcmp(header, movie_magic, sizeof(movie_magic)) != 0 ||
+        header[4] != MOVIE_VERSION ||
+        header[5] != IO_NUM_CONTROLLERS)
+    {
+        movie_invalid(file_ptr, file_path);
+    }
+
+    movie_init(movie, get_u32(&header[8]));
+    size_t num_frames = get_u32(&header[12]);
+
+    movie->start_state_size = get_u32(&header[16]);
+    if (movie->start_state_size != 0)
+    {
+        movie->start_state = malloc(movie->start_state_size);
+        if (movie->start_state == NULL ||
+            fread(movie->start_state, movie->start_state_size, 1, file_ptr) != 1)
+        {
+            movie_invalid(file_ptr, file_path);
+        }
+    }
+
+    movie_reserve(movie, num_frames);
+    uint8_t run[1 + IO_NUM_CONTROLLERS];
+    while (movie->num_frames < num_frames)
+    {
+        if (fread(run, sizeof(run), 1, file_ptr) != 1 || run[0] == 0 || movie->num_frames + run[0] > num_frames)
+            movie_invalid(file_ptr, file_path);
+
+        for (size_t i = 0; i < run[0]; ++i)
+        {
+            memcpy(movie->frames[movie->num_frames++], &run[1], IO_NUM_CONTROLLERS);
+        }
+    }
+
+    fclose(file_ptr);
+}
+
+
+void movie_save(const struct movie* movie, const char* file_path)
+{
+    FILE* file_ptr = fopen(file_path, "wb");
+    if (file_ptr == NULL)
+    {
+        fprintf(stderr, "Could not open movie file: %s", file_path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+
+    uint8_t header[MOVIE_HEADER_SIZE] = { 0 };
+    memcpy(header, movie_magic, sizeof(movie_magic));
+    header[4] = MOVIE_VERSION;
+    header[5] = IO_NUM_CONTROLLERS;
+    put_u32(&header[8], movie->rom_crc32);
+    put_u32(&header[12], (uint32_t) movie->num_frames);
+    put_u32(&header[16], (uint32_t) movie->start_state_size);
+    fwrite(header, sizeof(header), 1, file_ptr);
+    if (movie->start_state_size != 0)
+        fwrite(movie->start_state, movie->start_state_size, 1, file_ptr);
+
+    size_t frame = 0;
+    while (frame < movie->num_frames)
+    {
+        uint8_t run[1 + IO_NUM_CONTROLLERS];
+        run[0] = 1;
+        memcpy(&run[1], movie->frames[frame], IO_NUM_CONTROLLERS);
+        while (run[0] < MOVIE_MAX_RUN && frame + run[0] < movie->num_frames &&
+               memcmp(movie->frames[frame + run[0]], &run[1], IO_NUM_CONTROLLERS) == 0)
+        {
+            run[0]++;
+        }
+        fwrite(run, sizeof(run), 1, file_ptr);
+        frame += run[0];
+    }
+
+    if (fclose(file_ptr) != 0)
+    {
+        fprintf(stderr, "Could not write movie file: %s", file_path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+}
+
+
+static bool movie_play_frame(void* user, uint8_t buttons[IO_NUM_CONTROLLERS])
+{
+    struct movie* movie = user;
+    if (movie->cursor == movie->num_frames)
+        return false;
+    memcpy(buttons, movie->frames[movie->cursor++], IO_NUM_CONTROLLERS);
+    return true;
+}
+
+
+struct io_input_source movie_playback_source(struct movie* movie)
+{
+    movie->cursor = 0;
+    return (struct io_input_source) { .poll = movie_play_frame, .user = movie };
+}
+
+
+static bool movie_record_frame(void* user, uint8_t buttons[IO_NUM_CONTROLLERS])
+{
+    struct movie* movie = user;
+    if (!movie->record_source.poll(movie->record_source.user, buttons))
+        return false;
+
+    movie_reserve(movie, movie->num_frames + 1);
+    memcpy(movie->frames[movie->num_frames++], buttons, IO_NUM_CONTROLLERS);
+    return true;
+}
+
+
+struct io_input_source movie_record_source(struct movie* movie, struct io_input_source source)
+{
+    movie->record_source = source;
+    return (struct io_input_source) { .poll = movie_record_frame, .user = movie };
+}
@@ -0,0 +1,72 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Input movies: the buttons held on every controller for every frame, recorded from an input source and played back
+// as one. Emulation is deterministic, so playing a movie from its start state reproduces the recorded session
+// exactly, frame for frame, at whatever speed the core runs.
+//
+// File format (all integers little endian):
+//
+//   0   char[4]  "NESM"
+//   4   u8       version (MOVIE_VERSION)
+//   5   u8       number of controllers per frame
+//   6   u16      reserved, 0
+//   8   u32      CRC-32 of the ROM the movie was recorded on (see nes_file_crc32())
+//   12  u32      number of frames
+//   16  u32      start state size; 0 means the movie starts from power-on, otherwise a save state of this size follows
+//   20  ...      start state
+//   ...          frames, run-length encoded as [u8 run length 1-255][u8 buttons for each controller]
+//
+
+#ifndef NES_EMULATOR_MOVIE_H
+#define NES_EMULATOR_MOVIE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "io.h"
+
+#define MOVIE_VERSION 1
+
+struct movie
+{
+    uint32_t rom_crc32;
+
+    uint8_t* start_state;  /// NULL when the movie starts from power-on
+    size_t start_state_size;
+
+    uint8_t (*frames)[IO_NUM_CONTROLLERS];
+    size_t num_frames;
+    size_t capacity;
+
+    size_t cursor;                         /// Next frame to play back
+    struct io_input_source record_source;  /// Where a recording takes its input from
+};
+
+/**
+ * Initializes an empty movie that starts from power-on.
+ */
+void movie_init(struct movie* movie, uint32_t rom_crc32);
+
+void movie_free(struct movie* movie);
+
+/**
+ * Reads a movie file. Exits on a missing or malformed file.
+ */
+void movie_load(struct movie* movie, const char* file_path);
+
+/**
+ * Writes a movie file. Exits if the file cannot be written.
+ */
+void movie_save(const struct movie* movie, const char* file_path);
+
+/**
+ * Input source that plays the movie back from its first frame and runs out after its last.
+ */
+struct io_input_source movie_playback_source(struct movie* movie);
+
+/**
+ * Input source that passes through the buttons from source and appends them to the movie.
+ */
+struct io_input_source movie_record_source(struct movie* movie, struct io_input_source source);
+
+#endif //NES_EMULATOR_MOVIE_H
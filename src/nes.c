@@ -0,0 +1,252 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "nes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "io.h"
+#include "clock.h"
+#include "load.h"
+#include "emu.h"
+#include "frame.h"
+#include "screen.h"
+#include "state.h"
+#include "boot_cache.h"
+
+_Static_assert(NES_NUM_CONTROLLERS == IO_NUM_CONTROLLERS, "controller count mismatch");
+_Static_assert(NES_FRAME_WIDTH == FRAME_WIDTH && NES_FRAME_HEIGHT == FRAME_HEIGHT, "frame size mismatch");
+_Static_assert(NES_RAM_SIZE == RAM_SIZE, "RAM size mismatch");
+
+
+#define NES_ERROR_SIZE 64
+
+
+struct nes
+{
+    struct nes_file file;
+    char error[NES_ERROR_SIZE];  /// Message returned by nes_error()
+};
+
+static struct nes* nes_instance = NULL;
+
+/// Why the last nes_create() failed, empty if it didn't
+static char nes_create_error[NES_ERROR_SIZE] = "";
+
+/// The core's globals as they are before anything runs, restored to power on a fresh instance
+static uint8_t* power_on_state = NULL;
+
+
+struct nes* nes_create(const uint8_t* rom, size_t rom_size)
+{
+    nes_create_error[0] = '\0';
+    if (nes_instance != NULL)
+    {
+        snprintf(nes_create_error, sizeof(nes_create_error), "another instance exists; use a process per instance");
+        return NULL;
+    }
+
+    struct nes_file file;
+    if (!open_memory(rom, rom_size, &file))
+    {
+        snprintf(nes_create_error, sizeof(nes_create_error), "not a valid iNES image");
+        return NULL;
+    }
+    if (!load_file_supported(&file))
+    {
+        snprintf(nes_create_error, sizeof(nes_create_error), "mapper %d is not implemented", file.mapper_idx);
+        nes_file_free(&file);
+        return NULL;
+    }
+
+    // The core the power-on state is saved with and loaded into; load_file() then selects the cartridge's
+    emu_select_core(EMU_GENERIC_CORE);
+    if (power_on_state == NULL)
+    {
+        power_on_state = malloc(state_size());
+        if (power_on_state == NULL)
+        {
+            snprintf(nes_create_error, sizeof(nes_create_error), "out of memory");
+            nes_file_free(&file);
+            return NULL;
+        }
+        state_save(power_on_state, state_size());
+    }
+    else
+    {
+        state_load(power_on_state, state_size());
+    }
+
+    struct nes* nes = malloc(sizeof(struct nes));
+    if (nes == NULL)
+    {
+        snprintf(nes_create_error, sizeof(nes_create_error), "out of memory");
+        nes_file_free(&file);
+        return NULL;
+    }
+    nes->file = file;
+    load_file(&nes->file);
+    cpu_reset();
+
+    nes_instance = nes;
+    return nes;
+}
+
+
+void nes_destroy(struct nes* nes)
+{
+    if (nes == NULL)
+        return;
+    nes_file_free(&nes->file);
+    free(nes);
+    nes_instance = NULL;
+}
+
+
+uint64_t nes_step_frames(struct nes* nes, uint64_t num_frames, const uint8_t (*inputs)[NES_NUM_CONTROLLERS])
+{
+    (void) nes;
+    for (uint64_t i = 0; i < num_frames; ++i)
+    {
+        if (inputs != NULL)
+            memcpy(io_buttons, inputs[i], IO_NUM_CONTROLLERS);
+        else
+            memset(io_buttons, 0, IO_NUM_CONTROLLERS);
+        if (!emu_run_frame())
+            return i;
+    }
+    return num_frames;
+}
+
+
+const char* nes_error(struct nes* nes)
+{
+    if (nes == NULL)
+        return nes_create_error[0] != '\0' ? nes_create_error : NULL;
+    if (!cpu_halted)
+        return NULL;
+    snprintf(nes->error, sizeof(nes->error), "unimplemented opcode $%02X at $%04X", cpu_ir,
+             (uint16_t) (cpu_registers.pc - 1));
+    return nes->error;
+}
+
+
+uint64_t nes_frame_count(const struct nes* nes)
+{
+    (void) nes;
+    return ppu_frame_count;
+}
+
+
+bool nes_boot_cached(struct nes* nes, const char* cache_dir, uint64_t num_frames)
+{
+    if (clock_cpu_cycles != 0)
+        return false;
+    return boot_cache_boot(cache_dir, nes_file_crc32(&nes->file), num_frames);
+}
+
+
+void nes_set_frame_skip(struct nes* nes, unsigned frame_skip)
+{
+    (void) nes;
+    ppu_frame_skip = frame_skip;
+}
+
+
+const uint8_t* nes_framebuffer(const struct nes* nes, size_t* stride)
+{
+    (void) nes;
+    *stride = sizeof(ppu_dot_array[0]);
+    return &ppu_dot_array[0][0];
+}
+
+
+const uint64_t* nes_row_hashes(const struct nes* nes)
+{
+    (void) nes;
+    return ppu_row_hashes;
+}
+
+
+static struct screen_scale nes_screen_scale(const struct nes_scale* scale)
+{
+    return (struct screen_scale) {
+        .crop_top = scale->crop_top,
+        .crop_bottom = scale->crop_bottom,
+        .crop_left = scale->crop_left,
+        .crop_right = scale->crop_right,
+        .factor = scale->factor,
+        .filter = scale->edges ? SCREEN_SCALE_EDGES : SCREEN_SCALE_NEAREST,
+    };
+}
+
+
+bool nes_scale_size(const struct nes_scale* scale, size_t* width, size_t* height)
+{
+    struct screen_scale screen = nes_screen_scale(scale);
+    if (!screen_scale_valid(&screen))
+        return false;
+    *width = screen_scale_width(&screen);
+    *height = screen_scale_height(&screen);
+    return true;
+}
+
+
+bool nes_scale_frame(const struct nes* nes, const struct nes_scale* scale, uint32_t* rgb, size_t stride,
+                     uint64_t* row_hashes)
+{
+    (void) nes;
+    struct screen_scale screen = nes_screen_scale(scale);
+    if (!screen_scale_valid(&screen))
+        return false;
+    if (row_hashes == NULL)
+    {
+        screen_scale(&ppu_dot_array[0][0], sizeof(ppu_dot_array[0]), &screen, rgb, stride, NULL);
+        return true;
+    }
+
+    bool rows[FRAME_HEIGHT];
+    if (screen_scale_changed_rows_of(&screen, ppu_row_hashes, row_hashes, rows) != 0)
+        screen_scale(&ppu_dot_array[0][0], sizeof(ppu_dot_array[0]), &screen, rgb, stride, rows);
+    return true;
+}
+
+
+uint8_t* nes_ram(struct nes* nes)
+{
+    (void) nes;
+    return ram;
+}
+
+
+const int16_t* nes_audio(const struct nes* nes, size_t* num_samples)
+{
+    (void) nes;
+    static const int16_t no_samples[1] = { 0 };
+    *num_samples = 0;
+    return no_samples;
+}
+
+
+size_t nes_state_size(const struct nes* nes)
+{
+    (void) nes;
+    return state_size();
+}
+
+
+bool nes_save_state(struct nes* nes, void* buffer, size_t size)
+{
+    (void) nes;
+    return state_save(buffer, size);
+}
+
+
+bool nes_load_state(struct nes* nes, const void* buffer, size_t size)
+{
+    (void) nes;
+    return state_load(buffer, size);
+}
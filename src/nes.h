@@ -0,0 +1,156 @@
+//
+// Created by quate on 10/19/2026.
+//
+// libnes: the emulator core as a library, for driving it from other programs without a window or a thread.
+//
+// The core keeps its state in globals, so only one struct nes can exist at a time in a process; nes_create() fails
+// while another instance is alive. To explore several timelines, keep one instance and switch between them with
+// nes_save_state() and nes_load_state(). To run instances side by side (search, training), run each in its own
+// process, e.g. fork() a worker per instance and collect results over a pipe, as nes_testfarm does.
+//
+// Nothing here allocates after nes_create(), and every pointer returned stays valid until nes_destroy().
+//
+// libnes never calls exit() or otherwise ends the host process. A ROM that runs into something the core does not
+// emulate, such as an opcode the CPU does not implement, stops emulation instead; see nes_error().
+//
+
+#ifndef NES_EMULATOR_NES_H
+#define NES_EMULATOR_NES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NES_API __attribute__((visibility("default")))
+#else
+#define NES_API
+#endif
+
+#define NES_NUM_CONTROLLERS 2
+#define NES_FRAME_WIDTH 256
+#define NES_FRAME_HEIGHT 240
+#define NES_RAM_SIZE 0x0800
+
+struct nes;
+
+/**
+ * Powers on a console with the given iNES image inserted. The image is copied.
+ *
+ * Not reentrant across instances: the console lives in the library's globals, so a second instance in the same
+ * process is refused until the first is destroyed. Harnesses that need several consoles at once need a process each.
+ *
+ * @return NULL if the image is invalid, its mapper is not implemented, or another instance exists; nes_error(NULL)
+ *         says which.
+ */
+NES_API struct nes* nes_create(const uint8_t* rom, size_t rom_size);
+
+NES_API void nes_destroy(struct nes* nes);
+
+/**
+ * Runs frames back to back.
+ *
+ * @param inputs Buttons held on each controller for each frame (bit 0 = A ... bit 7 = Right), or NULL for none.
+ * @return Number of frames completed; fewer than num_frames if emulation stopped (see nes_error()).
+ */
+NES_API uint64_t nes_step_frames(struct nes* nes, uint64_t num_frames, const uint8_t (*inputs)[NES_NUM_CONTROLLERS]);
+
+/**
+ * Why emulation stopped, or NULL while it can run. Once stopped, nes_step_frames() completes no more frames until a
+ * state saved before that point is loaded; the rest of the console can still be looked at, e.g. nes_ram().
+ *
+ * With nes NULL: why the last nes_create() returned NULL, or NULL if it succeeded.
+ */
+NES_API const char* nes_error(struct nes* nes);
+
+/// Frames run since power-on
+NES_API uint64_t nes_frame_count(const struct nes* nes);
+
+/**
+ * Runs a console fresh from nes_create() for num_frames frames with no buttons held, or, if cache_dir has a state
+ * saved by an earlier boot of the same ROM for as many frames with this build, restores it instead; a missing entry
+ * is added. For batch jobs that start many runs from power-on.
+ *
+ * @return false if the console was not fresh from nes_create().
+ */
+NES_API bool nes_boot_cached(struct nes* nes, const char* cache_dir, uint64_t num_frames);
+
+/**
+ * Renders only every (frame_skip + 1)th frame. Skipped frames run with identical CPU-visible behavior, but the
+ * framebuffer keeps the last rendered frame.
+ */
+NES_API void nes_set_frame_skip(struct nes* nes, unsigned frame_skip);
+
+/**
+ * The framebuffer: NES_FRAME_HEIGHT rows of NES_FRAME_WIDTH palette indices (0-63), each row stride bytes apart.
+ * Frames are drawn into two buffers in turn, so get it again after each nes_step_frames() call; the previous pointer
+ * then holds the frame before, until the next frame is rendered.
+ */
+NES_API const uint8_t* nes_framebuffer(const struct nes* nes, size_t* stride);
+
+/**
+ * A hash of each row of the framebuffer, NES_FRAME_HEIGHT of them. Equal rows have equal hashes, so a caller that
+ * keeps the hashes of the frame it last consumed only needs to look at rows whose hash changed. Get it again after
+ * each nes_step_frames() call, like nes_framebuffer().
+ */
+NES_API const uint64_t* nes_row_hashes(const struct nes* nes);
+
+/**
+ * Post-processing of the framebuffer into a picture: overscan cropped off each side (NTSC TVs hide about 8 lines at
+ * the top and the bottom), then scaled up by an integer factor.
+ */
+struct nes_scale
+{
+    uint8_t crop_top;       /// Lines
+    uint8_t crop_bottom;
+    uint8_t crop_left;      /// Columns
+    uint8_t crop_right;
+    uint8_t factor;         /// 1 to 6
+    bool edges;             /// Scale2x (factors 2 and 4) or Scale3x (3 and 6) instead of plain pixel blocks
+};
+
+/**
+ * Size of the picture in pixels.
+ *
+ * @return false if the crop leaves nothing, or the factor is out of range or, with edges, not a multiple of 2 or 3.
+ */
+NES_API bool nes_scale_size(const struct nes_scale* scale, size_t* width, size_t* height);
+
+/**
+ * Crops, scales and converts the framebuffer straight into the caller's picture, 0x00RRGGBB pixels in host byte
+ * order, with no intermediate copy. Only picture pixels are written, so rgb may point into a larger surface.
+ *
+ * @param stride Bytes from one picture row to the next
+ * @param row_hashes NULL to scale the whole frame, or the nes_row_hashes() of the frame rgb was last scaled from with
+ *                   the same scale, NES_FRAME_HEIGHT of them, to scale only what changed; updated to this frame's
+ * @return false if the scale is invalid (see nes_scale_size()).
+ */
+NES_API bool nes_scale_frame(const struct nes* nes, const struct nes_scale* scale, uint32_t* rgb, size_t stride,
+                             uint64_t* row_hashes);
+
+/// CPU RAM ($0000-$07FF), NES_RAM_SIZE bytes. May be written, e.g. to poke game state.
+NES_API uint8_t* nes_ram(struct nes* nes);
+
+/**
+ * Audio samples produced by the last nes_step_frames() call.
+ *
+ * The APU does not synthesize audio yet, so this is always empty.
+ */
+NES_API const int16_t* nes_audio(const struct nes* nes, size_t* num_samples);
+
+/// Size of a save state in bytes. The same for every state of this build.
+NES_API size_t nes_state_size(const struct nes* nes);
+
+/**
+ * @return false if size is less than nes_state_size().
+ */
+NES_API bool nes_save_state(struct nes* nes, void* buffer, size_t size);
+
+/**
+ * Restores a state saved by nes_save_state() in this build, with the same ROM inserted.
+ *
+ * @return false, leaving the console untouched, if the buffer does not hold such a state.
+ */
+NES_API bool nes_load_state(struct nes* nes, const void* buffer, size_t size);
+
+#endif //NES_EMULATOR_NES_H
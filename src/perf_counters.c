@@ -0,0 +1,196 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "perf_counters.h"
+#include <errno.h>
+#include <string.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+const char* const perf_counter_names[PERF_NUM_COUNTERS] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_BRANCH_MISSES] = "branch-misses",
+    [PERF_L1D_MISSES] = "L1D misses",
+    [PERF_LLC_MISSES] = "LLC misses",
+};
+
+
+#ifdef __linux__
+
+#define PERF_CACHE_READ_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static const struct
+{
+    uint32_t type;
+    uint64_t config;
+} perf_events[PERF_NUM_COUNTERS] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_L1D_MISSES] = { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    [PERF_LLC_MISSES] = { PERF_TYPE_HW_CACHE, PERF_CACHE_READ_MISS(PERF_COUNT_HW_CACHE_LL) },
+};
+
+
+bool perf_counters_open(struct perf_counters* perf)
+{
+    bool any = false;
+    perf->error = 0;
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.disabled = 1;
+        // User space only: allowed at the default perf_event_paranoid of 2, and the emulator hardly enters the kernel
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        perf->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (perf->fds[i] < 0 && perf->error == 0)
+            perf->error = errno;
+        any = any || perf->fds[i] >= 0;
+    }
+    return any;
+}
+
+
+void perf_counters_start(struct perf_counters* perf)
+{
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        if (perf->fds[i] < 0)
+            continue;
+        ioctl(perf->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(perf->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+void perf_counters_stop(struct perf_counters* perf, struct perf_counts* counts)
+{
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        if (perf->fds[i] >= 0)
+            ioctl(perf->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    counts->available = 0;
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        counts->counts[i] = 0;
+        uint64_t value[3];  // count, time enabled, time running
+        if (perf->fds[i] < 0 || read(perf->fds[i], value, sizeof(value)) != sizeof(value) || value[2] == 0)
+            continue;
+        // With more counters than the PMU has, the kernel takes turns; extrapolate to the whole time
+        counts->counts[i] = value[2] < value[1] ? (uint64_t) ((double) value[0] * value[1] / value[2]) : value[0];
+        counts->available |= 1u << i;
+    }
+}
+
+
+void perf_counters_close(struct perf_counters* perf)
+{
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        if (perf->fds[i] >= 0)
+            close(perf->fds[i]);
+        perf->fds[i] = -1;
+    }
+}
+
+#else
+
+bool perf_counters_open(struct perf_counters* perf)
+{
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        perf->fds[i] = -1;
+    }
+    perf->error = ENOSYS;
+    return false;
+}
+
+void perf_counters_start(struct perf_counters* perf)
+{
+    (void) perf;
+}
+
+void perf_counters_stop(struct perf_counters* perf, struct perf_counts* counts)
+{
+    (void) perf;
+    memset(counts, 0, sizeof(*counts));
+}
+
+void perf_counters_close(struct perf_counters* perf)
+{
+    (void) perf;
+}
+
+#endif
+
+
+const char* perf_counters_error(const struct perf_counters* perf)
+{
+    switch (perf->error)
+    {
+        case 0:
+            return "no error";
+        case EACCES:
+        case EPERM:
+            return "not permitted (see /proc/sys/kernel/perf_event_paranoid)";
+        case ENOENT:
+        case ENODEV:
+        case EOPNOTSUPP:
+            return "not supported by this CPU or virtual machine";
+        case ENOSYS:
+            return "no perf events on this system";
+        default:
+            return strerror(perf->error);
+    }
+}
+
+
+void perf_counts_print(FILE* file, const struct perf_counts* counts, uint64_t frames, uint64_t cpu_cycles,
+                       const char* indent)
+{
+    if (frames != 0)
+        fprintf(file, "%s%-14s %16s %14s %14s\n", indent, "", "total", "per frame", "per 6502 cycle");
+    else
+        fprintf(file, "%s%-14s %16s %14s\n", indent, "", "total", "per 6502 cycle");
+    for (size_t i = 0; i < PERF_NUM_COUNTERS; ++i)
+    {
+        if ((counts->available & (1u << i)) == 0)
+        {
+            fprintf(file, "%s%-14s %16s\n", indent, perf_counter_names[i], "unavailable");
+            continue;
+        }
+        fprintf(file, "%s%-14s %16llu", indent, perf_counter_names[i], (unsigned long long) counts->counts[i]);
+        if (frames != 0)
+            fprintf(file, " %14.1f", (double) counts->counts[i] / frames);
+        fprintf(file, " %14.3f\n", cpu_cycles != 0 ? (double) counts->counts[i] / cpu_cycles : 0);
+    }
+
+    uint32_t ipc = (1u << PERF_CYCLES) | (1u << PERF_INSTRUCTIONS);
+    if ((counts->available & ipc) == ipc && counts->counts[PERF_CYCLES] != 0)
+    {
+        fprintf(file, "%sinstructions per cycle: %.2f\n", indent,
+                (double) counts->counts[PERF_INSTRUCTIONS] / counts->counts[PERF_CYCLES]);
+    }
+    uint32_t mpki = (1u << PERF_INSTRUCTIONS) | (1u << PERF_BRANCH_MISSES);
+    if ((counts->available & mpki) == mpki && counts->counts[PERF_INSTRUCTIONS] != 0)
+    {
+        fprintf(file, "%sbranch misses per 1000 instructions: %.2f\n", indent,
+                counts->counts[PERF_BRANCH_MISSES] * 1000.0 / counts->counts[PERF_INSTRUCTIONS]);
+    }
+}
@@ -0,0 +1,69 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Hardware performance counters (Linux perf_event_open) around a stretch of emulation, for the benchmarks and the
+// test farm. The counters count the calling thread only, in user space, so a render thread (--parallel-ppu) is not
+// included. Counters the kernel or the machine doesn't allow (perf_event_paranoid, virtual machines without a PMU,
+// other systems than Linux) are left out; the runs work the same without them.
+//
+
+#ifndef NES_EMULATOR_PERF_COUNTERS_H
+#define NES_EMULATOR_PERF_COUNTERS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+enum perf_counter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_BRANCH_MISSES,
+    PERF_L1D_MISSES,      /// L1 data cache read misses
+    PERF_LLC_MISSES,      /// Last-level cache read misses
+    PERF_NUM_COUNTERS
+};
+
+extern const char* const perf_counter_names[PERF_NUM_COUNTERS];
+
+/// Counts of one measurement; plain data, so it can be passed between processes
+struct perf_counts
+{
+    uint32_t available;                   /// Bit per enum perf_counter that was counted
+    uint64_t counts[PERF_NUM_COUNTERS];   /// Scaled up if the kernel had to multiplex counters
+};
+
+struct perf_counters
+{
+    int fds[PERF_NUM_COUNTERS];  /// -1 for counters that could not be opened
+    int error;                   /// errno of the first counter that could not be opened, 0 if none
+};
+
+/**
+ * Opens the counters the kernel allows, stopped.
+ *
+ * @return false if none could be opened; see perf_counters_error()
+ */
+bool perf_counters_open(struct perf_counters* perf);
+
+/// Why counters could not be opened, for reports
+const char* perf_counters_error(const struct perf_counters* perf);
+
+/// Zeroes and starts the counters.
+void perf_counters_start(struct perf_counters* perf);
+
+/// Stops the counters and reads them.
+void perf_counters_stop(struct perf_counters* perf, struct perf_counts* counts);
+
+void perf_counters_close(struct perf_counters* perf);
+
+/**
+ * Prints a table of the counts, per emulated frame (left out if frames is 0) and per emulated 6502 cycle, with
+ * instructions per cycle and branch misses per thousand instructions when those were counted.
+ *
+ * @param indent Printed before each line
+ */
+void perf_counts_print(FILE* file, const struct perf_counts* counts, uint64_t frames, uint64_t cpu_cycles,
+                       const char* indent);
+
+#endif //NES_EMULATOR_PERF_COUNTERS_H
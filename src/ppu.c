@@ -6,46 +6,65 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
 #include "exit_codes.h"
+#include "frame.h"
+#include "state.h"
+#include "ppu_render.h"
+#include "cartridge/mappers.h"
+#include "cartridge/nrom00.h"
+#include "cpu/cpu.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define NUM_SPRITES_PER_SCANLINE 8
 #define NUM_TILES_PER_SCANLINE 32
+#define NUM_DOTS_PER_SCANLINE 341
+#define VBLANK_SCANLINE 241
+#define PRERENDER_SCANLINE 261
+#define NUM_SCANLINES 262
+#define NUM_OAM_ENTRIES 64
 
 
 /// Cartridge mapping functions
-/**
- * Default PPU nametable mapping to internal PPU RAM.
- * @param addr
- * @return
- */
-uint8_t* default_ppu_nametable(uint16_t addr)
-{
-    switch (ppu_nametable_mirroring)
-    {
-        // 0x2000 = 0x2400, 0x2800 = 0x2C00
-        case MIRRORING_H: return &ppu_ram[addr & 0x03FF + (addr & 0x0800 >> 1)];  // TODO: kinda cursed
-        // 0x2000 = 0x2800, 0x2400 = 0x2C00
-        case MIRRORING_V: return &ppu_ram[addr & 0x07FF];
-    }
-}
-
 uint8_t* (*ppu_map_pattern_table_0)(uint16_t addr) = NULL;
 uint8_t* (*ppu_map_pattern_table_1)(uint16_t addr) = NULL;
-uint8_t* (*ppu_map_nametable_0)(uint16_t addr) = default_ppu_nametable;
-uint8_t* (*ppu_map_nametable_1)(uint16_t addr) = default_ppu_nametable;
-uint8_t* (*ppu_map_nametable_2)(uint16_t addr) = default_ppu_nametable;
-uint8_t* (*ppu_map_nametable_3)(uint16_t addr) = default_ppu_nametable;
-uint8_t* (*ppu_map_unused_space)(uint16_t addr) = NULL;
 
 enum mirroring ppu_nametable_mirroring;
 
 uint8_t ppu_ram[PPU_INTERNAL_RAM_SIZE];
+uint8_t ppu_cartridge_vram[PPU_INTERNAL_RAM_SIZE];
+uint8_t* ppu_nametables[4] = {
+    &ppu_ram[0], &ppu_ram[0], &ppu_ram[PPU_NAMETABLE_SIZE], &ppu_ram[PPU_NAMETABLE_SIZE]
+};
 uint8_t ppu_palette_ram[PPU_PALETTE_RAM_SIZE];
 
+static uint8_t ppu_frames[2][FRAME_HEIGHT][FRAME_WIDTH];
+static uint64_t ppu_frame_row_hashes[2][FRAME_HEIGHT];
+static size_t ppu_frame_index = 0;
+uint8_t (*ppu_dot_array)[FRAME_WIDTH] = ppu_frames[0];
+const uint64_t* ppu_row_hashes = ppu_frame_row_hashes[0];
+
+uint64_t ppu_frame_count = 0;
+bool ppu_frame_complete = false;
+
+unsigned int ppu_frame_skip = 0;
+bool ppu_skip_rendering = false;
+static bool ppu_no_render = false;
+
+void (*ppu_on_a12_rise)() = NULL;
+void (*ppu_on_vblank)() = NULL;
+
+struct oam_entry ppu_oam[64];
+
 
 // TODO: https://www.nesdev.org/wiki/PPU_power_up_state
 // TODO: Ignore writes to registers for ~29658 CPU clock cycles
 struct ppu_registers ppu_registers;  // TODO: explicit construction
+struct ppu_context ppu_context = { .resume = RESUME_POINT_START };
+_Static_assert(sizeof(struct ppu_registers) == 8, "PPU registers must map byte-for-byte onto 0x2000-0x2007");
 
 /// Internal registers
 // These are all the internal registers of the PPU
@@ -55,6 +74,60 @@ static uint16_t ppu_t;  /// 15 bits
 static uint16_t ppu_x;  /// 3 bits
 static uint16_t ppu_w;  /// 1 bit
 
+/// PPU-side address and data bus, as used by rendering fetches
+static uint16_t ppu_addr_bus;
+static uint8_t ppu_data_bus;
+
+/// Internal read buffer behind PPUDATA
+static uint8_t ppu_read_buffer;
+
+/// Level of PPU address line 12 on the last pattern fetch; mappers such as MMC3 clock on its rising edge
+static bool ppu_a12;
+
+/// Pixel column being output; also tells where in the scanline a CPU write landed
+static size_t pixel_x;
+
+
+/// Records a change the picture depends on for the render thread, if the current frame is being logged
+static void ppu_log(enum ppu_render_event_kind kind, uint16_t addr, uint8_t value)
+{
+    if (ppu_render_log == NULL)
+        return;
+    size_t line = ppu_context.scanline == PRERENDER_SCANLINE ? 0 : ppu_context.scanline + 1;
+    ppu_render_event(PPU_RENDER_TIME(line, pixel_x), kind, addr, value);
+}
+
+
+void ppu_map_nametables(enum mirroring mirroring, uint8_t* ram, uint8_t* cartridge_vram, uint8_t* slots[4])
+{
+    // Which 1kB bank backs each slot
+    static const uint8_t banks[][4] = {
+        [MIRRORING_H] = { 0, 0, 1, 1 },
+        [MIRRORING_V] = { 0, 1, 0, 1 },
+        [MIRRORING_SINGLE_A] = { 0, 0, 0, 0 },
+        [MIRRORING_SINGLE_B] = { 1, 1, 1, 1 },
+        [MIRRORING_FOUR_SCREEN] = { 0, 1, 2, 3 },
+    };
+
+    for (size_t slot = 0; slot < 4; ++slot)
+    {
+        uint8_t bank = banks[mirroring][slot];
+        slots[slot] = bank < 2 ? &ram[bank * PPU_NAMETABLE_SIZE] : &cartridge_vram[(bank - 2) * PPU_NAMETABLE_SIZE];
+    }
+}
+
+void ppu_set_mirroring(enum mirroring mirroring)
+{
+    ppu_nametable_mirroring = mirroring;
+    ppu_map_nametables(mirroring, ppu_ram, ppu_cartridge_vram, ppu_nametables);
+    ppu_log(PPU_RENDER_MIRRORING, 0, mirroring);
+}
+
+void ppu_set_no_render(bool no_render)
+{
+    ppu_no_render = no_render;
+}
+
 
 // https://www.nesdev.org/wiki/PPU_memory_map
 uint8_t* ppu_mem_map(uint16_t addr)
@@ -64,130 +137,651 @@ uint8_t* ppu_mem_map(uint16_t addr)
         case 0b00: return ppu_map_pattern_table_0(addr);  // left
         case 0b01: return ppu_map_pattern_table_1(addr);  // right
         case 0b10:
-            switch ((addr & 0x0FFF) >> 10)
-            {
-                case 0b00: return ppu_map_nametable_0(addr);
-                case 0b01: return ppu_map_nametable_1(addr);
-                case 0b10: return ppu_map_nametable_2(addr);
-                case 0b11: return ppu_map_nametable_3(addr);
-            }
+            return &ppu_nametables[(addr >> 10) & 0x03][addr & 0x03FF];
         case 0b11:
-            if ((addr & 0x0F00) != 0x0F00) return ppu_map_unused_space(addr);
-            return &ppu_palette_ram[addr & 0x00FF];
+            // 0x3000-0x3EFF mirrors the nametables
+            if ((addr & 0x0F00) != 0x0F00) return &ppu_nametables[(addr >> 10) & 0x03][addr & 0x03FF];
+            // 0x3F10/0x3F14/0x3F18/0x3F1C mirror the backdrop entries 0x3F00/0x3F04/0x3F08/0x3F0C
+            if ((addr & 0x0013) == 0x0010) return &ppu_palette_ram[addr & 0x000F];
+            return &ppu_palette_ram[addr & 0x001F];
         default:
             exit(ERROR_CODE__OH_NO);
     }
 }
 
 
-void read()
+static void ppu_read()
 {
-    ppu_registers.ppu_data = *ppu_mem_map(ppu_registers.ppu_addr);
+    ppu_data_bus = *ppu_mem_map(ppu_addr_bus);
 }
 
 
-void write()
+static void ppu_write()
 {
-    *ppu_mem_map(ppu_registers.ppu_addr) = ppu_registers.ppu_data;
+    *ppu_mem_map(ppu_addr_bus) = ppu_data_bus;
 }
 
 
-#define BEGIN_RESUMABLE static size_t resume_location = __LINE__; switch (resume_location) { case __LINE__:;
-#define END_CYCLE resume_location = __LINE__; return; case __LINE__:;
-#define RES_CALL(call_statement) resume_location = __LINE__; case __LINE__:; if (!call_statement) { return false; }
-#define END_RESUMABLE default: exit(-1); }
+/// Nametable or attribute read for rendering: ppu_addr_bus is always in 0x2000-0x2FFF
+static void ppu_read_nametable()
+{
+    ppu_data_bus = ppu_nametables[(ppu_addr_bus >> 10) & 0x03][ppu_addr_bus & 0x03FF];
+}
 
-#define SIZE_OF_NAMETABLE_TILE 1
 
-void ppu_cycle()
+static bool ppu_rendering_enabled()
 {
-    BEGIN_RESUMABLE
-    static size_t scanline = 0;
-    // Visible scanlines
-    for (; scanline < 240; ++scanline)
-    {
-        // TODO: cycle 0
-        END_CYCLE
+    return ppu_registers.ppu_mask.bg || ppu_registers.ppu_mask.sp;
+}
+
 
-        static uint8_t tile = 0;
-        static uint8_t curr_tile_id;  // (output of nametable)
-        static uint8_t curr_tile_attr;
-        static uint8_t curr_pattern_low;
-        static uint8_t curr_pattern_high;
+/// CPU interface
+// https://www.nesdev.org/wiki/PPU_registers
+#define PPU_CTRL 0
+#define PPU_MASK 1
+#define PPU_STATUS 2
+#define OAM_ADDR 3
+#define OAM_DATA 4
+#define PPU_SCROLL 5
+#define PPU_ADDR 6
+#define PPU_DATA 7
+
+static uint16_t ppu_vram_increment()
+{
+    return ppu_registers.ppu_ctrl.i ? 32 : 1;
+}
 
-        static uint16_t nametable_base_addr;
-        static uint16_t attr_base_addr;
-        switch (ppu_registers.ppu_ctrl.nt_sel)
+uint8_t ppu_register_read(uint8_t reg)
+{
+    uint8_t* regs = (uint8_t*) &ppu_registers;  // TODO: see other register todos
+    switch (reg)
+    {
+        case PPU_STATUS:
         {
-            case 0: nametable_base_addr = 0x2000;
-            case 1: nametable_base_addr = 0x2400;
-            case 2: nametable_base_addr = 0x2800;
-            case 3: nametable_base_addr = 0x2C00;
+            uint8_t value = regs[PPU_STATUS];
+            ppu_registers.ppu_status.v = 0;
+            ppu_w = 0;
+            return value;
         }
+        case OAM_DATA:
+            return ((uint8_t*) ppu_oam)[ppu_registers.oam_addr];
+        case PPU_DATA:
+        {
+            ppu_addr_bus = ppu_v & 0x3FFF;
+            ppu_read();
+            // Palette reads are not delayed by the read buffer
+            uint8_t value = ppu_addr_bus >= 0x3F00 ? ppu_data_bus : ppu_read_buffer;
+            ppu_read_buffer = ppu_data_bus;
+            ppu_registers.ppu_data = value;
+            ppu_v += ppu_vram_increment();
+            ppu_log(PPU_RENDER_READ, ppu_addr_bus, 0);
+            return value;
+        }
+        default:
+            // Write-only registers read back the last value written
+            return regs[reg];
+    }
+}
+
+void ppu_register_write(uint8_t reg, uint8_t value)
+{
+    uint8_t* regs = (uint8_t*) &ppu_registers;  // TODO: see other register todos
+    bool nmi_enabled = ppu_registers.ppu_ctrl.nmi;
+    if (reg != PPU_STATUS)
+        regs[reg] = value;
+
+    switch (reg)
+    {
+        case PPU_CTRL:
+            // /NMI is (vblank flag AND NMI enable), so enabling NMI during vblank is another falling edge
+            if (!nmi_enabled && ppu_registers.ppu_ctrl.nmi && ppu_registers.ppu_status.v)
+                cpu_nmi();
+            ppu_t = (ppu_t & ~0x0C00) | ((value & 0x03) << 10);
+            ppu_log(PPU_RENDER_CTRL, 0, value);
+            break;
+        case PPU_MASK:
+            ppu_log(PPU_RENDER_MASK, 0, value);
+            break;
+        case OAM_DATA:
+            ((uint8_t*) ppu_oam)[ppu_registers.oam_addr++] = value;
+            ppu_oam_changed();
+            break;
+        case PPU_SCROLL:
+            if (!ppu_w)
+            {
+                ppu_t = (ppu_t & ~0x001F) | (value >> 3);
+                ppu_x = value & 0x07;
+                ppu_log(PPU_RENDER_FINE_X, 0, ppu_x);
+            }
+            else
+            {
+                ppu_t = (ppu_t & ~0x73E0) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+            }
+            ppu_w ^= 1;
+            break;
+        case PPU_ADDR:
+            if (!ppu_w)
+            {
+                ppu_t = (ppu_t & 0x00FF) | ((value & 0x3F) << 8);
+            }
+            else
+            {
+                ppu_t = (ppu_t & 0xFF00) | value;
+                ppu_v = ppu_t;
+                ppu_log(PPU_RENDER_V, ppu_v, 0);
+            }
+            ppu_w ^= 1;
+            break;
+        case PPU_DATA:
+            ppu_addr_bus = ppu_v & 0x3FFF;
+            ppu_data_bus = value;
+            ppu_write();
+            ppu_v += ppu_vram_increment();
+            ppu_log(PPU_RENDER_WRITE, ppu_addr_bus, value);
+            break;
+        default:
+            break;
+    }
+}
+
+
+void ppu_oam_dma(const uint8_t* src)
+{
+    uint8_t* oam = (uint8_t*) ppu_oam;
+    size_t first = sizeof(ppu_oam) - ppu_registers.oam_addr;
+    memcpy(&oam[ppu_registers.oam_addr], src, first);
+    memcpy(oam, &src[first], ppu_registers.oam_addr);  // wraps around when OAMADDR isn't 0
+    ppu_oam_changed();
+}
+
+
+/// Scrolling
+// https://www.nesdev.org/wiki/PPU_scrolling#Wrapping_around
+static void ppu_increment_coarse_x()
+{
+    if ((ppu_v & 0x001F) == 31)
+    {
+        ppu_v &= ~0x001F;
+        ppu_v ^= 0x0400;  // switch horizontal nametable
+    }
+    else
+    {
+        ppu_v++;
+    }
+}
+
+static void ppu_increment_y()
+{
+    if ((ppu_v & 0x7000) != 0x7000)
+    {
+        ppu_v += 0x1000;  // fine y
+        return;
+    }
+
+    ppu_v &= ~0x7000;
+    uint16_t coarse_y = (ppu_v & 0x03E0) >> 5;
+    if (coarse_y == 29)
+    {
+        coarse_y = 0;
+        ppu_v ^= 0x0800;  // switch vertical nametable
+    }
+    else if (coarse_y == 31)
+    {
+        coarse_y = 0;  // attribute table rows wrap without switching nametable
+    }
+    else
+    {
+        coarse_y++;
+    }
+    ppu_v = (ppu_v & ~0x03E0) | (coarse_y << 5);
+}
+
+static void ppu_copy_horizontal()
+{
+    ppu_v = (ppu_v & ~0x041F) | (ppu_t & 0x041F);
+}
 
-        for (; tile < NUM_TILES_PER_SCANLINE; ++tile)
+static void ppu_copy_vertical()
+{
+    ppu_v = (ppu_v & ~0x7BE0) | (ppu_t & 0x7BE0);
+}
+
+
+/// Background pipeline
+// https://www.nesdev.org/wiki/PPU_rendering#Preface
+static uint8_t curr_tile_id;  // (output of nametable)
+static uint8_t curr_tile_attr;
+static uint8_t curr_pattern_low;
+static uint8_t curr_pattern_high;
+
+static uint16_t bg_pattern_shift_low;
+static uint16_t bg_pattern_shift_high;
+static uint16_t bg_attr_shift_low;
+static uint16_t bg_attr_shift_high;
+
+static void ppu_load_background_shifters()
+{
+    bg_pattern_shift_low = (bg_pattern_shift_low & 0xFF00) | curr_pattern_low;
+    bg_pattern_shift_high = (bg_pattern_shift_high & 0xFF00) | curr_pattern_high;
+    bg_attr_shift_low = (bg_attr_shift_low & 0xFF00) | (curr_tile_attr & 0b01 ? 0xFF : 0x00);
+    bg_attr_shift_high = (bg_attr_shift_high & 0xFF00) | (curr_tile_attr & 0b10 ? 0xFF : 0x00);
+}
+
+static void ppu_shift_background()
+{
+    bg_pattern_shift_low <<= 1;
+    bg_pattern_shift_high <<= 1;
+    bg_attr_shift_low <<= 1;
+    bg_attr_shift_high <<= 1;
+}
+
+static uint16_t ppu_nametable_addr()
+{
+    return 0x2000 | (ppu_v & 0x0FFF);
+}
+
+static uint16_t ppu_attribute_addr()
+{
+    return 0x23C0 | (ppu_v & 0x0C00) | ((ppu_v >> 4) & 0x38) | ((ppu_v >> 2) & 0x07);
+}
+
+static uint16_t ppu_background_pattern_addr()
+{
+    return (ppu_registers.ppu_ctrl.bg_sel << 12) | (curr_tile_id << 4) | (ppu_v >> 12);
+}
+
+
+/// Sprite pipeline
+// https://www.nesdev.org/wiki/PPU_sprite_evaluation
+
+/// Sprites selected for the next scanline (indices into ppu_oam)
+static uint8_t secondary_oam[NUM_SPRITES_PER_SCANLINE];
+static uint8_t secondary_oam_count;
+
+/// Sprite output units for the current scanline
+static struct sprite_unit sprite_units[NUM_SPRITES_PER_SCANLINE];
+static uint8_t sprite_unit_count;
+static bool sprite_zero_next;     /// Sprite 0 is in secondary_oam
+static bool sprite_zero_on_line;  /// Sprite 0 is in sprite_units[0]
+
+static uint8_t ppu_sprite_height()
+{
+    return ppu_registers.ppu_ctrl.sp_h == SIXTEEN ? 16 : 8;
+}
+
+bool ppu_sprite_overflow_bug = true;
+
+static bool ppu_sprite_y_in_range(uint8_t scanline, uint8_t y, uint8_t height)
+{
+    return scanline >= y && scanline - y < height;
+}
+
+/**
+ * Bitmask of the OAM entries whose Y range covers the given scanline (bit i = ppu_oam[i]).
+ *
+ * The 64 Y bytes are gathered from OAM into four vectors with two packs, then compared against the scanline all at
+ * once: an entry is in range iff y <= scanline and scanline - y < height.
+ */
+static uint64_t ppu_sprites_in_range(uint8_t scanline, uint8_t height)
+{
+#ifdef __SSE2__
+    const __m128i y_mask = _mm_set1_epi32(0xFF);
+    const __m128i line = _mm_set1_epi8((char) scanline);
+    const __m128i max_row = _mm_set1_epi8((char) (height - 1));
+    const __m128i* oam = (const __m128i*) ppu_oam;
+
+    uint64_t mask = 0;
+    for (size_t group = 0; group < 4; ++group)
+    {
+        // 16 entries -> their 16 Y bytes, in OAM order
+        __m128i y0 = _mm_and_si128(_mm_loadu_si128(&oam[group * 4 + 0]), y_mask);
+        __m128i y1 = _mm_and_si128(_mm_loadu_si128(&oam[group * 4 + 1]), y_mask);
+        __m128i y2 = _mm_and_si128(_mm_loadu_si128(&oam[group * 4 + 2]), y_mask);
+        __m128i y3 = _mm_and_si128(_mm_loadu_si128(&oam[group * 4 + 3]), y_mask);
+        __m128i ys = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+
+        __m128i row = _mm_sub_epi8(line, ys);
+        __m128i at_or_above = _mm_cmpeq_epi8(_mm_min_epu8(ys, line), ys);
+        __m128i in_range = _mm_and_si128(_mm_cmpeq_epi8(_mm_min_epu8(row, max_row), row), at_or_above);
+        mask |= (uint64_t) (uint16_t) _mm_movemask_epi8(in_range) << (group * 16);
+    }
+    return mask;
+#else
+    uint64_t mask = 0;
+    for (size_t i = 0; i < NUM_OAM_ENTRIES; ++i)
+    {
+        if (ppu_sprite_y_in_range(scanline, ppu_oam[i].sprite_y, height))
+            mask |= (uint64_t) 1 << i;
+    }
+    return mask;
+#endif
+}
+
+/**
+ * Sprite overflow as the hardware computes it: once 8 sprites are found it keeps scanning, but increments the byte
+ * offset within each entry along with the entry index, so it tests tile numbers, attributes and X positions as if
+ * they were Y coordinates. https://www.nesdev.org/wiki/PPU_sprite_evaluation#Sprite_overflow_bug
+ *
+ * @param n Entry after the 8th sprite found.
+ */
+static bool ppu_buggy_sprite_overflow(uint8_t scanline, uint8_t height, size_t n)
+{
+    const uint8_t* oam = (const uint8_t*) ppu_oam;
+    size_t m = 0;
+    for (; n < NUM_OAM_ENTRIES; ++n)
+    {
+        if (ppu_sprite_y_in_range(scanline, oam[n * 4 + m], height))
+            return true;
+        m = (m + 1) & 0x03;
+    }
+    return false;
+}
+
+/// Sprite lists for every visible scanline, valid until OAM, sprite height or the overflow option change
+static struct sprite_line
+{
+    uint8_t count;
+    bool overflow;
+    uint8_t sprites[NUM_SPRITES_PER_SCANLINE];
+} sprite_lines[NUM_VISIBLE_SCANLINES];
+static bool sprite_lines_valid = false;
+static uint8_t sprite_lines_height;
+static bool sprite_lines_overflow_bug;
+
+void ppu_oam_changed()
+{
+    sprite_lines_valid = false;
+}
+
+static void ppu_build_sprite_line(struct sprite_line* out, uint8_t scanline, uint8_t height)
+{
+    uint64_t mask = ppu_sprites_in_range(scanline, height);
+    out->count = 0;
+    out->overflow = false;
+    while (mask != 0 && out->count < NUM_SPRITES_PER_SCANLINE)
+    {
+        out->sprites[out->count++] = __builtin_ctzll(mask);
+        mask &= mask - 1;
+    }
+    if (out->count == NUM_SPRITES_PER_SCANLINE)
+    {
+        size_t next = out->sprites[NUM_SPRITES_PER_SCANLINE - 1] + 1;
+        out->overflow = ppu_sprite_overflow_bug ? ppu_buggy_sprite_overflow(scanline, height, next) : mask != 0;
+    }
+}
+
+/**
+ * Picks the sprites to be drawn on the scanline after the given one.
+ *
+ * OAM is normally only rewritten by DMA during vblank, so the lists for all 240 scanlines are built at once on the
+ * first evaluation after a change and the rest of the frame just looks them up.
+ */
+static void ppu_evaluate_sprites(size_t scanline)
+{
+    uint8_t height = ppu_sprite_height();
+    if (!sprite_lines_valid || sprite_lines_height != height || sprite_lines_overflow_bug != ppu_sprite_overflow_bug)
+    {
+        for (size_t line = 0; line < NUM_VISIBLE_SCANLINES; ++line)
         {
-            // TODO: sprite 0 hit
-            ppu_registers.ppu_addr = nametable_base_addr + tile * SIZE_OF_NAMETABLE_TILE;
-            END_CYCLE
-            read();
-            curr_tile_id = ppu_registers.ppu_data;
-            END_CYCLE
-
-            // TODO:
-//            ppu_registers.ppu_addr = attr_base_addr + tile / 2;
-            END_CYCLE
-            read();
-            curr_tile_attr = ppu_registers.ppu_data;
-            END_CYCLE
-
-            // TODO: read palette low bit plane
-            END_CYCLE
-            END_CYCLE
-
-            // TODO: read palette high bit plane
-            END_CYCLE
-            // TODO: push to shift registers
-            END_CYCLE
+            ppu_build_sprite_line(&sprite_lines[line], line, height);
         }
+        sprite_lines_valid = true;
+        sprite_lines_height = height;
+        sprite_lines_overflow_bug = ppu_sprite_overflow_bug;
+    }
+
+    const struct sprite_line* line = &sprite_lines[scanline];
+    memcpy(secondary_oam, line->sprites, line->count);
+    secondary_oam_count = line->count;
+    sprite_zero_next = line->count != 0 && line->sprites[0] == 0;
+    if (line->overflow)
+        ppu_registers.ppu_status.o = 1;
+}
+
+static uint8_t reverse_bits(uint8_t b)
+{
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+/**
+ * Pattern address of a sprite row. Unused slots fetch tile 0xFF like the hardware does, which matters for A12.
+ */
+static uint16_t ppu_sprite_pattern_addr(uint8_t slot, size_t scanline)
+{
+    uint8_t tile = 0xFF;
+    uint8_t row = 0;
+    uint8_t attr = 0;
+    if (slot < secondary_oam_count)
+    {
+        const struct oam_entry* entry = &ppu_oam[secondary_oam[slot]];
+        tile = entry->sprite_tile_num;
+        row = scanline - entry->sprite_y;
+        attr = entry->sprite_attr;
+    }
 
-        static uint8_t sprite;
-        for (; sprite < NUM_SPRITES_PER_SCANLINE; ++sprite)
+    if (ppu_registers.ppu_ctrl.sp_h == SIXTEEN)
+    {
+        if (attr & SPRITE_ATTR_FLIP_V) row = 15 - row;
+        return ((tile & 0x01) << 12) | ((tile & 0xFE) << 4) | ((row & 0x08) << 1) | (row & 0x07);
+    }
+
+    if (attr & SPRITE_ATTR_FLIP_V) row = 7 - row;
+    return (ppu_registers.ppu_ctrl.sp_sel << 12) | (tile << 4) | row;
+}
+
+static void ppu_load_sprite_unit(uint8_t slot, uint8_t pattern_low, uint8_t pattern_high)
+{
+    if (slot >= secondary_oam_count)
+        return;
+    const struct oam_entry* entry = &ppu_oam[secondary_oam[slot]];
+    struct sprite_unit* unit = &sprite_units[slot];
+    unit->x = entry->sprite_x;
+    unit->attr = entry->sprite_attr;
+    if (entry->sprite_attr & SPRITE_ATTR_FLIP_H)
+    {
+        pattern_low = reverse_bits(pattern_low);
+        pattern_high = reverse_bits(pattern_high);
+    }
+    unit->pattern_low = pattern_low;
+    unit->pattern_high = pattern_high;
+}
+
+
+/// Pixel output
+/**
+ * Whether this thread draws the current frame: not when it is skipped, nor when the render thread draws it.
+ */
+static bool ppu_drawing()
+{
+    return !ppu_skip_rendering && !ppu_render_parallel;
+}
+
+/**
+ * Whether the background fetches and shifters have to run. When nothing is drawn here they only matter for the
+ * sprite 0 hit, so they run just on the scanlines with sprite 0 and the ones that prefetch their first tiles.
+ * VRAM address updates and A12 happen either way.
+ */
+static bool ppu_background_pipeline()
+{
+    return ppu_drawing() || sprite_zero_on_line || sprite_zero_next;
+}
+
+/**
+ * Background pixel (0-3) at the current dot, honoring fine x and the left column mask.
+ */
+static uint8_t ppu_background_pixel(uint8_t* palette)
+{
+    if (!ppu_registers.ppu_mask.bg || (pixel_x < 8 && !ppu_registers.ppu_mask.bg_left))
+        return 0;
+    uint16_t mux = 0x8000 >> ppu_x;
+    *palette = ((bg_attr_shift_high & mux) ? 2 : 0) | ((bg_attr_shift_low & mux) ? 1 : 0);
+    return ((bg_pattern_shift_high & mux) ? 2 : 0) | ((bg_pattern_shift_low & mux) ? 1 : 0);
+}
+
+static bool ppu_sprites_visible_at_dot()
+{
+    return ppu_registers.ppu_mask.sp && (pixel_x >= 8 || ppu_registers.ppu_mask.sp_left);
+}
+
+/**
+ * Sprite 0 hit check. Runs on every visible dot, including on skipped frames, since games poll it.
+ */
+static void ppu_check_sprite_zero_hit()
+{
+    if (!sprite_zero_on_line || ppu_registers.ppu_status.s || pixel_x == 255 || !ppu_sprites_visible_at_dot())
+        return;
+    if (ppu_sprite_unit_pixel(&sprite_units[0], pixel_x) == 0)
+        return;
+    uint8_t palette;
+    if (ppu_background_pixel(&palette) != 0)
+        ppu_registers.ppu_status.s = 1;
+}
+
+/**
+ * Hashes a row 8 pixels at a time. Starts from 0 and maps a zero word to a zero state, so the zeroed buffers at
+ * power-on agree with their zeroed hashes.
+ */
+static uint64_t ppu_hash_row(const uint8_t* row)
+{
+    uint64_t hash = 0;
+    for (size_t x = 0; x < FRAME_WIDTH; x += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, &row[x], sizeof(word));
+        hash = ((hash << 5 | hash >> 59) ^ word) * 0x9E3779B97F4A7C15ull;
+    }
+    return hash;
+}
+
+void ppu_output_begin_frame()
+{
+    ppu_frame_index ^= 1;
+    ppu_dot_array = ppu_frames[ppu_frame_index];
+    ppu_row_hashes = ppu_frame_row_hashes[ppu_frame_index];
+}
+
+void ppu_output_row(size_t row)
+{
+    // Rows that match the frame before keep its hash; most of a typical frame does
+    size_t prev = ppu_frame_index ^ 1;
+    if (memcmp(ppu_frames[ppu_frame_index][row], ppu_frames[prev][row], FRAME_WIDTH) == 0)
+        ppu_frame_row_hashes[ppu_frame_index][row] = ppu_frame_row_hashes[prev][row];
+    else
+        ppu_frame_row_hashes[ppu_frame_index][row] = ppu_hash_row(ppu_frames[ppu_frame_index][row]);
+}
+
+/**
+ * Composes the final pixel from background and sprites and writes it to the frame.
+ */
+static void ppu_compose_pixel(size_t scanline)
+{
+    uint8_t bg_palette = 0;
+    uint8_t bg_pixel = ppu_background_pixel(&bg_palette);
+
+    uint8_t sp_pixel = 0;
+    uint8_t sp_attr = 0;
+    if (ppu_sprites_visible_at_dot())
+    {
+        for (uint8_t i = 0; i < sprite_unit_count; ++i)
         {
-            // TODO: sprite data fetches
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
-            END_CYCLE
+            sp_pixel = ppu_sprite_unit_pixel(&sprite_units[i], pixel_x);
+            if (sp_pixel != 0)
+            {
+                sp_attr = sprite_units[i].attr;
+                break;
+            }
         }
+    }
+
+    uint8_t color = *ppu_mem_map(0x3F00 | ppu_palette_index(bg_pixel, bg_palette, sp_pixel, sp_attr));
+    ppu_dot_array[scanline][pixel_x] = color & (ppu_registers.ppu_mask.grey ? 0x30 : 0x3F);
+}
+
+/**
+ * Per-dot background work for dots 1-256 and 321-336. Outputs a pixel on visible dots of visible scanlines.
+ */
+static void ppu_background_dot(size_t scanline)
+{
+    if (scanline < NUM_VISIBLE_SCANLINES && pixel_x < FRAME_WIDTH)
+    {
+        // Skipped and handed-off frames still need sprite 0 hit for game logic; only the pixel itself is elided
+        ppu_check_sprite_zero_hit();
+        if (ppu_drawing())
+            ppu_compose_pixel(scanline);
+    }
+    pixel_x++;
+    if (ppu_rendering_enabled() && ppu_background_pipeline())
+        ppu_shift_background();
+}
+
+
+// The generic core, for cartridges whose mapper has no specialized one
+#define PPU_CYCLE_NAME ppu_cycle
+#define PPU_PATTERN(addr) ppu_mem_map(addr)
+#define PPU_A12_RISE() do { if (ppu_on_a12_rise != NULL) ppu_on_a12_rise(); } while (0)
+#include "ppu_cycle.h"
+
+// One core per mapper in NES_MAPPERS
+#define PPU_MAPPER nrom
+#include "ppu_cycle.h"
+
+/// Stops the build here, rather than at link time, for a mapper in NES_MAPPERS without a core above
+#define PPU_CHECK_CORE(name, number) _Static_assert(ppu_cycle_core_##name, "no ppu_cycle_" #name " in ppu.c");
+NES_MAPPERS(PPU_CHECK_CORE)
+
 
-        // TODO: next two tiles
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-
-        // TODO: unused fetches
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-        END_CYCLE
-    }
-    END_RESUMABLE
+void ppu_state(struct state* state)
+{
+    STATE_FIELD(state, ppu_registers);
+    STATE_CODE_POINTER(state, ppu_context.resume);
+    STATE_FIELD(state, ppu_context.scanline);
+    STATE_FIELD(state, ppu_context.dot);
+    STATE_FIELD(state, ppu_context.tile);
+    STATE_FIELD(state, ppu_context.sprite);
+    STATE_FIELD(state, ppu_context.sprite_pattern_low);
+    STATE_FIELD(state, ppu_nametable_mirroring);
+    STATE_FIELD(state, ppu_ram);
+    STATE_FIELD(state, ppu_cartridge_vram);
+    STATE_FIELD(state, ppu_palette_ram);
+    STATE_FIELD(state, ppu_oam);
+    STATE_FIELD(state, ppu_frame_count);
+    STATE_FIELD(state, ppu_frame_complete);
+    STATE_FIELD(state, ppu_skip_rendering);
+
+    STATE_FIELD(state, ppu_v);
+    STATE_FIELD(state, ppu_t);
+    STATE_FIELD(state, ppu_x);
+    STATE_FIELD(state, ppu_w);
+    STATE_FIELD(state, ppu_addr_bus);
+    STATE_FIELD(state, ppu_data_bus);
+    STATE_FIELD(state, ppu_read_buffer);
+    STATE_FIELD(state, ppu_a12);
+
+    STATE_FIELD(state, curr_tile_id);
+    STATE_FIELD(state, curr_tile_attr);
+    STATE_FIELD(state, curr_pattern_low);
+    STATE_FIELD(state, curr_pattern_high);
+    STATE_FIELD(state, bg_pattern_shift_low);
+    STATE_FIELD(state, bg_pattern_shift_high);
+    STATE_FIELD(state, bg_attr_shift_low);
+    STATE_FIELD(state, bg_attr_shift_high);
+    STATE_FIELD(state, pixel_x);
+
+    STATE_FIELD(state, secondary_oam);
+    STATE_FIELD(state, secondary_oam_count);
+    STATE_FIELD(state, sprite_units);
+    STATE_FIELD(state, sprite_unit_count);
+    STATE_FIELD(state, sprite_zero_next);
+    STATE_FIELD(state, sprite_zero_on_line);
+
+    if (state->mode == STATE_LOAD)
+    {
+        // The frame being logged for the render thread started from the state being replaced; drop it
+        ppu_render_log = NULL;
+        ppu_set_mirroring(ppu_nametable_mirroring);
+        ppu_oam_changed();
+    }
 }
@@ -6,11 +6,16 @@
 #define TINY_EMULATOR_PPU_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "resumable.h"
+#include "frame.h"
+#include "cartridge/mappers.h"
 
 
 struct ppu_registers
 {
-    struct ppu_ctrl  // NOTE: C bit-field order is compiler-defined but tend to be LSB-top; may need to replace with bit-masking
+    struct __attribute__((__packed__)) ppu_ctrl  // NOTE: C bit-field order is compiler-defined but tend to be LSB-top; may need to replace with bit-masking
     {
         /// Nametable select (base nametable address; 0 = 0x2000, 1 = 0x2400, 2 = 0x2800, 3 = 0x2C00)
         uint8_t nt_sel : 2;
@@ -28,7 +33,7 @@ struct ppu_registers
         uint8_t nmi : 1;
     } ppu_ctrl;
 
-    struct ppu_mask
+    struct __attribute__((__packed__)) ppu_mask
     {
         /// Greyscale (0 = normal, 1 = greyscale)
         uint8_t grey : 1;
@@ -48,7 +53,7 @@ struct ppu_registers
         uint8_t b : 1;
     } ppu_mask;
 
-    struct ppu_status
+    struct __attribute__((__packed__)) ppu_status
     {
         /// Open bus
         uint8_t _ : 5;
@@ -77,7 +82,68 @@ struct ppu_registers
 
 extern struct ppu_registers ppu_registers;
 
-extern uint8_t ppu_dot_array[242][283];
+/**
+ * Where ppu_cycle() is within the frame, plus the fetch state that has to survive from one dot to the next.
+ */
+struct ppu_context
+{
+    resume_point resume;
+    size_t scanline;
+    size_t dot;
+    uint8_t tile;                /// Tile fetch slot within the scanline (0-33)
+    uint8_t sprite;              /// Sprite fetch slot within the scanline (0-7)
+    uint8_t sprite_pattern_low;  /// Low bit plane fetched for the current sprite slot
+};
+
+extern struct ppu_context ppu_context;
+
+#define NUM_VISIBLE_SCANLINES 240
+#define NUM_SPRITES_PER_SCANLINE 8
+
+/**
+ * Frame output. The PPU draws palette indices into two frame buffers in turn, so the frame before is always at hand
+ * to diff against: ppu_dot_array points at the frame being drawn or, between frames, the one last drawn.
+ */
+extern uint8_t (*ppu_dot_array)[FRAME_WIDTH];
+
+/**
+ * Hash of each row of ppu_dot_array, valid once the row is drawn. Equal rows have equal hashes, so consumers that
+ * remember the hashes of what they hold can skip the rows that didn't change. An all-zero row hashes to 0.
+ */
+extern const uint64_t* ppu_row_hashes;
+
+/// Switches to the other frame buffer; called by whoever draws the frame before its first row
+void ppu_output_begin_frame();
+
+/// Called by whoever draws the frame once a row is complete, to compute its hash
+void ppu_output_row(size_t row);
+
+/// Number of frames completed since power-on. Incremented at the start of vertical blanking.
+extern uint64_t ppu_frame_count;
+
+/// Set by the PPU when a frame's visible picture is done; cleared by whoever consumes the frame.
+extern bool ppu_frame_complete;
+
+/**
+ * Frame skip setting: only every (ppu_frame_skip + 1)th frame is drawn into ppu_dot_array. Skipped frames still
+ * produce sprite 0 hit, sprite overflow, vblank timing and pattern fetches (A12), so game logic is unaffected.
+ */
+extern unsigned int ppu_frame_skip;
+
+/// Whether the current (or, during vblank, just completed) frame is being skipped.
+extern bool ppu_skip_rendering;
+
+/**
+ * Skips every frame from the next one on, whatever ppu_frame_skip is, for runs that only look at memory; false goes
+ * back to ppu_frame_skip. Not part of save states.
+ */
+void ppu_set_no_render(bool no_render);
+
+/// Called on each rising edge of PPU address line 12 during rendering fetches, for scanline-counting mappers.
+extern void (*ppu_on_a12_rise)();
+
+/// Called at the start of vertical blanking, before the frame is handed to the render thread in parallel mode.
+extern void (*ppu_on_vblank)();
 
 /**
  * PPU memory space
@@ -98,21 +164,45 @@ extern uint8_t* ppu_mem_map(uint16_t addr);
  */
 extern uint8_t* (*ppu_map_pattern_table_0)(uint16_t addr);
 extern uint8_t* (*ppu_map_pattern_table_1)(uint16_t addr);
-extern uint8_t* (*ppu_map_nametable_0)(uint16_t addr);
-extern uint8_t* (*ppu_map_nametable_1)(uint16_t addr);
-extern uint8_t* (*ppu_map_nametable_2)(uint16_t addr);
-extern uint8_t* (*ppu_map_nametable_3)(uint16_t addr);
-extern uint8_t* (*ppu_map_unused_space)(uint16_t addr);
 
-extern enum mirroring { MIRRORING_H = 0, MIRRORING_V = 1 } ppu_nametable_mirroring;
+// https://www.nesdev.org/wiki/Mirroring#Nametable_Mirroring
+extern enum mirroring
+{
+    MIRRORING_H = 0,            /// 0x2000 = 0x2400, 0x2800 = 0x2C00
+    MIRRORING_V = 1,            /// 0x2000 = 0x2800, 0x2400 = 0x2C00
+    MIRRORING_SINGLE_A = 2,     /// All four are the first 1kB of ppu_ram
+    MIRRORING_SINGLE_B = 3,     /// All four are the second 1kB of ppu_ram
+    MIRRORING_FOUR_SCREEN = 4,  /// ppu_ram plus ppu_cartridge_vram, no mirroring
+} ppu_nametable_mirroring;
 
 #define PPU_INTERNAL_RAM_SIZE 2048
 extern uint8_t ppu_ram[PPU_INTERNAL_RAM_SIZE];  // 2kB internal ppu ram
 
+/// The extra 2kB of VRAM on four-screen cartridges
+extern uint8_t ppu_cartridge_vram[PPU_INTERNAL_RAM_SIZE];
+
+#define PPU_NAMETABLE_SIZE 0x0400
+
+/**
+ * The 1kB of memory behind each of the four nametable slots (0x2000, 0x2400, 0x2800, 0x2C00), per the mirroring.
+ */
+extern uint8_t* ppu_nametables[4];
+
+/**
+ * Sets the nametable mirroring and points the nametable slots accordingly. Called by mappers on load and whenever
+ * they switch mirroring.
+ */
+void ppu_set_mirroring(enum mirroring mirroring);
+
+/**
+ * Points four nametable slots into the given internal and cartridge VRAM per a mirroring mode.
+ */
+void ppu_map_nametables(enum mirroring mirroring, uint8_t* ram, uint8_t* cartridge_vram, uint8_t* slots[4]);
+
 // https://www.nesdev.org/wiki/NTSC_video#Composite_decoding
 // https://www.nesdev.org/wiki/PPU_palettes
 #define PPU_PALETTE_RAM_SIZE 32
-extern uint8_t palette_ram[PPU_INTERNAL_RAM_SIZE];
+extern uint8_t ppu_palette_ram[PPU_PALETTE_RAM_SIZE];
 
 extern struct oam_entry
 {
@@ -122,6 +212,84 @@ extern struct oam_entry
     uint8_t sprite_x;
 } ppu_oam[64];
 
+/// Sprite attribute bits (byte 2 of an OAM entry)
+#define SPRITE_ATTR_PALETTE 0x03
+#define SPRITE_ATTR_PRIORITY 0x20
+#define SPRITE_ATTR_FLIP_H 0x40
+#define SPRITE_ATTR_FLIP_V 0x80
+
+/// A sprite output unit: one sprite's row as fetched for the scanline it is drawn on
+struct sprite_unit
+{
+    uint8_t x;
+    uint8_t attr;
+    uint8_t pattern_low;   /// Already flipped so that bit 7 is the leftmost pixel
+    uint8_t pattern_high;
+};
+
+/**
+ * Sprite pixel (0-3) of a sprite unit at the given pixel column.
+ */
+static inline uint8_t ppu_sprite_unit_pixel(const struct sprite_unit* unit, size_t x)
+{
+    size_t offset = x - unit->x;
+    if (offset >= 8)
+        return 0;
+    uint8_t bit = 7 - offset;
+    return (((unit->pattern_high >> bit) & 1) << 1) | ((unit->pattern_low >> bit) & 1);
+}
+
+/**
+ * The priority multiplexer: picks between the background and sprite pixel and gives the palette RAM entry to show.
+ * https://www.nesdev.org/wiki/PPU_rendering#Preface
+ */
+static inline uint8_t ppu_palette_index(uint8_t bg_pixel, uint8_t bg_palette, uint8_t sp_pixel, uint8_t sp_attr)
+{
+    if (sp_pixel != 0 && (bg_pixel == 0 || !(sp_attr & SPRITE_ATTR_PRIORITY)))
+        return 0x10 | ((sp_attr & SPRITE_ATTR_PALETTE) << 2) | sp_pixel;
+    if (bg_pixel != 0)
+        return (bg_palette << 2) | bg_pixel;
+    return 0;
+}
+
+/**
+ * CPU-side access to the PPU registers at 0x2000-0x2007, including their side effects.
+ *
+ * @param reg Register index (address & 0x7).
+ */
+uint8_t ppu_register_read(uint8_t reg);
+void ppu_register_write(uint8_t reg, uint8_t value);
+
+/**
+ * Copies 256 bytes into OAM starting at OAMADDR, as OAM DMA does.
+ */
+void ppu_oam_dma(const uint8_t* src);
+
+/**
+ * Accuracy option: emulate the hardware's buggy sprite overflow detection (false positives and negatives) instead of
+ * setting the flag exactly when more than 8 sprites share a scanline.
+ */
+extern bool ppu_sprite_overflow_bug;
+
+/**
+ * Call after modifying ppu_oam directly, so cached sprite evaluation results are rebuilt.
+ */
+void ppu_oam_changed();
+
+/**
+ * Advances the PPU one dot, reaching the cartridge through the mapping functions above. Every mapper in NES_MAPPERS
+ * has its own copy, ppu_cycle_<name>(), which calls its hooks directly instead and otherwise behaves the same. The
+ * resume point in ppu_context belongs to the copy that set it, so one core must be used for a cartridge throughout.
+ */
 void ppu_cycle();
 
+#define PPU_DECLARE_CYCLE(name, number) void ppu_cycle_##name();
+NES_MAPPERS(PPU_DECLARE_CYCLE)
+#undef PPU_DECLARE_CYCLE
+
+struct state;
+
+/// Measures, saves or loads this module's part of a save state (see state.h)
+void ppu_state(struct state* state);
+
 #endif //TINY_EMULATOR_PPU_H
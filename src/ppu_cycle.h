@@ -0,0 +1,243 @@
+//
+// Created by quate on 10/19/2026.
+//
+// The PPU cycle function, as a template: ppu.c includes this once per emulation core (see cartridge/mappers.h), after
+// defining either
+//   PPU_MAPPER          the mapper's name in NES_MAPPERS, which the three below are derived from
+// or
+//   PPU_CYCLE_NAME      the function's name
+//   PPU_PATTERN(addr)   pointer to the pattern table byte at addr, below 0x2000
+//   PPU_A12_RISE()      what the cartridge does when A12 rises
+// It uses the static helpers of ppu.c and undefines the parameters at the end, so it has no include guard.
+//
+
+#define PPU_CONCAT_(a, b) a##b
+#define PPU_CONCAT(a, b) PPU_CONCAT_(a, b)
+
+#ifdef PPU_MAPPER
+#define PPU_CYCLE_NAME PPU_CONCAT(ppu_cycle_, PPU_MAPPER)
+#define PPU_PATTERN(addr) PPU_CONCAT(PPU_MAPPER, _ppu_pattern)(addr)
+#define PPU_A12_RISE() PPU_CONCAT(PPU_MAPPER, _ppu_a12_rise)()
+
+/// Marks this mapper's core as compiled, for the check in ppu.c
+enum { PPU_CONCAT(ppu_cycle_core_, PPU_MAPPER) = 1 };
+#endif
+
+/// Pattern table fetch for rendering: the mapper sees A12 even when the data itself isn't needed
+#define PPU_TRACK_A12() do { \
+    bool a12 = (ppu_addr_bus & 0x1000) != 0; \
+    if (a12 && !ppu_a12) \
+        PPU_A12_RISE(); \
+    ppu_a12 = a12; \
+} while (0)
+
+/// A CPU access to PPUDATA can leave its address on the bus in the middle of a fetch, so that may be outside the
+/// pattern tables
+#define PPU_FETCH_PATTERN() do { \
+    ppu_data_bus = *(ppu_addr_bus < 0x2000 ? PPU_PATTERN(ppu_addr_bus) : ppu_mem_map(ppu_addr_bus)); \
+} while (0)
+
+#define PPU_READ_PATTERN() do { \
+    PPU_TRACK_A12(); \
+    PPU_FETCH_PATTERN(); \
+} while (0)
+
+
+void PPU_CYCLE_NAME()
+{
+    struct ppu_context* ctx = &ppu_context;
+    BEGIN_RESUMABLE(ctx->resume)
+    while (1) {
+        for (ctx->scanline = 0; ctx->scanline < NUM_SCANLINES; ++ctx->scanline)
+        {
+            if (ctx->scanline >= NUM_VISIBLE_SCANLINES && ctx->scanline < PRERENDER_SCANLINE)
+            {
+                // Post-render (240) and vertical blanking scanlines; PPU idles
+                END_CYCLE
+
+                if (ctx->scanline == VBLANK_SCANLINE)
+                {
+                    // Dot 1 of line 241: the visible picture is done
+                    ppu_registers.ppu_status.v = 1;
+                    if (ppu_registers.ppu_ctrl.nmi)
+                        cpu_nmi();
+                    ppu_frame_count++;
+                    ppu_frame_complete = true;
+                    if (ppu_on_vblank != NULL)
+                        ppu_on_vblank();
+                    if (ppu_render_log != NULL)
+                        ppu_render_end_frame(ppu_frame_count);
+                }
+
+                for (ctx->dot = 1; ctx->dot < NUM_DOTS_PER_SCANLINE; ++ctx->dot)
+                {
+                    END_CYCLE
+                }
+                continue;
+            }
+
+            // Visible scanlines and pre-render scanline (261)
+            pixel_x = 0;
+            sprite_unit_count = secondary_oam_count;
+            sprite_zero_on_line = sprite_zero_next;
+            if (ppu_render_log != NULL && ctx->scanline < NUM_VISIBLE_SCANLINES)
+                ppu_render_sprites(ctx->scanline, sprite_units, sprite_unit_count);
+            END_CYCLE
+
+            if (ctx->scanline == PRERENDER_SCANLINE)
+            {
+                ppu_registers.ppu_status.v = 0;
+                ppu_registers.ppu_status.s = 0;
+                ppu_registers.ppu_status.o = 0;
+                secondary_oam_count = 0;
+                sprite_zero_next = false;
+                // Decide once per frame whether its pixels are produced
+                ppu_skip_rendering = ppu_no_render ||
+                                     (ppu_frame_skip != 0 && (ppu_frame_count + 1) % (ppu_frame_skip + 1) != 0);
+                if (ppu_render_parallel && !ppu_skip_rendering)
+                    ppu_render_begin_frame(ppu_x);
+                if (ppu_drawing())
+                    ppu_output_begin_frame();
+            }
+
+            // Tiles 0-31 for this scanline (dots 1-256), then tiles 0-1 of the next scanline (dots 321-336)
+            for (ctx->tile = 0; ctx->tile < NUM_TILES_PER_SCANLINE + 2; ++ctx->tile)
+            {
+                if (ctx->tile == NUM_TILES_PER_SCANLINE)
+                {
+                    if (ctx->scanline < NUM_VISIBLE_SCANLINES && ppu_drawing())
+                        ppu_output_row(ctx->scanline);
+
+                    // Dots 257-320: sprite fetches for the next scanline
+                    if (ppu_rendering_enabled())
+                    {
+                        ppu_copy_horizontal();
+                        if (ctx->scanline < NUM_VISIBLE_SCANLINES)
+                            ppu_evaluate_sprites(ctx->scanline);
+                    }
+
+                    for (ctx->sprite = 0; ctx->sprite < NUM_SPRITES_PER_SCANLINE; ++ctx->sprite)
+                    {
+                        // Garbage nametable fetches
+                        if (ctx->scanline == PRERENDER_SCANLINE && ctx->sprite == 3 && ppu_rendering_enabled())
+                            ppu_copy_vertical();  // dots 280-304
+                        END_CYCLE
+                        END_CYCLE
+                        // Garbage attribute fetches
+                        END_CYCLE
+                        END_CYCLE
+
+                        ppu_addr_bus = ppu_sprite_pattern_addr(ctx->sprite, ctx->scanline);
+                        END_CYCLE
+                        if (ppu_rendering_enabled())
+                        {
+                            PPU_READ_PATTERN();
+                            ctx->sprite_pattern_low = ppu_data_bus;
+                        }
+                        END_CYCLE
+
+                        ppu_addr_bus += 8;
+                        END_CYCLE
+                        if (ppu_rendering_enabled())
+                        {
+                            PPU_READ_PATTERN();
+                            ppu_load_sprite_unit(ctx->sprite, ctx->sprite_pattern_low, ppu_data_bus);
+                        }
+                        END_CYCLE
+                    }
+
+                    // Dot 321: the first two tiles of the next scanline are fetched from here on
+                    if (ppu_render_log != NULL && (ctx->scanline == PRERENDER_SCANLINE || ctx->scanline < NUM_VISIBLE_SCANLINES - 1))
+                        ppu_render_prefetch(ctx->scanline == PRERENDER_SCANLINE ? 0 : ctx->scanline + 1, ppu_v);
+                }
+
+                if (ctx->tile != 0 && ppu_rendering_enabled() && ppu_background_pipeline())
+                    ppu_load_background_shifters();
+
+                // Nametable byte
+                ppu_addr_bus = ppu_nametable_addr();
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+                if (ppu_rendering_enabled() && ppu_background_pipeline())
+                {
+                    ppu_read_nametable();
+                    curr_tile_id = ppu_data_bus;
+                }
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+
+                // Attribute byte
+                ppu_addr_bus = ppu_attribute_addr();
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+                if (ppu_rendering_enabled() && ppu_background_pipeline())
+                {
+                    ppu_read_nametable();
+                    // Select the quadrant of the 32x32 pixel attribute area this tile is in
+                    curr_tile_attr = ppu_data_bus >> (((ppu_v >> 4) & 0x04) | (ppu_v & 0x02));
+                }
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+
+                // Pattern low bit plane
+                ppu_addr_bus = ppu_background_pattern_addr();
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+                if (ppu_rendering_enabled())
+                {
+                    PPU_TRACK_A12();
+                    if (ppu_background_pipeline())
+                    {
+                        PPU_FETCH_PATTERN();
+                        curr_pattern_low = ppu_data_bus;
+                    }
+                }
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+
+                // Pattern high bit plane
+                ppu_addr_bus = ppu_background_pattern_addr() + 8;
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+                if (ppu_rendering_enabled())
+                {
+                    PPU_TRACK_A12();
+                    if (ppu_background_pipeline())
+                    {
+                        PPU_FETCH_PATTERN();
+                        curr_pattern_high = ppu_data_bus;
+                    }
+                    ppu_increment_coarse_x();
+                    if (ctx->tile == NUM_TILES_PER_SCANLINE - 1)
+                        ppu_increment_y();  // dot 256
+                }
+                ppu_background_dot(ctx->scanline);
+                END_CYCLE
+            }
+
+            // Unused nametable fetches (dots 337-340)
+            if (ppu_rendering_enabled() && ppu_background_pipeline())
+                ppu_load_background_shifters();
+            END_CYCLE
+            END_CYCLE
+            END_CYCLE
+            // Odd frames skip the last dot of the pre-render scanline while rendering
+            if (ctx->scanline != PRERENDER_SCANLINE || !(ppu_frame_count & 1) || !ppu_rendering_enabled())
+            {
+                END_CYCLE
+            }
+        }
+    }
+    END_RESUMABLE
+}
+
+
+#undef PPU_READ_PATTERN
+#undef PPU_FETCH_PATTERN
+#undef PPU_TRACK_A12
+#undef PPU_A12_RISE
+#undef PPU_PATTERN
+#undef PPU_CYCLE_NAME
+#undef PPU_MAPPER
+#undef PPU_CONCAT
+#undef PPU_CONCAT_
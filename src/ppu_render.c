@@ -0,0 +1,433 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "ppu_render.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "exit_codes.h"
+#include "frame.h"
+#include "telemetry.h"
+
+
+bool ppu_render_parallel = false;
+struct ppu_render_log* ppu_render_log = NULL;
+void (*ppu_render_on_frame)(uint64_t frame_number) = NULL;
+
+/// One log being drawn while the other is being recorded
+static struct ppu_render_log logs[2];
+static size_t next_log = 0;
+
+static pthread_t render_thread;
+static pthread_mutex_t render_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t render_cond = PTHREAD_COND_INITIALIZER;
+static struct ppu_render_log* render_pending = NULL;  /// Handed off but not picked up yet
+static bool render_busy = false;                       /// A handed-off frame isn't done yet
+static bool render_quit = false;
+
+
+/**
+ * Logging side
+ */
+
+void ppu_render_begin_frame(uint8_t fine_x)
+{
+    struct ppu_render_log* log = &logs[next_log];
+    log->ctrl = ppu_registers.ppu_ctrl;
+    log->mask = ppu_registers.ppu_mask;
+    log->fine_x = fine_x;
+    log->mirroring = ppu_nametable_mirroring;
+    memcpy(log->ram, ppu_ram, sizeof(log->ram));
+    memcpy(log->cartridge_vram, ppu_cartridge_vram, sizeof(log->cartridge_vram));
+    memcpy(log->palette, ppu_palette_ram, sizeof(log->palette));
+    for (size_t bank = 0; bank < 8; ++bank)
+    {
+        log->chr_banks[bank] = ppu_mem_map(bank << 10);
+        memcpy(log->chr[bank], log->chr_banks[bank], sizeof(log->chr[bank]));
+    }
+    log->event_count = 0;
+    ppu_render_log = log;
+}
+
+void ppu_render_prefetch(size_t line, uint16_t v)
+{
+    struct ppu_render_line* out = &ppu_render_log->lines[line];
+    out->v = v;
+    for (size_t bank = 0; bank < 8; ++bank)
+    {
+        out->chr[bank] = ppu_mem_map(bank << 10);
+    }
+}
+
+void ppu_render_sprites(size_t line, const struct sprite_unit* units, uint8_t count)
+{
+    struct ppu_render_line* out = &ppu_render_log->lines[line];
+    out->sprite_count = count;
+    memcpy(out->sprites, units, count * sizeof(struct sprite_unit));
+}
+
+void ppu_render_event(uint32_t time, enum ppu_render_event_kind kind, uint16_t addr, uint8_t value)
+{
+    struct ppu_render_log* log = ppu_render_log;
+    if (log->event_count == PPU_RENDER_MAX_EVENTS)
+        return;  // see PPU_RENDER_MAX_EVENTS
+    log->events[log->event_count++] = (struct ppu_render_event) {
+        .time = time, .kind = kind, .value = value, .addr = addr
+    };
+}
+
+void ppu_render_end_frame(uint64_t frame_number)
+{
+    struct ppu_render_log* log = ppu_render_log;
+    ppu_render_log = NULL;
+    log->frame_number = frame_number;
+
+    pthread_mutex_lock(&render_mutex);
+    if (render_busy)
+    {
+        uint64_t begin_ns = telemetry_begin();
+        while (render_busy)
+            pthread_cond_wait(&render_cond, &render_mutex);
+        telemetry_end(TELEMETRY_WAIT_RENDER, begin_ns, frame_number);
+    }
+    render_pending = log;
+    render_busy = true;
+    pthread_cond_broadcast(&render_cond);
+    pthread_mutex_unlock(&render_mutex);
+
+    next_log ^= 1;
+}
+
+
+/**
+ * Render thread. Replays the background pipeline of ppu_cycle() for dots 1-256 of each visible scanline on its own
+ * copy of the state, applying the logged writes at the pixel they came before.
+ */
+static struct
+{
+    struct ppu_ctrl ctrl;
+    struct ppu_mask mask;
+    uint8_t fine_x;
+    uint16_t v;
+    uint16_t addr_bus;
+
+    uint8_t ram[PPU_INTERNAL_RAM_SIZE];
+    uint8_t cartridge_vram[PPU_INTERNAL_RAM_SIZE];
+    uint8_t* nametables[4];
+    uint8_t palette[PPU_PALETTE_RAM_SIZE];
+    uint8_t chr[8][0x0400];
+    /// Pattern banks of the scanline being drawn: the copy, unless a bank was switched in since the frame started
+    const uint8_t* banks[8];
+
+    uint8_t tile_id;
+    uint8_t tile_attr;
+    uint8_t pattern_low;
+    uint8_t pattern_high;
+    uint16_t pattern_shift_low;
+    uint16_t pattern_shift_high;
+    uint16_t attr_shift_low;
+    uint16_t attr_shift_high;
+
+    size_t next_event;
+} render;
+
+static bool render_enabled()
+{
+    return render.mask.bg || render.mask.sp;
+}
+
+/// The render thread's copy of the byte at a PPU address, mapped like ppu_mem_map()
+static uint8_t* render_mem_map(uint16_t addr)
+{
+    if (addr < 0x2000)
+        return &render.chr[addr >> 10][addr & 0x03FF];
+    if (addr < 0x3F00)
+        return &render.nametables[(addr >> 10) & 0x03][addr & 0x03FF];
+    if ((addr & 0x0013) == 0x0010)
+        return &render.palette[addr & 0x000F];
+    return &render.palette[addr & 0x001F];
+}
+
+static void render_apply_events(const struct ppu_render_log* log, uint32_t until)
+{
+    while (render.next_event < log->event_count && log->events[render.next_event].time <= until)
+    {
+        const struct ppu_render_event* event = &log->events[render.next_event++];
+        switch (event->kind)
+        {
+            case PPU_RENDER_CTRL:
+                memcpy(&render.ctrl, &event->value, 1);
+                break;
+            case PPU_RENDER_MASK:
+                memcpy(&render.mask, &event->value, 1);
+                break;
+            case PPU_RENDER_FINE_X:
+                render.fine_x = event->value;
+                break;
+            case PPU_RENDER_V:
+                render.v = event->addr;
+                break;
+            case PPU_RENDER_WRITE:
+                *render_mem_map(event->addr) = event->value;
+                // fallthrough
+            case PPU_RENDER_READ:
+                render.addr_bus = event->addr;
+                render.v += render.ctrl.i ? 32 : 1;
+                break;
+            case PPU_RENDER_MIRRORING:
+                ppu_map_nametables(event->value, render.ram, render.cartridge_vram, render.nametables);
+                break;
+            default:
+                exit(ERROR_CODE__OH_NO);
+        }
+    }
+}
+
+static uint8_t render_nametable_read(uint16_t addr)
+{
+    return render.nametables[(addr >> 10) & 0x03][addr & 0x03FF];
+}
+
+static uint8_t render_pattern_read(uint16_t addr)
+{
+    // Only a PPUDATA access between the address and read dots puts anything but a pattern address on the bus
+    if (addr >= 0x2000)
+        return *render_mem_map(addr);
+    return render.banks[addr >> 10][addr & 0x03FF];
+}
+
+static uint16_t render_pattern_addr()
+{
+    return (render.ctrl.bg_sel << 12) | (render.tile_id << 4) | (render.v >> 12);
+}
+
+static void render_increment_coarse_x()
+{
+    if ((render.v & 0x001F) == 31)
+    {
+        render.v &= ~0x001F;
+        render.v ^= 0x0400;
+    }
+    else
+    {
+        render.v++;
+    }
+}
+
+static void render_load_shifters()
+{
+    render.pattern_shift_low = (render.pattern_shift_low & 0xFF00) | render.pattern_low;
+    render.pattern_shift_high = (render.pattern_shift_high & 0xFF00) | render.pattern_high;
+    render.attr_shift_low = (render.attr_shift_low & 0xFF00) | (render.tile_attr & 0b01 ? 0xFF : 0x00);
+    render.attr_shift_high = (render.attr_shift_high & 0xFF00) | (render.tile_attr & 0b10 ? 0xFF : 0x00);
+}
+
+static void render_shift()
+{
+    render.pattern_shift_low <<= 1;
+    render.pattern_shift_high <<= 1;
+    render.attr_shift_low <<= 1;
+    render.attr_shift_high <<= 1;
+}
+
+static void render_pixel(const struct ppu_render_line* line, size_t scanline, size_t x)
+{
+    uint8_t bg_pixel = 0;
+    uint8_t bg_palette = 0;
+    if (render.mask.bg && (x >= 8 || render.mask.bg_left))
+    {
+        uint16_t mux = 0x8000 >> render.fine_x;
+        bg_palette = ((render.attr_shift_high & mux) ? 2 : 0) | ((render.attr_shift_low & mux) ? 1 : 0);
+        bg_pixel = ((render.pattern_shift_high & mux) ? 2 : 0) | ((render.pattern_shift_low & mux) ? 1 : 0);
+    }
+
+    uint8_t sp_pixel = 0;
+    uint8_t sp_attr = 0;
+    if (render.mask.sp && (x >= 8 || render.mask.sp_left))
+    {
+        for (uint8_t i = 0; i < line->sprite_count; ++i)
+        {
+            sp_pixel = ppu_sprite_unit_pixel(&line->sprites[i], x);
+            if (sp_pixel != 0)
+            {
+                sp_attr = line->sprites[i].attr;
+                break;
+            }
+        }
+    }
+
+    // Never one of the mirrored backdrop entries: those would need a sprite pixel of 0
+    uint8_t color = render.palette[ppu_palette_index(bg_pixel, bg_palette, sp_pixel, sp_attr)];
+    ppu_dot_array[scanline][x] = color & (render.mask.grey ? 0x30 : 0x3F);
+}
+
+/**
+ * One dot of background fetches, as in ppu_cycle(): an address is put on the bus on one dot and read on the next,
+ * where the reads, loads and increments only happen while rendering is enabled.
+ *
+ * @param step Dot within the 8-dot tile slot.
+ * @param load Whether the slot starts by loading the previous tile into the shifters.
+ */
+static void render_fetch(size_t step, bool load, bool enabled)
+{
+    switch (step & 0x07)
+    {
+        case 0:
+            if (load && enabled)
+                render_load_shifters();
+            render.addr_bus = 0x2000 | (render.v & 0x0FFF);
+            break;
+        case 1:
+            if (enabled)
+                render.tile_id = render_nametable_read(render.addr_bus);
+            break;
+        case 2:
+            render.addr_bus = 0x23C0 | (render.v & 0x0C00) | ((render.v >> 4) & 0x38) | ((render.v >> 2) & 0x07);
+            break;
+        case 3:
+            if (enabled)
+                render.tile_attr = render_nametable_read(render.addr_bus) >> (((render.v >> 4) & 0x04) | (render.v & 0x02));
+            break;
+        case 4:
+            render.addr_bus = render_pattern_addr();
+            break;
+        case 5:
+            if (enabled)
+                render.pattern_low = render_pattern_read(render.addr_bus);
+            break;
+        case 6:
+            render.addr_bus = render_pattern_addr() + 8;
+            break;
+        case 7:
+            if (enabled)
+            {
+                render.pattern_high = render_pattern_read(render.addr_bus);
+                render_increment_coarse_x();
+            }
+            break;
+    }
+}
+
+static void render_line(const struct ppu_render_log* log, size_t scanline)
+{
+    const struct ppu_render_line* line = &log->lines[scanline];
+
+    render_apply_events(log, PPU_RENDER_TIME(scanline, 256));
+    render.v = line->v;
+    for (size_t bank = 0; bank < 8; ++bank)
+    {
+        render.banks[bank] = line->chr[bank] == log->chr_banks[bank] ? render.chr[bank] : line->chr[bank];
+    }
+
+    // Dots 321-336 of the scanline before fetch its first two tiles, and dot 337 loads the second
+    for (size_t x = 256; x < 272; ++x)
+    {
+        render_apply_events(log, PPU_RENDER_TIME(scanline, x));
+        bool enabled = render_enabled();
+        render_fetch(x, true, enabled);
+        if (enabled)
+            render_shift();
+    }
+    render_apply_events(log, PPU_RENDER_TIME(scanline, 272));
+    if (render_enabled())
+        render_load_shifters();
+
+    // Dots 1-256
+    for (size_t x = 0; x < FRAME_WIDTH; ++x)
+    {
+        render_apply_events(log, PPU_RENDER_TIME(scanline + 1, x));
+        bool enabled = render_enabled();
+        render_fetch(x, x != 0, enabled);
+        render_pixel(line, scanline, x);
+        if (enabled)
+            render_shift();
+    }
+}
+
+static void render_frame(const struct ppu_render_log* log)
+{
+    render.ctrl = log->ctrl;
+    render.mask = log->mask;
+    render.fine_x = log->fine_x;
+    memcpy(render.ram, log->ram, sizeof(render.ram));
+    memcpy(render.cartridge_vram, log->cartridge_vram, sizeof(render.cartridge_vram));
+    memcpy(render.palette, log->palette, sizeof(render.palette));
+    memcpy(render.chr, log->chr, sizeof(render.chr));
+    ppu_map_nametables(log->mirroring, render.ram, render.cartridge_vram, render.nametables);
+    render.next_event = 0;
+
+    ppu_output_begin_frame();
+    for (size_t scanline = 0; scanline < NUM_VISIBLE_SCANLINES; ++scanline)
+    {
+        render_line(log, scanline);
+        ppu_output_row(scanline);
+    }
+}
+
+static void* render_thread_main(void* arg)
+{
+    (void) arg;
+    telemetry_name_thread("render");
+    pthread_mutex_lock(&render_mutex);
+    while (1)
+    {
+        uint64_t begin_ns = telemetry_begin();
+        while (render_pending == NULL && !render_quit)
+            pthread_cond_wait(&render_cond, &render_mutex);
+        telemetry_end(TELEMETRY_WAIT_WORK, begin_ns, render_pending != NULL ? render_pending->frame_number : 0);
+        if (render_pending == NULL)
+            break;  // quitting, and everything handed off is drawn
+        struct ppu_render_log* log = render_pending;
+        render_pending = NULL;
+        pthread_mutex_unlock(&render_mutex);
+
+        begin_ns = telemetry_begin();
+        render_frame(log);
+        telemetry_end(TELEMETRY_RENDER, begin_ns, log->frame_number);
+        if (ppu_render_on_frame != NULL)
+            ppu_render_on_frame(log->frame_number);
+
+        pthread_mutex_lock(&render_mutex);
+        render_busy = false;
+        pthread_cond_broadcast(&render_cond);
+    }
+    pthread_mutex_unlock(&render_mutex);
+    return NULL;
+}
+
+
+void ppu_render_start()
+{
+    render_quit = false;
+    if (pthread_create(&render_thread, NULL, render_thread_main, NULL) != 0)
+    {
+        fprintf(stderr, "Could not start render thread");
+        exit(ERROR_CODE__OH_NO);
+    }
+    ppu_render_parallel = true;
+}
+
+
+void ppu_render_stop()
+{
+    if (!ppu_render_parallel)
+        return;
+    pthread_mutex_lock(&render_mutex);
+    render_quit = true;
+    pthread_cond_broadcast(&render_cond);
+    pthread_mutex_unlock(&render_mutex);
+    pthread_join(render_thread, NULL);
+    ppu_render_parallel = false;
+    ppu_render_log = NULL;
+}
+
+
+void ppu_render_flush()
+{
+    pthread_mutex_lock(&render_mutex);
+    while (render_busy)
+        pthread_cond_wait(&render_cond, &render_mutex);
+    pthread_mutex_unlock(&render_mutex);
+}
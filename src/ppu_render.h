@@ -0,0 +1,128 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Parallel PPU rendering. In this mode ppu_cycle() draws nothing itself. For each frame it records what the picture
+// depends on: a snapshot of VRAM, palette and registers at the start of the frame, the scroll position, pattern banks
+// and sprites of every scanline, and each CPU write that changes rendering mid-frame, stamped with the pixel it
+// landed before. At vblank the log goes to a render thread, which replays the background pipeline from it and draws
+// frame N into ppu_dot_array while the emulation thread goes on with frame N+1.
+//
+// The emulation thread keeps everything the CPU can observe: timing, VRAM address updates, sprite evaluation and
+// fetches (overflow, A12), and the background pipeline on the scanlines around sprite 0, for the sprite 0 hit.
+//
+
+#ifndef NES_EMULATOR_PPU_RENDER_H
+#define NES_EMULATOR_PPU_RENDER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "ppu.h"
+
+/// Logged events per frame. A CPU cycle logs at most one, so a frame of them always fits.
+#define PPU_RENDER_MAX_EVENTS 32768
+
+/**
+ * Event timestamp. Line is 0 for the pre-render scanline and n + 1 for visible scanline n; pixel is the pixel column
+ * the write came before (256 and up: after the visible part of the scanline).
+ */
+#define PPU_RENDER_TIME(line, pixel) ((uint32_t) (line) << 9 | (uint32_t) (pixel))
+
+enum ppu_render_event_kind
+{
+    PPU_RENDER_CTRL,       /// PPUCTRL write (value)
+    PPU_RENDER_MASK,       /// PPUMASK write (value)
+    PPU_RENDER_FINE_X,     /// Fine x scroll changed (value)
+    PPU_RENDER_V,          /// PPUADDR set the VRAM address (addr)
+    PPU_RENDER_READ,       /// PPUDATA read (addr); takes over the address bus and increments the VRAM address
+    PPU_RENDER_WRITE,      /// PPUDATA write (addr, value); same, and stores the value
+    PPU_RENDER_MIRRORING,  /// Mapper switched mirroring (value)
+};
+
+struct ppu_render_event
+{
+    uint32_t time;  /// See PPU_RENDER_TIME
+    uint8_t kind;
+    uint8_t value;
+    uint16_t addr;
+};
+
+/// What the render thread needs about one visible scanline
+struct ppu_render_line
+{
+    /// VRAM address when its first two tiles started being fetched (dot 321 of the scanline before)
+    uint16_t v;
+    /// The eight 1kB pattern table banks mapped at that point
+    const uint8_t* chr[8];
+    uint8_t sprite_count;
+    struct sprite_unit sprites[NUM_SPRITES_PER_SCANLINE];
+};
+
+struct ppu_render_log
+{
+    uint64_t frame_number;
+
+    /// State at dot 1 of the pre-render scanline
+    struct ppu_ctrl ctrl;
+    struct ppu_mask mask;
+    uint8_t fine_x;
+    enum mirroring mirroring;
+    uint8_t ram[PPU_INTERNAL_RAM_SIZE];
+    uint8_t cartridge_vram[PPU_INTERNAL_RAM_SIZE];
+    uint8_t palette[PPU_PALETTE_RAM_SIZE];
+    /// Pattern table banks mapped, and a copy of them, since CHR RAM may be rewritten while this frame is drawn
+    const uint8_t* chr_banks[8];
+    uint8_t chr[8][0x0400];
+
+    struct ppu_render_line lines[NUM_VISIBLE_SCANLINES];
+
+    size_t event_count;
+    struct ppu_render_event events[PPU_RENDER_MAX_EVENTS];
+};
+
+/// Whether frames are drawn by the render thread. Set by ppu_render_start() and cleared by ppu_render_stop().
+extern bool ppu_render_parallel;
+
+/// The log of the frame being emulated, or NULL if this frame isn't logged (not in parallel mode, or skipped).
+extern struct ppu_render_log* ppu_render_log;
+
+/**
+ * Called on the render thread when a frame is done; its pixels and row hashes are in ppu_dot_array and ppu_row_hashes
+ * until this returns. Must be set before ppu_render_start().
+ */
+extern void (*ppu_render_on_frame)(uint64_t frame_number);
+
+/**
+ * Starts the render thread. Frames from the next pre-render scanline on are drawn by it. Must not be called while
+ * another thread is running the PPU.
+ */
+void ppu_render_start();
+
+/**
+ * Renders the frames already handed off, then stops the render thread. A frame in progress is not drawn.
+ */
+void ppu_render_stop();
+
+/**
+ * Waits until every frame handed off so far has been drawn and passed to ppu_render_on_frame.
+ */
+void ppu_render_flush();
+
+/**
+ * Logging side, called by the PPU.
+ */
+
+/// Starts logging a frame, snapshotting the state it starts from
+void ppu_render_begin_frame(uint8_t fine_x);
+
+/// Scroll position and pattern banks for the first tiles of visible scanline `line`
+void ppu_render_prefetch(size_t line, uint16_t v);
+
+/// Sprites fetched for visible scanline `line`
+void ppu_render_sprites(size_t line, const struct sprite_unit* units, uint8_t count);
+
+void ppu_render_event(uint32_t time, enum ppu_render_event_kind kind, uint16_t addr, uint8_t value);
+
+/// Hands the logged frame to the render thread, waiting for it to finish the frame before if it hasn't yet
+void ppu_render_end_frame(uint64_t frame_number);
+
+#endif //NES_EMULATOR_PPU_RENDER_H
@@ -0,0 +1,51 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Resumable function macros shared by the CPU and PPU cycle functions.
+//
+// A resumable function runs until END_CYCLE, returns, and on the next call continues right after that END_CYCLE.
+// Where it left off is kept in a resume_point owned by the caller's context struct.
+//
+// With GCC/Clang the resume point is a label address and resuming is a single indirect jump (labels as values).
+// Elsewhere, or with RESUMABLE_USE_SWITCH defined, it is the __LINE__ of the END_CYCLE and resuming goes through a
+// switch over all of them.
+//
+// Locals that must survive across END_CYCLE have to live in the context (or be static); the function is re-entered
+// from the top on every call.
+//
+
+#ifndef NES_EMULATOR_RESUMABLE_H
+#define NES_EMULATOR_RESUMABLE_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(RESUMABLE_USE_SWITCH)
+#define RESUMABLE_COMPUTED_GOTO
+#endif
+
+#define RESUMABLE_CONCAT_(a, b) a##b
+#define RESUMABLE_CONCAT(a, b) RESUMABLE_CONCAT_(a, b)
+#define RESUMABLE_LABEL RESUMABLE_CONCAT(resume_at_, __LINE__)
+
+#ifdef RESUMABLE_COMPUTED_GOTO
+
+typedef void* resume_point;
+#define RESUME_POINT_START NULL
+
+#define BEGIN_RESUMABLE(resume) { resume_point* resume_location = &(resume); if (*resume_location != NULL) goto **resume_location;
+#define END_CYCLE *resume_location = &&RESUMABLE_LABEL; return; RESUMABLE_LABEL:;
+#define END_RESUMABLE exit(-1); }
+
+#else
+
+typedef size_t resume_point;
+#define RESUME_POINT_START 0
+
+#define BEGIN_RESUMABLE(resume) { resume_point* resume_location = &(resume); switch (*resume_location) { case RESUME_POINT_START:;
+#define END_CYCLE *resume_location = __LINE__; return; case __LINE__:;
+#define END_RESUMABLE default: exit(-1); } }
+
+#endif
+
+#endif //NES_EMULATOR_RESUMABLE_H
@@ -0,0 +1,613 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "rom_scan.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "load.h"
+#include "utils.h"
+#include "exit_codes.h"
+
+
+/**
+ * SHA-1 (FIPS 180-4). Only used to fingerprint ROMs for databases, where it is still the usual key.
+ */
+struct sha1
+{
+    uint32_t h[5];
+    uint8_t block[64];
+    size_t block_size;
+    uint64_t total_size;
+};
+
+static uint32_t rotl32(uint32_t x, int n)
+{
+    return x << n | x >> (32 - n);
+}
+
+static void sha1_block(struct sha1* sha1, const uint8_t* block)
+{
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i)
+    {
+        w[i] = (uint32_t) block[4 * i] << 24 | (uint32_t) block[4 * i + 1] << 16 | (uint32_t) block[4 * i + 2] << 8 |
+               block[4 * i + 3];
+    }
+    for (int i = 16; i < 80; ++i)
+    {
+        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = sha1->h[0], b = sha1->h[1], c = sha1->h[2], d = sha1->h[3], e = sha1->h[4];
+    for (int i = 0; i < 80; ++i)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5A827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ED9EBA1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8F1BBCDC;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xCA62C1D6;
+        }
+        uint32_t t = rotl32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl32(b, 30);
+        b = a;
+        a = t;
+    }
+    sha1->h[0] += a;
+    sha1->h[1] += b;
+    sha1->h[2] += c;
+    sha1->h[3] += d;
+    sha1->h[4] += e;
+}
+
+static void sha1_init(struct sha1* sha1)
+{
+    *sha1 = (struct sha1) { .h = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 } };
+}
+
+static void sha1_update(struct sha1* sha1, const uint8_t* data, size_t size)
+{
+    sha1->total_size += size;
+    if (sha1->block_size != 0)
+    {
+        size_t take = 64 - sha1->block_size < size ? 64 - sha1->block_size : size;
+        memcpy(sha1->block + sha1->block_size, data, take);
+        sha1->block_size += take;
+        data += take;
+        size -= take;
+        if (sha1->block_size < 64)
+            return;
+        sha1_block(sha1, sha1->block);
+        sha1->block_size = 0;
+    }
+    for (; size >= 64; data += 64, size -= 64)
+    {
+        sha1_block(sha1, data);
+    }
+    memcpy(sha1->block, data, size);
+    sha1->block_size = size;
+}
+
+static void sha1_final(struct sha1* sha1, uint8_t digest[ROM_SHA1_SIZE])
+{
+    uint64_t bits = sha1->total_size * 8;
+    uint8_t padding[72] = { 0x80 };
+    size_t padding_size = (sha1->block_size < 56 ? 56 : 120) - sha1->block_size;
+    for (int i = 0; i < 8; ++i)
+    {
+        padding[padding_size + i] = (uint8_t) (bits >> (56 - 8 * i));
+    }
+    sha1_update(sha1, padding, padding_size + 8);
+    for (int i = 0; i < 5; ++i)
+    {
+        digest[4 * i] = (uint8_t) (sha1->h[i] >> 24);
+        digest[4 * i + 1] = (uint8_t) (sha1->h[i] >> 16);
+        digest[4 * i + 2] = (uint8_t) (sha1->h[i] >> 8);
+        digest[4 * i + 3] = (uint8_t) sha1->h[i];
+    }
+}
+
+
+static int compare_roms(const void* a, const void* b)
+{
+    return strcmp(((const struct rom_info*) a)->path, ((const struct rom_info*) b)->path);
+}
+
+void rom_index_free(struct rom_index* index)
+{
+    for (size_t i = 0; i < index->count; ++i)
+    {
+        free(index->roms[i].path);
+    }
+    free(index->roms);
+    index->roms = NULL;
+    index->count = 0;
+}
+
+bool rom_index_load(struct rom_index* index, const char* path)
+{
+    *index = (struct rom_index) { 0 };
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && (size_t) info.st_size >= sizeof(struct rom_index_header))
+        data = mmap(NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    size_t size = (size_t) info.st_size;
+    const struct rom_index_header* header = data;
+    const struct rom_index_entry* entries = (const struct rom_index_entry*) (header + 1);
+    const char* paths = (const char*) (entries + header->count);
+    bool valid = header->magic == ROM_INDEX_MAGIC && header->version == ROM_INDEX_VERSION &&
+                 header->entry_size == sizeof(struct rom_index_entry) &&
+                 size == sizeof(*header) + (size_t) header->count * sizeof(*entries) + header->paths_size &&
+                 header->paths_size != 0 && paths[header->paths_size - 1] == '\0';
+    if (valid)
+        index->roms = calloc(header->count, sizeof(struct rom_info));
+    for (size_t i = 0; valid && i < header->count; ++i)
+    {
+        const struct rom_index_entry* entry = &entries[i];
+        valid = entry->path_offset < header->paths_size;
+        if (!valid)
+            break;
+        index->roms[i] = (struct rom_info) {
+            .path = strdup(paths + entry->path_offset),
+            .size = entry->size,
+            .mtime_ns = entry->mtime_ns,
+            .crc32 = entry->crc32,
+            .flags = entry->flags,
+            .submapper = entry->submapper,
+            .mapper = entry->mapper,
+            .prg_rom_size = entry->prg_rom_size,
+            .chr_rom_size = entry->chr_rom_size,
+            .prg_ram_size = entry->prg_ram_size,
+        };
+        memcpy(index->roms[i].sha1, entry->sha1, ROM_SHA1_SIZE);
+        index->count = i + 1;
+    }
+    munmap(data, size);
+
+    if (!valid)
+        rom_index_free(index);
+    return valid;
+}
+
+bool rom_index_save(const struct rom_index* index, const char* path)
+{
+    size_t paths_size = 0;
+    for (size_t i = 0; i < index->count; ++i)
+    {
+        paths_size += strlen(index->roms[i].path) + 1;
+    }
+    if (paths_size == 0)
+        paths_size = 1;  // Keeps the paths NUL-terminated when there are none
+    struct rom_index_header header = {
+        .magic = ROM_INDEX_MAGIC,
+        .version = ROM_INDEX_VERSION,
+        .entry_size = sizeof(struct rom_index_entry),
+        .count = (uint32_t) index->count,
+        .paths_size = (uint32_t) paths_size,
+    };
+    struct rom_index_entry* entries = calloc(index->count + 1, sizeof(struct rom_index_entry));
+    char* paths = calloc(paths_size, 1);
+    if (entries == NULL || paths == NULL)
+    {
+        free(entries);
+        free(paths);
+        return false;
+    }
+    size_t path_offset = 0;
+    for (size_t i = 0; i < index->count; ++i)
+    {
+        const struct rom_info* rom = &index->roms[i];
+        entries[i] = (struct rom_index_entry) {
+            .size = rom->size,
+            .mtime_ns = rom->mtime_ns,
+            .path_offset = (uint32_t) path_offset,
+            .crc32 = rom->crc32,
+            .flags = rom->flags,
+            .submapper = rom->submapper,
+            .mapper = rom->mapper,
+            .prg_rom_size = rom->prg_rom_size,
+            .chr_rom_size = rom->chr_rom_size,
+            .prg_ram_size = rom->prg_ram_size,
+        };
+        memcpy(entries[i].sha1, rom->sha1, ROM_SHA1_SIZE);
+        size_t length = strlen(rom->path) + 1;
+        memcpy(paths + path_offset, rom->path, length);
+        path_offset += length;
+    }
+
+    size_t temp_path_size = strlen(path) + 32;  // path, pid and suffix
+    char* temp_path = malloc(temp_path_size);
+    snprintf(temp_path, temp_path_size, "%s.%ld.tmp", path, (long) getpid());
+    FILE* file = fopen(temp_path, "wb");
+    bool written = file != NULL && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   fwrite(entries, sizeof(struct rom_index_entry), index->count, file) == index->count &&
+                   fwrite(paths, 1, paths_size, file) == paths_size;
+    if (file != NULL && fclose(file) != 0)
+        written = false;
+    if (!written || rename(temp_path, path) != 0)
+    {
+        remove(temp_path);
+        written = false;
+    }
+    free(temp_path);
+    free(entries);
+    free(paths);
+    return written;
+}
+
+
+/**
+ * Files found by a scan, in the order the index keeps them
+ */
+struct rom_list
+{
+    struct rom_info* roms;
+    size_t count;
+    size_t capacity;
+};
+
+/// @return false if the directory could not be opened
+static bool find_roms(const char* dir_path, struct rom_list* list)
+{
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open directory: %s\n", dir_path);
+        return false;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        size_t length = strlen(dir_path) + 1 + strlen(entry->d_name) + 1;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir_path, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) != 0)
+        {
+            free(path);
+            continue;
+        }
+        if (S_ISDIR(info.st_mode))
+        {
+            find_roms(path, list);
+            free(path);
+            continue;
+        }
+        size_t name_length = strlen(entry->d_name);
+        char* real_path = realpath(path, NULL);
+        free(path);
+        if (!S_ISREG(info.st_mode) || name_length < 4 || strcasecmp(entry->d_name + name_length - 4, ".nes") != 0 ||
+            real_path == NULL)
+        {
+            free(real_path);
+            continue;
+        }
+
+        if (list->count == list->capacity)
+        {
+            list->capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+            list->roms = realloc(list->roms, list->capacity * sizeof(struct rom_info));
+            if (list->roms == NULL)
+            {
+                fprintf(stderr, "Out of memory for %zu ROMs\n", list->capacity);
+                exit(ERROR_CODE__OH_NO);
+            }
+        }
+        list->roms[list->count++] = (struct rom_info) {
+            .path = real_path,
+            .size = (uint64_t) info.st_size,
+            .mtime_ns = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec,
+        };
+    }
+    closedir(dir);
+    return true;
+}
+
+
+/**
+ * Reads the header and hashes the ROM data of one file, through a read-only mapping.
+ *
+ * @return false if it could not be read
+ */
+static bool read_rom(struct rom_info* rom)
+{
+    int fd = open(rom->path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    // The index keeps the size and time of what was hashed, should the file have changed since it was found
+    rom->size = (uint64_t) info.st_size;
+    rom->mtime_ns = (int64_t) info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+
+    size_t size = (size_t) info.st_size;
+    const uint8_t* data = (const uint8_t*) "";
+    if (size != 0)
+    {
+        void* mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED)
+        {
+            close(fd);
+            return false;
+        }
+        madvise(mapped, size, MADV_SEQUENTIAL);
+        data = mapped;
+    }
+    close(fd);
+
+    size_t rom_offset = 0;
+    size_t rom_size = size;
+    struct nes_file file;
+    if (size >= NES_FILE_HEADER_SIZE && load_parse_header(data, &file))
+    {
+        rom->flags = ROM_INFO_HEADER;
+        rom->flags |= file.nes2 ? ROM_INFO_NES2 : 0;
+        rom->flags |= file.battery ? ROM_INFO_BATTERY : 0;
+        rom->flags |= file.trainer ? ROM_INFO_TRAINER : 0;
+        rom->flags |= file.v_mirror ? ROM_INFO_V_MIRROR : 0;
+        rom->flags |= file.four_screen ? ROM_INFO_FOUR_SCREEN : 0;
+        rom->mapper = file.mapper_idx;
+        rom->submapper = file.submapper;
+        rom->prg_rom_size = (uint32_t) get_prg_size_bytes(file.prg_size);
+        rom->chr_rom_size = (uint32_t) get_chr_size_bytes(file.chr_size);
+        rom->prg_ram_size = (uint32_t) file.prg_ram_bytes;
+
+        rom_offset = NES_FILE_HEADER_SIZE + (file.trainer ? TRAINER_SIZE : 0);
+        rom_size = (size_t) rom->prg_rom_size + rom->chr_rom_size;
+        if (rom_offset > size || rom_size > size - rom_offset)
+        {
+            rom->flags |= ROM_INFO_TRUNCATED;
+            rom_offset = rom_offset > size ? size : rom_offset;
+            rom_size = size - rom_offset;
+        }
+    }
+
+    rom->crc32 = crc32_update(0, data + rom_offset, rom_size);
+    struct sha1 sha1;
+    sha1_init(&sha1);
+    sha1_update(&sha1, data + rom_offset, rom_size);
+    sha1_final(&sha1, rom->sha1);
+
+    if (size != 0)
+        munmap((void*) data, size);
+    return true;
+}
+
+/// Work shared by the scan threads: every ROM in `roms` with `pending` set is read by one of them
+struct scan_work
+{
+    struct rom_info* roms;
+    bool* pending;
+    bool* failed;
+    size_t count;
+    atomic_size_t next;
+};
+
+/// Whether `path` is somewhere under the directory `dir`; both canonical
+static bool path_under(const char* path, const char* dir)
+{
+    size_t length = strlen(dir);
+    return strncmp(path, dir, length) == 0 && (path[length] == '/' || (length != 0 && dir[length - 1] == '/'));
+}
+
+static void* scan_thread_main(void* arg)
+{
+    struct scan_work* work = arg;
+    for (;;)
+    {
+        size_t i = atomic_fetch_add_explicit(&work->next, 1, memory_order_relaxed);
+        if (i >= work->count)
+            return NULL;
+        if (work->pending[i])
+            work->failed[i] = !read_rom(&work->roms[i]);
+    }
+}
+
+void rom_index_scan(struct rom_index* index, const char* const* dirs, size_t num_dirs, unsigned jobs,
+                    struct rom_scan_stats* stats)
+{
+    *stats = (struct rom_scan_stats) { 0 };
+    struct rom_list list = { 0 };
+    // Canonical paths of the directories that were walked, NULL for those that could not be
+    char** scanned = calloc(num_dirs + 1, sizeof(char*));
+    for (size_t i = 0; i < num_dirs; ++i)
+    {
+        if (find_roms(dirs[i], &list))
+            scanned[i] = realpath(dirs[i], NULL);
+    }
+    qsort(list.roms, list.count, sizeof(struct rom_info), compare_roms);
+
+    // The same file found through two directories is kept once
+    size_t unique = 0;
+    for (size_t i = 0; i < list.count; ++i)
+    {
+        if (unique != 0 && strcmp(list.roms[unique - 1].path, list.roms[i].path) == 0)
+            free(list.roms[i].path);
+        else
+            list.roms[unique++] = list.roms[i];
+    }
+    list.count = unique;
+
+    // Unchanged files keep their entry; the rest are read
+    bool* pending = calloc(list.count + 1, sizeof(bool));
+    bool* failed = calloc(list.count + 1, sizeof(bool));
+    bool* seen = calloc(index->count + 1, sizeof(bool));
+    for (size_t i = 0; i < list.count; ++i)
+    {
+        struct rom_info* found = &list.roms[i];
+        struct rom_info* known = bsearch(found, index->roms, index->count, sizeof(struct rom_info), compare_roms);
+        if (known != NULL)
+            seen[known - index->roms] = true;
+        if (known != NULL && known->size == found->size && known->mtime_ns == found->mtime_ns)
+        {
+            char* path = found->path;
+            *found = *known;
+            found->path = path;
+            stats->reused++;
+        }
+        else
+        {
+            pending[i] = true;
+            stats->hashed++;
+        }
+    }
+
+    if (jobs == 0)
+        jobs = (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+    if (jobs > stats->hashed)
+        jobs = stats->hashed > 0 ? (unsigned) stats->hashed : 1;
+    struct scan_work work = { .roms = list.roms, .pending = pending, .failed = failed, .count = list.count };
+    atomic_init(&work.next, 0);
+    pthread_t* threads = calloc(jobs, sizeof(pthread_t));
+    unsigned started = 0;
+    for (; started + 1 < jobs; ++started)
+    {
+        if (pthread_create(&threads[started], NULL, scan_thread_main, &work) != 0)
+            break;
+    }
+    scan_thread_main(&work);
+    for (unsigned i = 0; i < started; ++i)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // Unreadable files are left out, so the next scan tries them again
+    size_t count = 0;
+    for (size_t i = 0; i < list.count; ++i)
+    {
+        if (failed[i])
+        {
+            fprintf(stderr, "Could not read ROM: %s\n", list.roms[i].path);
+            free(list.roms[i].path);
+            stats->hashed--;
+            stats->unreadable++;
+            continue;
+        }
+        list.roms[count++] = list.roms[i];
+    }
+    free(pending);
+    free(failed);
+
+    // Entries that were not found are dropped if their directory was just walked or their file is gone; the others
+    // belong to directories left out of this scan and are kept as they are
+    struct rom_info* roms = realloc(list.roms, (count + index->count + 1) * sizeof(struct rom_info));
+    if (roms == NULL)
+    {
+        fprintf(stderr, "Out of memory for %zu ROMs\n", count + index->count);
+        exit(ERROR_CODE__OH_NO);
+    }
+    size_t merged = count;
+    for (size_t i = 0; i < index->count; ++i)
+    {
+        if (seen[i])
+            continue;
+        struct rom_info* known = &index->roms[i];
+        bool dropped = false;
+        for (size_t d = 0; d < num_dirs && !dropped; ++d)
+        {
+            dropped = scanned[d] != NULL && path_under(known->path, scanned[d]);
+        }
+        struct stat info;
+        if (dropped || stat(known->path, &info) != 0)
+        {
+            stats->removed++;
+            continue;
+        }
+        roms[merged++] = *known;
+        known->path = NULL;  // now owned by the merged list
+    }
+    if (merged != count)
+        qsort(roms, merged, sizeof(struct rom_info), compare_roms);
+    free(seen);
+    for (size_t d = 0; d < num_dirs; ++d)
+    {
+        free(scanned[d]);
+    }
+    free(scanned);
+
+    rom_index_free(index);
+    index->roms = roms;
+    index->count = merged;
+}
+
+bool nes_scan(const char* index_path, const char* const* dirs, size_t num_dirs, unsigned jobs,
+              struct rom_index* index, struct rom_scan_stats* stats)
+{
+    rom_index_load(index, index_path);
+    rom_index_scan(index, dirs, num_dirs, jobs, stats);
+    return rom_index_save(index, index_path);
+}
+
+
+const struct rom_info* rom_index_find_path(const struct rom_index* index, const char* path)
+{
+    char* real_path = realpath(path, NULL);
+    struct rom_info key = { .path = real_path != NULL ? real_path : (char*) path };
+    const struct rom_info* rom = bsearch(&key, index->roms, index->count, sizeof(struct rom_info), compare_roms);
+    free(real_path);
+    return rom;
+}
+
+const struct rom_info* rom_index_find_crc32(const struct rom_index* index, uint32_t crc32)
+{
+    for (size_t i = 0; i < index->count; ++i)
+    {
+        if (index->roms[i].crc32 == crc32)
+            return &index->roms[i];
+    }
+    return NULL;
+}
+
+bool rom_info_supported(const struct rom_info* rom)
+{
+    if ((rom->flags & ROM_INFO_HEADER) == 0 || (rom->flags & ROM_INFO_TRUNCATED) != 0)
+        return false;
+    struct nes_file file = {
+        .mapper_idx = rom->mapper,
+        .prg_size = rom->prg_rom_size / PRG_PAGE_SIZE,
+        .chr_size = rom->chr_rom_size / CHR_PAGE_SIZE,
+    };
+    return load_file_supported(&file);
+}
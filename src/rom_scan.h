@@ -0,0 +1,137 @@
+//
+// Created by quate on 10/19/2026.
+//
+// ROM library index. nes_scan() walks directories for .nes files, reads their headers and hashes their ROM data on
+// several threads, and keeps the results in a compact binary index file. A later scan with the same index only reads
+// the files whose size or modification time changed, so tools that pick ROMs for jobs can look up a ROM's board and
+// whether this build can run it from the index alone.
+//
+// The index is a struct rom_index_header, `count` struct rom_index_entry records sorted by path, then the paths, each
+// NUL-terminated, at the entries' path offsets. It is written in host byte order and rebuilt from scratch if its
+// header doesn't match this build's.
+//
+
+#ifndef NES_EMULATOR_ROM_SCAN_H
+#define NES_EMULATOR_ROM_SCAN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ROM_INDEX_MAGIC 0x5844494E  // "NIDX"
+#define ROM_INDEX_VERSION 1
+
+#define ROM_SHA1_SIZE 20
+
+enum rom_info_flags
+{
+    ROM_INFO_HEADER = 1 << 0,       /// Has a usable iNES header; the fields below it are only set then
+    ROM_INFO_NES2 = 1 << 1,
+    ROM_INFO_BATTERY = 1 << 2,
+    ROM_INFO_TRAINER = 1 << 3,
+    ROM_INFO_V_MIRROR = 1 << 4,
+    ROM_INFO_FOUR_SCREEN = 1 << 5,
+    ROM_INFO_TRUNCATED = 1 << 6,    /// Shorter than its header says
+};
+
+struct rom_info
+{
+    char* path;             /// Canonical (realpath) path
+    uint64_t size;          /// File size and modification time when it was read
+    int64_t mtime_ns;
+
+    /// Of the PRG and CHR data, without the header and trainer (the hashes ROM databases list, and nes_file_crc32()),
+    /// or of the whole file if it has no header
+    uint32_t crc32;
+    uint8_t sha1[ROM_SHA1_SIZE];
+
+    uint8_t flags;          /// enum rom_info_flags
+    uint8_t submapper;
+    uint16_t mapper;
+    uint32_t prg_rom_size;  /// Bytes
+    uint32_t chr_rom_size;
+    uint32_t prg_ram_size;  /// 0 when the header doesn't say
+};
+
+struct rom_index
+{
+    size_t count;
+    struct rom_info* roms;  /// Sorted by path
+};
+
+/// On-disk layout, see the top of this file
+struct rom_index_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t entry_size;    /// sizeof(struct rom_index_entry)
+    uint32_t count;
+    uint32_t paths_size;
+};
+
+struct rom_index_entry
+{
+    uint64_t size;
+    int64_t mtime_ns;
+    uint32_t path_offset;   /// From the start of the paths
+    uint32_t crc32;
+    uint8_t sha1[ROM_SHA1_SIZE];
+    uint8_t flags;
+    uint8_t submapper;
+    uint16_t mapper;
+    uint32_t prg_rom_size;
+    uint32_t chr_rom_size;
+    uint32_t prg_ram_size;
+    uint32_t reserved;      /// 0; no padding is written
+};
+
+struct rom_scan_stats
+{
+    size_t hashed;          /// New or changed files read
+    size_t reused;          /// Unchanged files taken from the index
+    size_t removed;         /// Index entries whose file is gone
+    size_t unreadable;      /// Files that could not be read; left out of the index
+};
+
+/**
+ * Loads an index file.
+ *
+ * @return false, with `index` empty, if it doesn't exist or isn't a valid index from this build
+ */
+bool rom_index_load(struct rom_index* index, const char* path);
+
+/**
+ * Writes the index to a temporary file and renames it over `path`.
+ */
+bool rom_index_save(const struct rom_index* index, const char* path);
+
+void rom_index_free(struct rom_index* index);
+
+/**
+ * Brings `index` up to date with the .nes files under `dirs` (recursively): new and changed files are read on `jobs`
+ * threads, unchanged ones are kept as they are, and those no longer there are dropped. Entries for files outside
+ * `dirs`, from earlier scans of other directories, stay unless the file is gone.
+ */
+void rom_index_scan(struct rom_index* index, const char* const* dirs, size_t num_dirs, unsigned jobs,
+                    struct rom_scan_stats* stats);
+
+/**
+ * Loads the index at `index_path` (if any), scans `dirs` into it and writes it back.
+ *
+ * @return false if the index could not be written
+ */
+bool nes_scan(const char* index_path, const char* const* dirs, size_t num_dirs, unsigned jobs,
+              struct rom_index* index, struct rom_scan_stats* stats);
+
+/// The ROM at `path`, canonicalized if it exists, or NULL
+const struct rom_info* rom_index_find_path(const struct rom_index* index, const char* path);
+
+/// The first ROM with this CRC-32, or NULL
+const struct rom_info* rom_index_find_crc32(const struct rom_index* index, uint32_t crc32);
+
+/**
+ * Whether this build of the emulator can run the ROM (see load_file_supported()), from its header fields.
+ */
+bool rom_info_supported(const struct rom_info* rom);
+
+#endif //NES_EMULATOR_ROM_SCAN_H
@@ -3,3 +3,363 @@
 //
 
 #include "screen.h"
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+
+const uint32_t screen_palette[SCREEN_PALETTE_SIZE] = {
+    0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+    0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+    0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+    0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+    0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+    0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+    0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+    0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+};
+
+
+static void screen_convert_row(const struct frame* frame, uint32_t* rgb, size_t y)
+{
+    for (size_t x = 0; x < FRAME_WIDTH; ++x)
+    {
+        rgb[y * FRAME_WIDTH + x] = screen_palette[frame->pixels[y][x] & (SCREEN_PALETTE_SIZE - 1)];
+    }
+}
+
+
+void screen_convert_frame(const struct frame* frame, uint32_t* rgb)
+{
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        screen_convert_row(frame, rgb, y);
+    }
+}
+
+
+size_t screen_convert_changed_rows(const struct frame* frame, uint32_t* rgb, uint64_t row_hashes[FRAME_HEIGHT])
+{
+    size_t converted = 0;
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        if (row_hashes[y] == frame->row_hashes[y])
+            continue;
+        screen_convert_row(frame, rgb, y);
+        row_hashes[y] = frame->row_hashes[y];
+        converted++;
+    }
+    return converted;
+}
+
+
+void screen_convert_frame_rgb24(const struct frame* frame, uint8_t* rgb)
+{
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        for (size_t x = 0; x < FRAME_WIDTH; ++x)
+        {
+            uint32_t color = screen_palette[frame->pixels[y][x] & (SCREEN_PALETTE_SIZE - 1)];
+            *rgb++ = (uint8_t) (color >> 16);
+            *rgb++ = (uint8_t) (color >> 8);
+            *rgb++ = (uint8_t) color;
+        }
+    }
+}
+
+
+void screen_convert_frame_yuv420(const struct frame* frame, uint8_t* yuv)
+{
+    // With only 64 colors, converting the palette once per frame is cheaper than converting any pixel
+    uint8_t luma[SCREEN_PALETTE_SIZE];
+    int16_t cb[SCREEN_PALETTE_SIZE];
+    int16_t cr[SCREEN_PALETTE_SIZE];
+    for (size_t i = 0; i < SCREEN_PALETTE_SIZE; ++i)
+    {
+        int r = (screen_palette[i] >> 16) & 0xFF;
+        int g = (screen_palette[i] >> 8) & 0xFF;
+        int b = screen_palette[i] & 0xFF;
+        luma[i] = (uint8_t) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+        cb[i] = (int16_t) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        cr[i] = (int16_t) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    uint8_t* y_plane = yuv;
+    uint8_t* cb_plane = y_plane + FRAME_WIDTH * FRAME_HEIGHT;
+    uint8_t* cr_plane = cb_plane + FRAME_WIDTH * FRAME_HEIGHT / 4;
+    for (size_t y = 0; y < FRAME_HEIGHT; y += 2)
+    {
+        const uint8_t* top = frame->pixels[y];
+        const uint8_t* bottom = frame->pixels[y + 1];
+        for (size_t x = 0; x < FRAME_WIDTH; x += 2)
+        {
+            uint8_t a = top[x] & (SCREEN_PALETTE_SIZE - 1);
+            uint8_t b = top[x + 1] & (SCREEN_PALETTE_SIZE - 1);
+            uint8_t c = bottom[x] & (SCREEN_PALETTE_SIZE - 1);
+            uint8_t d = bottom[x + 1] & (SCREEN_PALETTE_SIZE - 1);
+            y_plane[y * FRAME_WIDTH + x] = luma[a];
+            y_plane[y * FRAME_WIDTH + x + 1] = luma[b];
+            y_plane[(y + 1) * FRAME_WIDTH + x] = luma[c];
+            y_plane[(y + 1) * FRAME_WIDTH + x + 1] = luma[d];
+            *cb_plane++ = (uint8_t) ((cb[a] + cb[b] + cb[c] + cb[d] + 2) >> 2);
+            *cr_plane++ = (uint8_t) ((cr[a] + cr[b] + cr[c] + cr[d] + 2) >> 2);
+        }
+    }
+}
+
+
+bool screen_scale_valid(const struct screen_scale* scale)
+{
+    if (scale->crop_top + scale->crop_bottom >= FRAME_HEIGHT || scale->crop_left + scale->crop_right >= FRAME_WIDTH)
+        return false;
+    if (scale->factor < 1 || scale->factor > SCREEN_SCALE_MAX_FACTOR)
+        return false;
+    return scale->filter == SCREEN_SCALE_NEAREST || scale->factor % 2 == 0 || scale->factor % 3 == 0;
+}
+
+
+size_t screen_scale_width(const struct screen_scale* scale)
+{
+    return (size_t) (FRAME_WIDTH - scale->crop_left - scale->crop_right) * scale->factor;
+}
+
+
+size_t screen_scale_height(const struct screen_scale* scale)
+{
+    return (size_t) (FRAME_HEIGHT - scale->crop_top - scale->crop_bottom) * scale->factor;
+}
+
+
+static uint32_t* screen_out_row(uint32_t* out, size_t out_stride, size_t row)
+{
+    return (uint32_t*) ((uint8_t*) out + row * out_stride);
+}
+
+
+static uint32_t screen_color(uint8_t index)
+{
+    return screen_palette[index & (SCREEN_PALETTE_SIZE - 1)];
+}
+
+
+/**
+ * Copies the first of `count` picture rows over the others.
+ */
+static void screen_replicate_row(uint32_t* out, size_t out_stride, size_t row, size_t count, size_t width)
+{
+    const uint32_t* first = screen_out_row(out, out_stride, row);
+    for (size_t i = 1; i < count; ++i)
+    {
+        memcpy(screen_out_row(out, out_stride, row + i), first, width * sizeof(uint32_t));
+    }
+}
+
+
+/**
+ * One picture row of nearest-neighbor scaling: each pixel `factor` times.
+ */
+static void screen_scale_row_nearest(const uint8_t* line, size_t width, size_t factor, uint32_t* row)
+{
+    size_t x = 0;
+#ifdef __SSE2__
+    // Each pixel is stored as whole vectors of its color, spilling up to three pixels into the next ones, which
+    // overwrite them in turn; only the pixels whose spill would run past the end of the row are left to the loop below
+    if (factor > 1)
+    {
+        size_t vectors = (factor + 3) / 4;
+        size_t spill = vectors * 4 - factor;
+        size_t simd_width = width - (spill + factor - 1) / factor;
+        for (; x < simd_width; ++x)
+        {
+            __m128i color = _mm_set1_epi32((int) screen_color(line[x]));
+            __m128i* dst = (__m128i*) (row + x * factor);
+            _mm_storeu_si128(dst, color);
+            if (vectors > 1)
+                _mm_storeu_si128(dst + 1, color);
+        }
+    }
+#endif
+    for (; x < width; ++x)
+    {
+        uint32_t color = screen_color(line[x]);
+        for (size_t i = 0; i < factor; ++i)
+        {
+            row[x * factor + i] = color;
+        }
+    }
+}
+
+
+/// Writes a pixel of the edge filters' output, repeated to a repeat x repeat block
+static void screen_put(uint32_t* row, size_t column, size_t repeat, uint8_t index)
+{
+    uint32_t color = screen_color(index);
+    for (size_t i = 0; i < repeat; ++i)
+    {
+        row[column + i] = color;
+    }
+}
+
+
+/**
+ * Scale2x (EPX) of one frame row, into two picture rows of blocks of `repeat` pixels. Neighbors beyond the cropped
+ * picture are taken to be the same as the pixel at its edge.
+ * https://www.scale2x.it/algorithm
+ */
+static void screen_scale_row_2x(const uint8_t* above, const uint8_t* line, const uint8_t* below, size_t left,
+                                size_t right, size_t repeat, uint32_t* row0, uint32_t* row1)
+{
+    for (size_t x = left; x < right; ++x)
+    {
+        uint8_t b = above[x] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t d = line[x == left ? x : x - 1] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t e = line[x] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t f = line[x + 1 == right ? x : x + 1] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t h = below[x] & (SCREEN_PALETTE_SIZE - 1);
+        size_t column = (x - left) * 2 * repeat;
+        if (b != h && d != f)
+        {
+            screen_put(row0, column, repeat, d == b ? d : e);
+            screen_put(row0, column + repeat, repeat, b == f ? f : e);
+            screen_put(row1, column, repeat, d == h ? d : e);
+            screen_put(row1, column + repeat, repeat, h == f ? f : e);
+        }
+        else
+        {
+            screen_put(row0, column, 2 * repeat, e);
+            screen_put(row1, column, 2 * repeat, e);
+        }
+    }
+}
+
+
+/**
+ * Scale3x (AdvMAME3x) of one frame row, into three picture rows, like screen_scale_row_2x().
+ */
+static void screen_scale_row_3x(const uint8_t* above, const uint8_t* line, const uint8_t* below, size_t left,
+                                size_t right, size_t repeat, uint32_t* row0, uint32_t* row1, uint32_t* row2)
+{
+    for (size_t x = left; x < right; ++x)
+    {
+        size_t x0 = x == left ? x : x - 1;
+        size_t x2 = x + 1 == right ? x : x + 1;
+        uint8_t a = above[x0] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t b = above[x] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t c = above[x2] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t d = line[x0] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t e = line[x] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t f = line[x2] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t g = below[x0] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t h = below[x] & (SCREEN_PALETTE_SIZE - 1);
+        uint8_t i = below[x2] & (SCREEN_PALETTE_SIZE - 1);
+        size_t column = (x - left) * 3 * repeat;
+        if (b != h && d != f)
+        {
+            screen_put(row0, column, repeat, d == b ? d : e);
+            screen_put(row0, column + repeat, repeat, (d == b && e != c) || (b == f && e != a) ? b : e);
+            screen_put(row0, column + 2 * repeat, repeat, b == f ? f : e);
+            screen_put(row1, column, repeat, (d == b && e != g) || (d == h && e != a) ? d : e);
+            screen_put(row1, column + repeat, repeat, e);
+            screen_put(row1, column + 2 * repeat, repeat, (b == f && e != i) || (h == f && e != c) ? f : e);
+            screen_put(row2, column, repeat, d == h ? d : e);
+            screen_put(row2, column + repeat, repeat, (d == h && e != i) || (h == f && e != g) ? h : e);
+            screen_put(row2, column + 2 * repeat, repeat, h == f ? f : e);
+        }
+        else
+        {
+            screen_put(row0, column, 3 * repeat, e);
+            screen_put(row1, column, 3 * repeat, e);
+            screen_put(row2, column, 3 * repeat, e);
+        }
+    }
+}
+
+
+void screen_scale(const uint8_t* pixels, size_t pixels_stride, const struct screen_scale* scale, uint32_t* out,
+                  size_t out_stride, const bool* rows)
+{
+    size_t factor = scale->factor;
+    size_t top = scale->crop_top;
+    size_t bottom = FRAME_HEIGHT - scale->crop_bottom;
+    size_t left = scale->crop_left;
+    size_t right = FRAME_WIDTH - scale->crop_right;
+    size_t width = screen_scale_width(scale);
+
+    // The edge filters make `base` picture rows per frame row, each pixel of which becomes a repeat x repeat block
+    size_t base = scale->filter == SCREEN_SCALE_NEAREST ? 1 : factor % 3 == 0 ? 3 : 2;
+    size_t repeat = factor / base;
+    for (size_t y = top; y < bottom; ++y)
+    {
+        if (rows != NULL && !rows[y])
+            continue;
+        const uint8_t* line = pixels + y * pixels_stride;
+        size_t first_row = (y - top) * factor;
+        if (base == 1)
+        {
+            screen_scale_row_nearest(line + left, right - left, factor, screen_out_row(out, out_stride, first_row));
+            screen_replicate_row(out, out_stride, first_row, factor, width);
+            continue;
+        }
+
+        const uint8_t* above = y == top ? line : line - pixels_stride;
+        const uint8_t* below = y + 1 == bottom ? line : line + pixels_stride;
+        uint32_t* row0 = screen_out_row(out, out_stride, first_row);
+        uint32_t* row1 = screen_out_row(out, out_stride, first_row + repeat);
+        if (base == 2)
+        {
+            screen_scale_row_2x(above, line, below, left, right, repeat, row0, row1);
+        }
+        else
+        {
+            uint32_t* row2 = screen_out_row(out, out_stride, first_row + 2 * repeat);
+            screen_scale_row_3x(above, line, below, left, right, repeat, row0, row1, row2);
+        }
+        for (size_t i = 0; i < base; ++i)
+        {
+            screen_replicate_row(out, out_stride, first_row + i * repeat, repeat, width);
+        }
+    }
+}
+
+
+void screen_scale_frame(const struct frame* frame, const struct screen_scale* scale, uint32_t* out, size_t out_stride)
+{
+    screen_scale(&frame->pixels[0][0], FRAME_WIDTH, scale, out, out_stride, NULL);
+}
+
+
+size_t screen_scale_changed_rows_of(const struct screen_scale* scale, const uint64_t* frame_row_hashes,
+                                    uint64_t row_hashes[FRAME_HEIGHT], bool rows[FRAME_HEIGHT])
+{
+    bool changed[FRAME_HEIGHT];
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        changed[y] = row_hashes[y] != frame_row_hashes[y];
+        row_hashes[y] = frame_row_hashes[y];
+    }
+
+    size_t scaled = 0;
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        rows[y] = changed[y];
+        if (scale->filter != SCREEN_SCALE_NEAREST)
+            rows[y] = rows[y] || (y > 0 && changed[y - 1]) || (y + 1 < FRAME_HEIGHT && changed[y + 1]);
+        if (rows[y] && y >= scale->crop_top && y < (size_t) (FRAME_HEIGHT - scale->crop_bottom))
+            scaled++;
+    }
+    return scaled;
+}
+
+
+size_t screen_scale_changed_rows(const struct frame* frame, const struct screen_scale* scale, uint32_t* out,
+                                 size_t out_stride, uint64_t row_hashes[FRAME_HEIGHT])
+{
+    bool rows[FRAME_HEIGHT];
+    size_t scaled = screen_scale_changed_rows_of(scale, frame->row_hashes, row_hashes, rows);
+    if (scaled != 0)
+        screen_scale(&frame->pixels[0][0], FRAME_WIDTH, scale, out, out_stride, rows);
+    return scaled;
+}
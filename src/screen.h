@@ -5,6 +5,128 @@
 #ifndef NES_EMULATOR_SCREEN_H
 #define NES_EMULATOR_SCREEN_H
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "frame.h"
 
+#define SCREEN_PALETTE_SIZE 64
+
+/// Frame rate of the NTSC NES, about 60.0988 frames per second
+#define SCREEN_FPS_NUMERATOR 39375000
+#define SCREEN_FPS_DENOMINATOR 655171
+
+/// Bytes of a frame converted by screen_convert_frame_rgb24() and screen_convert_frame_yuv420()
+#define SCREEN_RGB24_SIZE (FRAME_WIDTH * FRAME_HEIGHT * 3)
+#define SCREEN_YUV420_SIZE (FRAME_WIDTH * FRAME_HEIGHT * 3 / 2)
+
+#define SCREEN_SCALE_MAX_FACTOR 6
+/// Lines at the top and at the bottom that NTSC TVs usually hide, and games often leave garbage in
+#define SCREEN_OVERSCAN_LINES 8
+
+enum screen_scale_filter
+{
+    SCREEN_SCALE_NEAREST,  /// Each pixel becomes a factor x factor block
+    SCREEN_SCALE_EDGES,    /// Scale2x (factors 2 and 4) or Scale3x (3 and 6), then blocks: rounds off diagonal edges
+};
+
+/**
+ * A post-processing stage from a frame to the picture shown: overscan cropped off each side, then scaled up by an
+ * integer factor.
+ */
+struct screen_scale
+{
+    uint8_t crop_top;     /// Lines
+    uint8_t crop_bottom;
+    uint8_t crop_left;    /// Columns
+    uint8_t crop_right;
+    uint8_t factor;       /// 1 to SCREEN_SCALE_MAX_FACTOR
+    enum screen_scale_filter filter;
+};
+
+/**
+ * RGB color (0x00RRGGBB) of each of the PPU's 64 palette indices.
+ * https://www.nesdev.org/wiki/PPU_palettes#2C02
+ */
+extern const uint32_t screen_palette[SCREEN_PALETTE_SIZE];
+
+/**
+ * Converts a frame of palette indices into RGB.
+ *
+ * @param frame Frame as published by the emulation thread.
+ * @param rgb Output of FRAME_WIDTH * FRAME_HEIGHT pixels, row-major.
+ */
+void screen_convert_frame(const struct frame* frame, uint32_t* rgb);
+
+/**
+ * Converts only the rows of a frame that differ from what rgb already holds.
+ *
+ * @param row_hashes Row hashes of the frame rgb was last converted from, updated to those of this frame. rgb and
+ *                   row_hashes must agree to begin with, e.g. by converting the first frame with screen_convert_frame()
+ *                   and copying its row hashes.
+ * @return Number of rows converted.
+ */
+size_t screen_convert_changed_rows(const struct frame* frame, uint32_t* rgb, uint64_t row_hashes[FRAME_HEIGHT]);
+
+/**
+ * Converts a frame into packed 24-bit RGB, three bytes (R, G, B) per pixel, row-major: SCREEN_RGB24_SIZE bytes.
+ */
+void screen_convert_frame_rgb24(const struct frame* frame, uint8_t* rgb);
+
+/**
+ * Converts a frame into planar 4:2:0 Y'CbCr (BT.601, limited range): the luma plane, then the Cb and Cr planes at half
+ * the width and height, each sample the average of a 2x2 block of pixels (centered, as Y4M's C420jpeg).
+ * SCREEN_YUV420_SIZE bytes.
+ */
+void screen_convert_frame_yuv420(const struct frame* frame, uint8_t* yuv);
+
+/**
+ * Whether the crop leaves some of the frame, and the factor is one the filter supports.
+ */
+bool screen_scale_valid(const struct screen_scale* scale);
+
+/// Size of the picture in pixels
+size_t screen_scale_width(const struct screen_scale* scale);
+size_t screen_scale_height(const struct screen_scale* scale);
+
+/**
+ * Crops, scales and converts rows of palette indices straight into the caller's RGB (0x00RRGGBB) buffer, with no
+ * copy in between. Picture pixels only are written: the bytes between the end of a row and the next stride are left
+ * alone, so the picture may be a window into a larger surface.
+ *
+ * @param pixels FRAME_HEIGHT rows of FRAME_WIDTH palette indices, pixels_stride bytes apart
+ * @param out screen_scale_height() rows of screen_scale_width() pixels, out_stride bytes apart
+ * @param rows Which frame rows to scale, FRAME_HEIGHT flags, or NULL for all of them. Rows outside the crop are
+ *             ignored. With SCREEN_SCALE_EDGES, a row's picture also depends on the rows above and below it.
+ */
+void screen_scale(const uint8_t* pixels, size_t pixels_stride, const struct screen_scale* scale, uint32_t* out,
+                  size_t out_stride, const bool* rows);
+
+/**
+ * Scales a whole frame, see screen_scale().
+ */
+void screen_scale_frame(const struct frame* frame, const struct screen_scale* scale, uint32_t* out, size_t out_stride);
+
+/**
+ * Which frame rows screen_scale() has to scale again for a frame with the given row hashes.
+ *
+ * @param row_hashes Row hashes of the frame the picture was last scaled from with the same scale, updated to
+ *                   frame_row_hashes
+ * @param rows Set to the flags for screen_scale()
+ * @return Number of rows in the crop to scale.
+ */
+size_t screen_scale_changed_rows_of(const struct screen_scale* scale, const uint64_t* frame_row_hashes,
+                                    uint64_t row_hashes[FRAME_HEIGHT], bool rows[FRAME_HEIGHT]);
+
+/**
+ * Scales only the picture rows that depend on frame rows that differ from what out already holds, like
+ * screen_convert_changed_rows().
+ *
+ * @param row_hashes Row hashes of the frame out was last scaled from with the same scale, updated to those of this
+ *                   frame
+ * @return Number of frame rows scaled.
+ */
+size_t screen_scale_changed_rows(const struct frame* frame, const struct screen_scale* scale, uint32_t* out,
+                                 size_t out_stride, uint64_t row_hashes[FRAME_HEIGHT]);
 
 #endif //NES_EMULATOR_SCREEN_H
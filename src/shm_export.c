@@ -0,0 +1,117 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "shm_export.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "cpu/cpu.h"
+#include "screen.h"
+#include "exit_codes.h"
+
+
+void shm_export_open(struct shm_export* shm, const char* name, enum shm_export_format format)
+{
+    if (strlen(name) >= sizeof(shm->name))
+    {
+        fprintf(stderr, "Shared memory name is too long: %s", name);
+        exit(ERROR_CODE__OH_NO);
+    }
+    strcpy(shm->name, name);
+    shm->format = format;
+
+    size_t row_stride = FRAME_WIDTH * (format == SHM_EXPORT_RGB ? sizeof(uint32_t) : sizeof(uint8_t));
+    size_t pixels_offset = sizeof(struct shm_export_header);
+    size_t ram_offset = pixels_offset + FRAME_HEIGHT * row_stride;
+    shm->size = ram_offset + RAM_SIZE;
+
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t) shm->size) != 0)
+    {
+        fprintf(stderr, "Could not create shared memory: %s", name);
+        exit(ERROR_CODE__OH_NO);
+    }
+    void* base = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+    {
+        fprintf(stderr, "Could not map shared memory: %s", name);
+        exit(ERROR_CODE__OH_NO);
+    }
+
+    // The segment starts zeroed, which is an all-zero frame with all-zero row hashes; in RGB that frame is color 0
+    shm->header = base;
+    shm->pixels = (uint8_t*) base + pixels_offset;
+    shm->ram = (uint8_t*) base + ram_offset;
+    if (format == SHM_EXPORT_RGB)
+    {
+        uint32_t* rgb = (uint32_t*) shm->pixels;
+        for (size_t i = 0; i < FRAME_WIDTH * FRAME_HEIGHT; ++i)
+        {
+            rgb[i] = screen_palette[0];
+        }
+    }
+
+    struct shm_export_header* header = shm->header;
+    header->version = SHM_EXPORT_VERSION;
+    header->format = format;
+    header->width = FRAME_WIDTH;
+    header->height = FRAME_HEIGHT;
+    header->row_stride = (uint32_t) row_stride;
+    header->pixels_offset = (uint32_t) pixels_offset;
+    header->ram_offset = (uint32_t) ram_offset;
+    header->ram_size = RAM_SIZE;
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_EXPORT_MAGIC;
+}
+
+
+void shm_export_publish(struct shm_export* shm, uint64_t frame_number, uint64_t input_timestamp_ns,
+                        uint64_t publish_timestamp_ns, const uint8_t (*pixels)[FRAME_WIDTH],
+                        const uint64_t* row_hashes, const uint8_t* ram)
+{
+    struct shm_export_header* header = shm->header;
+    uint64_t sequence = atomic_load_explicit(&header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&header->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    header->frame_number = frame_number;
+    header->input_timestamp_ns = input_timestamp_ns;
+    header->publish_timestamp_ns = publish_timestamp_ns;
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        if (header->row_hashes[y] == row_hashes[y])
+            continue;
+        if (shm->format == SHM_EXPORT_RGB)
+        {
+            uint32_t* rgb = (uint32_t*) (shm->pixels + y * header->row_stride);
+            for (size_t x = 0; x < FRAME_WIDTH; ++x)
+            {
+                rgb[x] = screen_palette[pixels[y][x] & (SCREEN_PALETTE_SIZE - 1)];
+            }
+        }
+        else
+        {
+            memcpy(shm->pixels + y * header->row_stride, pixels[y], FRAME_WIDTH);
+        }
+        header->row_hashes[y] = row_hashes[y];
+    }
+    memcpy(shm->ram, ram, RAM_SIZE);
+
+    atomic_store_explicit(&header->sequence, sequence + 2, memory_order_release);
+}
+
+
+void shm_export_close(struct shm_export* shm)
+{
+    if (shm->header == NULL)
+        return;
+    munmap(shm->header, shm->size);
+    shm_unlink(shm->name);
+    shm->header = NULL;
+}
@@ -0,0 +1,97 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Shared-memory export of frames and CPU RAM, for analysis processes on the same machine to read in place.
+//
+// Each exporting emulator owns one POSIX shared-memory segment, named by the caller, so that several instances can
+// run side by side. The segment holds a struct shm_export_header followed by the pixels of the latest published frame
+// and then a copy of CPU RAM as of that frame's start of vertical blanking. The emulator is the only writer and
+// never waits for readers. The segment exists, empty, before it is filled in: readers should wait until fstat() gives
+// a size of at least sizeof(struct shm_export_header) and magic reads SHM_EXPORT_MAGIC. From there on they use the
+// header's sequence number as a seqlock:
+//
+//     do {
+//         do seq = atomic_load_explicit(&header->sequence, memory_order_acquire); while (seq & 1);
+//         ... copy the pixels, RAM and header fields needed ...
+//         atomic_thread_fence(memory_order_acquire);
+//     } while (atomic_load_explicit(&header->sequence, memory_order_relaxed) != seq);
+//
+// A reader that only wants what changed can keep the row hashes from its last copy and skip rows whose hash is the
+// same.
+//
+
+#ifndef NES_EMULATOR_SHM_EXPORT_H
+#define NES_EMULATOR_SHM_EXPORT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "frame.h"
+
+/// "NESX" in the first four bytes of the segment
+#define SHM_EXPORT_MAGIC 0x5853454E
+#define SHM_EXPORT_VERSION 1
+
+enum shm_export_format
+{
+    SHM_EXPORT_INDICES = 0,  /// One byte per pixel: the PPU palette index (0x00-0x3F)
+    SHM_EXPORT_RGB = 1,      /// Four bytes per pixel: 0x00RRGGBB in host byte order, see screen_palette
+};
+
+struct shm_export_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;          /// enum shm_export_format
+    uint32_t width;           /// FRAME_WIDTH
+    uint32_t height;          /// FRAME_HEIGHT
+    uint32_t row_stride;      /// Bytes from one row of pixels to the next
+    uint32_t pixels_offset;   /// From the start of the segment
+    uint32_t ram_offset;      /// From the start of the segment
+    uint32_t ram_size;
+    uint32_t reserved;
+
+    /// Odd while the emulator is writing; incremented by 2 per published frame
+    _Atomic uint64_t sequence;
+
+    /// 0 until the first frame is published, then the number of frames the PPU had completed at that one
+    uint64_t frame_number;
+    uint64_t input_timestamp_ns;
+    uint64_t publish_timestamp_ns;
+
+    /// ppu_row_hashes of the rows in the segment
+    uint64_t row_hashes[FRAME_HEIGHT];
+};
+
+struct shm_export
+{
+    char name[256];
+    enum shm_export_format format;
+    size_t size;
+    struct shm_export_header* header;
+    uint8_t* pixels;
+    uint8_t* ram;
+};
+
+/**
+ * Creates and maps the shared-memory segment, replacing any left over under the same name. Exits on failure.
+ *
+ * @param name POSIX shared-memory object name, e.g. "/nes_emulator.1"
+ */
+void shm_export_open(struct shm_export* shm, const char* name, enum shm_export_format format);
+
+/**
+ * Writes a frame into the segment. Only the rows whose hash differs from the one in the segment are rewritten.
+ *
+ * @param pixels The frame, FRAME_HEIGHT rows of FRAME_WIDTH palette indices
+ * @param row_hashes Their ppu_row_hashes
+ * @param ram CPU RAM, RAM_SIZE bytes
+ */
+void shm_export_publish(struct shm_export* shm, uint64_t frame_number, uint64_t input_timestamp_ns,
+                        uint64_t publish_timestamp_ns, const uint8_t (*pixels)[FRAME_WIDTH],
+                        const uint64_t* row_hashes, const uint8_t* ram);
+
+/// Unmaps and unlinks the segment. Readers that have it mapped keep their mapping.
+void shm_export_close(struct shm_export* shm);
+
+#endif //NES_EMULATOR_SHM_EXPORT_H
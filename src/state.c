@@ -0,0 +1,153 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#define _GNU_SOURCE  // dladdr
+#include "state.h"
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "apu.h"
+#include "clock.h"
+#include "io.h"
+#include "emu.h"
+#include "cartridge/nrom00.h"
+#include "utils.h"
+
+
+#define STATE_VERSION 3
+
+static const char state_magic[4] = { 'N', 'E', 'S', 'S' };
+
+struct state_header
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t size;
+    uint32_t build_id;
+    int32_t core;  /// emu_core_id: resume points are labels in that core's functions
+};
+
+
+void state_field(struct state* state, void* field, size_t size)
+{
+    if (state->mode == STATE_SAVE)
+        memcpy(state->data + state->pos, field, size);
+    else if (state->mode == STATE_LOAD)
+        memcpy(field, state->data + state->pos, size);
+    state->pos += size;
+}
+
+
+void state_code_pointer(struct state* state, void* field)
+{
+    // Relative to a function in the same binary, which moves along with the rest of the code
+    uintptr_t base = (uintptr_t) &state_code_pointer;
+    uintptr_t pointer;
+    memcpy(&pointer, field, sizeof(pointer));
+    uintptr_t offset = pointer != 0 ? pointer - base : 0;
+    if (state->mode == STATE_SAVE)
+        memcpy(state->data + state->pos, &offset, sizeof(offset));
+    else if (state->mode == STATE_LOAD)
+    {
+        memcpy(&offset, state->data + state->pos, sizeof(offset));
+        pointer = offset != 0 ? offset + base : 0;
+        memcpy(field, &pointer, sizeof(pointer));
+    }
+    state->pos += sizeof(offset);
+}
+
+
+/**
+ * CRC-32 of the executable or shared library this code was loaded from, which is what the code offsets in a state are
+ * valid for. 0 if it can't be read.
+ */
+static uint32_t state_build_id()
+{
+    static uint32_t build_id = 0;
+    static bool known = false;
+    if (known)
+        return build_id;
+    known = true;
+
+    Dl_info info;
+    if (dladdr((void*) &state_build_id, &info) == 0 || info.dli_fname == NULL)
+        return build_id;
+    FILE* file = fopen(info.dli_fname, "rb");
+    if (file == NULL)
+        return build_id;
+    uint8_t buffer[16384];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), file)) != 0)
+    {
+        build_id = crc32_update(build_id, buffer, count);
+    }
+    fclose(file);
+    return build_id;
+}
+
+
+static void state_all(struct state* state)
+{
+    cpu_state(state);
+    ppu_state(state);
+    apu_state(state);
+    clock_state(state);
+    io_state(state);
+    nrom_state(state);
+}
+
+
+size_t state_size()
+{
+    static size_t size = 0;
+    if (size == 0)
+    {
+        struct state state = { .mode = STATE_MEASURE, .data = NULL, .pos = sizeof(struct state_header) };
+        state_all(&state);
+        size = state.pos;
+    }
+    return size;
+}
+
+
+bool state_save(void* buffer, size_t size)
+{
+    if (size < state_size())
+        return false;
+
+    struct state_header header = {
+        .version = STATE_VERSION,
+        .size = state_size(),
+        .build_id = state_build_id(),
+        .core = emu_core_id,
+    };
+    memcpy(header.magic, state_magic, sizeof(state_magic));
+    memcpy(buffer, &header, sizeof(header));
+
+    struct state state = { .mode = STATE_SAVE, .data = buffer, .pos = sizeof(header) };
+    state_all(&state);
+    return true;
+}
+
+
+bool state_load(const void* buffer, size_t size)
+{
+    struct state_header header;
+    if (size < sizeof(header))
+        return false;
+    memcpy(&header, buffer, sizeof(header));
+    if (memcmp(header.magic, state_magic, sizeof(state_magic)) != 0 || header.version != STATE_VERSION ||
+        header.size != state_size() || header.build_id != state_build_id() || header.core != emu_core_id ||
+        size < state_size())
+    {
+        return false;
+    }
+
+    // Loading only reads from data
+    struct state state = { .mode = STATE_LOAD, .data = (uint8_t*) buffer, .pos = sizeof(header) };
+    state_all(&state);
+    return true;
+}
@@ -0,0 +1,68 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Save states.
+//
+// Every module with emulation state has a <module>_state(struct state*) function that passes each of its state
+// variables to STATE_FIELD. The same function measures, saves or loads the state depending on the mode, so a variable
+// can't be saved without also being loaded.
+//
+// A save state holds the resume points of the CPU/PPU state machines and the scheduler's event handlers, which are code
+// addresses. They are saved relative to this build's code (STATE_CODE_POINTER), so states can be exchanged between
+// runs of the same build, wherever it gets loaded; the header records which build that is. The PPU's resume point is
+// a label in the emulation core that saved it (see emu_select_core()), so the header records the core as well.
+//
+
+#ifndef NES_EMULATOR_STATE_H
+#define NES_EMULATOR_STATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+enum state_mode
+{
+    STATE_MEASURE,
+    STATE_SAVE,
+    STATE_LOAD,
+};
+
+struct state
+{
+    enum state_mode mode;
+    uint8_t* data;  /// NULL when measuring
+    size_t pos;
+};
+
+void state_field(struct state* state, void* field, size_t size);
+
+#define STATE_FIELD(state, field) state_field(state, &(field), sizeof(field))
+
+void state_code_pointer(struct state* state, void* field);
+
+/// For a resume point or function pointer field: saved as an offset into this build's code, NULL as NULL
+#define STATE_CODE_POINTER(state, field) do { \
+    _Static_assert(sizeof(field) == sizeof(uintptr_t), "not a code pointer"); \
+    state_code_pointer(state, &(field)); \
+} while (0)
+
+/// Size of a save state in bytes. Constant for a given build.
+size_t state_size();
+
+/**
+ * Saves the state of the running system.
+ *
+ * @return false if buffer is smaller than state_size().
+ */
+bool state_save(void* buffer, size_t size);
+
+/**
+ * Restores a state saved with state_save(). The cartridge must already be loaded. The framebuffer is not part of the
+ * state and is redrawn by the next frame.
+ *
+ * @return false, leaving the running system untouched, if buffer does not hold a state from this build and the core
+ *         selected now.
+ */
+bool state_load(const void* buffer, size_t size);
+
+#endif //NES_EMULATOR_STATE_H
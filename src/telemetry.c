@@ -0,0 +1,157 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "telemetry.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+struct telemetry_event
+{
+    uint64_t start_ns;
+    uint32_t duration_ns;  /// Value, for counters
+    uint32_t frame;
+    uint8_t span;
+};
+
+struct telemetry_thread
+{
+    char name[32];
+    struct telemetry_event* events;
+    size_t count;  /// Recorded so far; the ring holds the last capacity of them
+};
+
+static const char* const telemetry_span_names[NUM_TELEMETRY_SPANS] = {
+    [TELEMETRY_INPUT_POLL] = "input poll",
+    [TELEMETRY_EMULATE] = "emulate",
+    [TELEMETRY_RENDER] = "render",
+    [TELEMETRY_PUBLISH] = "publish",
+    [TELEMETRY_CONVERT] = "convert",
+    [TELEMETRY_DUMP] = "dump",
+    [TELEMETRY_WAIT_RENDER] = "wait for render thread",
+    [TELEMETRY_WAIT_WORK] = "wait for frame to render",
+    [TELEMETRY_WAIT_FRAME] = "wait for frame",
+    [TELEMETRY_WAIT_DUMP] = "wait for video dump",
+    [TELEMETRY_DMA_STALL] = "DMA stall cycles",
+};
+
+bool telemetry_enabled = false;
+uint64_t telemetry_dma_stall_cycles = 0;
+
+static size_t telemetry_capacity = 0;
+static uint64_t telemetry_start_ns = 0;
+static struct telemetry_thread telemetry_threads[TELEMETRY_MAX_THREADS];
+static atomic_size_t telemetry_num_threads = 0;
+static _Thread_local struct telemetry_thread* telemetry_this_thread = NULL;
+static _Thread_local bool telemetry_thread_dropped = false;
+
+
+void telemetry_start(size_t capacity)
+{
+    telemetry_capacity = capacity;
+    telemetry_start_ns = clock_now_ns();
+    telemetry_enabled = true;
+}
+
+
+void telemetry_name_thread(const char* name)
+{
+    if (!telemetry_enabled || telemetry_this_thread != NULL || telemetry_thread_dropped)
+        return;
+    size_t index = atomic_fetch_add(&telemetry_num_threads, 1);
+    struct telemetry_event* events = index < TELEMETRY_MAX_THREADS
+                                     ? malloc(telemetry_capacity * sizeof(struct telemetry_event)) : NULL;
+    if (events == NULL)
+    {
+        telemetry_thread_dropped = true;
+        return;
+    }
+    // Touch the buffer now rather than take page faults while recording
+    memset(events, 0, telemetry_capacity * sizeof(struct telemetry_event));
+
+    struct telemetry_thread* thread = &telemetry_threads[index];
+    if (name != NULL)
+        snprintf(thread->name, sizeof(thread->name), "%s", name);
+    else
+        snprintf(thread->name, sizeof(thread->name), "thread %zu", index);
+    thread->count = 0;
+    thread->events = events;
+    telemetry_this_thread = thread;
+}
+
+
+static void telemetry_record(enum telemetry_span span, uint64_t start_ns, uint64_t duration_ns, uint64_t frame)
+{
+    if (telemetry_this_thread == NULL)
+    {
+        telemetry_name_thread(NULL);
+        if (telemetry_this_thread == NULL)
+            return;
+    }
+    struct telemetry_thread* thread = telemetry_this_thread;
+    struct telemetry_event* event = &thread->events[thread->count++ % telemetry_capacity];
+    event->start_ns = start_ns;
+    event->duration_ns = duration_ns > UINT32_MAX ? UINT32_MAX : (uint32_t) duration_ns;
+    event->frame = (uint32_t) frame;
+    event->span = span;
+}
+
+
+void telemetry_end(enum telemetry_span span, uint64_t begin_ns, uint64_t frame)
+{
+    if (!telemetry_enabled)
+        return;
+    telemetry_record(span, begin_ns, clock_now_ns() - begin_ns, frame);
+}
+
+
+void telemetry_count(enum telemetry_span counter, uint64_t value)
+{
+    if (!telemetry_enabled)
+        return;
+    telemetry_record(counter, clock_now_ns(), value, 0);
+}
+
+
+bool telemetry_write(const char* file_path)
+{
+    FILE* file = fopen(file_path, "w");
+    if (file == NULL)
+        return false;
+
+    // Timestamps are in microseconds from telemetry_start(); pid is the process, tid the recording thread
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"nes_emulator\"}}");
+    size_t num_threads = atomic_load(&telemetry_num_threads);
+    for (size_t t = 0; t < num_threads && t < TELEMETRY_MAX_THREADS; ++t)
+    {
+        const struct telemetry_thread* thread = &telemetry_threads[t];
+        if (thread->events == NULL)
+            continue;
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"%s\"}}",
+                t, thread->name);
+
+        size_t first = thread->count > telemetry_capacity ? thread->count - telemetry_capacity : 0;
+        for (size_t i = first; i < thread->count; ++i)
+        {
+            const struct telemetry_event* event = &thread->events[i % telemetry_capacity];
+            double ts_us = (event->start_ns - telemetry_start_ns) / 1e3;
+            const char* name = telemetry_span_names[event->span];
+            if (event->span == TELEMETRY_DMA_STALL)
+            {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%zu,"
+                              "\"args\":{\"cycles\":%u}}", name, ts_us, t, event->duration_ns);
+            }
+            else
+            {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu,"
+                              "\"args\":{\"frame\":%u}}", name, ts_us, event->duration_ns / 1e3, t, event->frame);
+            }
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
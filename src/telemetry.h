@@ -0,0 +1,83 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Frame timing telemetry. When enabled, each thread records what it spends its time on (emulating, rendering,
+// publishing, converting, waiting on another thread) as timed spans in a ring buffer of its own, allocated up front,
+// so recording is a clock read and a store. At exit the buffers are written as Chrome trace-event JSON, which
+// Perfetto (ui.perfetto.dev) and chrome://tracing display as a timeline per thread.
+//
+// CPU and PPU advance together cycle by cycle, so their time is one "emulate" span; with --parallel-ppu the drawing
+// part of the PPU shows up separately on the render thread. DMA doesn't take time of its own either: it stalls the
+// CPU while the PPU goes on, so it is recorded as a per-frame counter of stalled CPU cycles.
+//
+
+#ifndef NES_EMULATOR_TELEMETRY_H
+#define NES_EMULATOR_TELEMETRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "clock.h"
+
+/// Spans kept per thread; older ones are overwritten. A quarter of an hour of frames at the default.
+#define TELEMETRY_DEFAULT_CAPACITY (1u << 18)
+#define TELEMETRY_MAX_THREADS 8
+
+enum telemetry_span
+{
+    TELEMETRY_INPUT_POLL,
+    TELEMETRY_EMULATE,       /// CPU and PPU running one frame
+    TELEMETRY_RENDER,        /// Render thread drawing a frame
+    TELEMETRY_PUBLISH,       /// Copying a frame to the outputs
+    TELEMETRY_CONVERT,       /// Presentation converting a frame to RGB
+    TELEMETRY_WAIT_RENDER,   /// Emulation thread waiting for the render thread to take the next frame
+    TELEMETRY_WAIT_WORK,     /// Render thread waiting for a frame to draw
+    TELEMETRY_WAIT_FRAME,    /// Presentation waiting for a new frame
+    TELEMETRY_DUMP,          /// Video dump converting and writing a frame
+    TELEMETRY_WAIT_DUMP,     /// Publishing thread waiting for room in the video dump's queue
+    TELEMETRY_DMA_STALL,     /// Counter: CPU cycles stalled by DMA during a frame
+    NUM_TELEMETRY_SPANS
+};
+
+extern bool telemetry_enabled;
+
+/// CPU cycles stalled by DMA since the last TELEMETRY_DMA_STALL counter was recorded
+extern uint64_t telemetry_dma_stall_cycles;
+
+/**
+ * Allocates the buffers and turns recording on.
+ *
+ * @param capacity Spans kept per thread.
+ */
+void telemetry_start(size_t capacity);
+
+/**
+ * Names the calling thread in the trace and allocates its buffer, which otherwise happens on its first span. Threads
+ * beyond TELEMETRY_MAX_THREADS aren't recorded.
+ */
+void telemetry_name_thread(const char* name);
+
+/// Start time of a span, or 0 when telemetry is off
+static inline uint64_t telemetry_begin()
+{
+    return telemetry_enabled ? clock_now_ns() : 0;
+}
+
+/**
+ * Records a span that began at begin_ns (from telemetry_begin()) and ends now.
+ *
+ * @param frame Frame number the span worked on, shown with it.
+ */
+void telemetry_end(enum telemetry_span span, uint64_t begin_ns, uint64_t frame);
+
+/// Records a counter value at the current time
+void telemetry_count(enum telemetry_span counter, uint64_t value);
+
+/**
+ * Writes everything recorded as Chrome trace-event JSON. Call once the recording threads are done.
+ *
+ * @return false if the file could not be written.
+ */
+bool telemetry_write(const char* file_path);
+
+#endif //NES_EMULATOR_TELEMETRY_H
@@ -0,0 +1,43 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "triple_buffer.h"
+#include <string.h>
+
+#define TRIPLE_BUFFER_INDEX_MASK 0x03
+#define TRIPLE_BUFFER_FRESH 0x04
+
+
+void triple_buffer_init(struct triple_buffer* tb)
+{
+    memset(tb->buffers, 0, sizeof(tb->buffers));
+    tb->back = 0;
+    tb->front = 1;
+    atomic_init(&tb->parked, 2);
+}
+
+
+struct frame* triple_buffer_back(struct triple_buffer* tb)
+{
+    return &tb->buffers[tb->back];
+}
+
+
+void triple_buffer_publish(struct triple_buffer* tb)
+{
+    // Release: consumer must see the frame contents once it sees the fresh bit
+    uint_fast8_t prev = atomic_exchange_explicit(&tb->parked, tb->back | TRIPLE_BUFFER_FRESH, memory_order_acq_rel);
+    tb->back = prev & TRIPLE_BUFFER_INDEX_MASK;
+}
+
+
+const struct frame* triple_buffer_acquire(struct triple_buffer* tb)
+{
+    if (!(atomic_load_explicit(&tb->parked, memory_order_relaxed) & TRIPLE_BUFFER_FRESH))
+        return NULL;
+
+    uint_fast8_t prev = atomic_exchange_explicit(&tb->parked, tb->front, memory_order_acq_rel);
+    tb->front = prev & TRIPLE_BUFFER_INDEX_MASK;
+    return &tb->buffers[tb->front];
+}
@@ -0,0 +1,52 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Lock-free single-producer single-consumer triple buffer of frames.
+//
+// The producer always owns one buffer (back), the consumer always owns one buffer (front), and the third is parked
+// in a shared slot. Publishing swaps back with the parked buffer and acquiring swaps front with it, so neither side
+// ever waits on the other; the consumer simply sees the newest published frame and older ones get overwritten.
+//
+
+#ifndef NES_EMULATOR_TRIPLE_BUFFER_H
+#define NES_EMULATOR_TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include "frame.h"
+
+struct triple_buffer
+{
+    struct frame buffers[3];
+
+    /// Index of the parked buffer, OR'd with TRIPLE_BUFFER_FRESH if it holds a frame the consumer hasn't seen yet
+    atomic_uint_fast8_t parked;
+
+    /// Producer-owned
+    uint8_t back;
+
+    /// Consumer-owned
+    uint8_t front;
+};
+
+void triple_buffer_init(struct triple_buffer* tb);
+
+/**
+ * Producer side. The buffer to render the next frame into. Stays valid until triple_buffer_publish().
+ */
+struct frame* triple_buffer_back(struct triple_buffer* tb);
+
+/**
+ * Producer side. Makes the back buffer visible to the consumer and hands the producer a new back buffer.
+ */
+void triple_buffer_publish(struct triple_buffer* tb);
+
+/**
+ * Consumer side. Takes the most recently published frame.
+ *
+ * @return The new frame, or NULL if nothing has been published since the last call. The frame stays valid until the
+ * next call that returns non-NULL.
+ */
+const struct frame* triple_buffer_acquire(struct triple_buffer* tb);
+
+#endif //NES_EMULATOR_TRIPLE_BUFFER_H
@@ -3,6 +3,10 @@
 //
 
 #include "utils.h"
+#include <pthread.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 void set_low_byte(uint16_t* u16, uint8_t u8)
 {
@@ -28,3 +32,108 @@ uint8_t get_high_byte(uint16_t u16)
 {
     return (uint8_t) (u16 >> 8);
 }
+
+
+#define CRC32_POLYNOMIAL 0xEDB88320  // reversed
+
+static uint32_t crc32_table[256];
+static pthread_once_t crc32_table_once = PTHREAD_ONCE_INIT;
+
+
+static void crc32_init_table()
+{
+    for (uint32_t i = 0; i < 256; ++i)
+    {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32_POLYNOMIAL : crc >> 1;
+        }
+        crc32_table[i] = crc;
+    }
+}
+
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CRC32_CLMUL_MIN_SIZE 64
+
+/**
+ * CRC-32 of a multiple of 16 bytes (at least 64), from and to the inverted register value, by folding with carry-less
+ * multiplication: four 128-bit lanes are folded forward 64 bytes at a time, then into one, which is reduced to 32 bits
+ * (Barrett). The constants are powers of x modulo the polynomial, bit-reflected, from Intel's "Fast CRC Computation
+ * for Generic Polynomials Using PCLMULQDQ Instruction".
+ */
+__attribute__((target("pclmul,sse2")))
+static uint32_t crc32_clmul(uint32_t crc, const uint8_t* data, size_t size)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*) (data + 0x00)), _mm_cvtsi32_si128((int) crc));
+    __m128i x2 = _mm_loadu_si128((const __m128i*) (data + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i*) (data + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i*) (data + 0x30));
+    data += 64;
+    size -= 64;
+
+    while (size >= 64)
+    {
+        __m128i f1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k1k2, 0x00), _mm_clmulepi64_si128(x1, k1k2, 0x11));
+        __m128i f2 = _mm_xor_si128(_mm_clmulepi64_si128(x2, k1k2, 0x00), _mm_clmulepi64_si128(x2, k1k2, 0x11));
+        __m128i f3 = _mm_xor_si128(_mm_clmulepi64_si128(x3, k1k2, 0x00), _mm_clmulepi64_si128(x3, k1k2, 0x11));
+        __m128i f4 = _mm_xor_si128(_mm_clmulepi64_si128(x4, k1k2, 0x00), _mm_clmulepi64_si128(x4, k1k2, 0x11));
+        x1 = _mm_xor_si128(f1, _mm_loadu_si128((const __m128i*) (data + 0x00)));
+        x2 = _mm_xor_si128(f2, _mm_loadu_si128((const __m128i*) (data + 0x10)));
+        x3 = _mm_xor_si128(f3, _mm_loadu_si128((const __m128i*) (data + 0x20)));
+        x4 = _mm_xor_si128(f4, _mm_loadu_si128((const __m128i*) (data + 0x30)));
+        data += 64;
+        size -= 64;
+    }
+
+    // Four lanes into one, then the remaining 16-byte blocks into it
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x2);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x3);
+    x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)), x4);
+    for (; size >= 16; data += 16, size -= 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i*) data);
+        x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x00), _mm_clmulepi64_si128(x1, k3k4, 0x11)),
+                           block);
+    }
+
+    // 128 bits to 64
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00), _mm_srli_si128(x1, 4));
+
+    // Barrett reduction to 32
+    __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), poly, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, t);
+    return (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+}
+#endif
+
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size)
+{
+    pthread_once(&crc32_table_once, crc32_init_table);
+
+    crc = ~crc;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (size >= CRC32_CLMUL_MIN_SIZE && __builtin_cpu_supports("pclmul"))
+    {
+        size_t blocks_size = size & ~(size_t) 15;
+        crc = crc32_clmul(crc, data, blocks_size);
+        data += blocks_size;
+        size -= blocks_size;
+    }
+#endif
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
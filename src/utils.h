@@ -3,6 +3,7 @@
 //
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifndef NES_EMULATOR_UTILS_H
 #define NES_EMULATOR_UTILS_H
@@ -17,4 +18,10 @@ void set_high_byte(uint16_t* u16, uint8_t u8);
 uint8_t get_low_byte(uint16_t u16);
 uint8_t get_high_byte(uint16_t u16);
 
+/**
+ * CRC-32 (IEEE 802.3, as used by zip and ROM databases). Pass 0 to start; pass the previous result to continue over
+ * more data.
+ */
+uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t size);
+
 #endif //NES_EMULATOR_UTILS_H
@@ -0,0 +1,339 @@
+//
+// Created by quate on 10/19/2026.
+//
+
+#include "video_dump.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "screen.h"
+#include "telemetry.h"
+#include "exit_codes.h"
+
+#define VIDEO_DUMP_INDEX_MASK (VIDEO_DUMP_QUEUE_SIZE - 1)
+
+/// Output buffer of each file; a few frames, so that the writer makes few large writes
+#define VIDEO_DUMP_FILE_BUFFER_SIZE (1 << 20)
+
+#define WAV_HEADER_SIZE 44
+#define WAV_BYTES_PER_SAMPLE 2
+/// Size fields of a WAV header that can't be patched afterwards, as in a pipe: "unknown", which readers take as "to
+/// the end of the stream"
+#define WAV_UNKNOWN_SIZE 0xFFFFFFFF
+
+
+/**
+ * Opens a file for writing, or standard output for "-", or a pipe into a command for "|command".
+ */
+static FILE* open_output(const char* path, bool* is_pipe)
+{
+    *is_pipe = path[0] == '|';
+    FILE* file;
+    if (strcmp(path, "-") == 0)
+        file = stdout;
+    else if (*is_pipe)
+        file = popen(path + 1, "w");
+    else
+        file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Could not open dump output: %s", path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    setvbuf(file, NULL, _IOFBF, VIDEO_DUMP_FILE_BUFFER_SIZE);
+    return file;
+}
+
+static bool close_output(FILE* file, bool is_pipe)
+{
+    if (file == NULL)
+        return true;
+    bool ok = fflush(file) == 0 && !ferror(file);
+    if (is_pipe)
+        ok = pclose(file) == 0 && ok;
+    else if (file != stdout)
+        ok = fclose(file) == 0 && ok;
+    return ok;
+}
+
+
+static void put_u16(uint8_t* bytes, uint16_t value)
+{
+    bytes[0] = (uint8_t) value;
+    bytes[1] = (uint8_t) (value >> 8);
+}
+
+static void put_u32(uint8_t* bytes, uint32_t value)
+{
+    put_u16(bytes, (uint16_t) value);
+    put_u16(bytes + 2, (uint16_t) (value >> 16));
+}
+
+/**
+ * 16-bit mono PCM header. The sizes are those of `data_size` bytes of samples, or WAV_UNKNOWN_SIZE.
+ */
+static void write_wav_header(FILE* file, uint32_t data_size)
+{
+    uint8_t header[WAV_HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    put_u32(header + 4, data_size == WAV_UNKNOWN_SIZE ? WAV_UNKNOWN_SIZE : data_size + WAV_HEADER_SIZE - 8);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_u32(header + 16, 16);  // fmt chunk size
+    put_u16(header + 20, 1);   // PCM
+    put_u16(header + 22, 1);   // channels
+    put_u32(header + 24, VIDEO_DUMP_AUDIO_RATE);
+    put_u32(header + 28, VIDEO_DUMP_AUDIO_RATE * WAV_BYTES_PER_SAMPLE);
+    put_u16(header + 32, WAV_BYTES_PER_SAMPLE);
+    put_u16(header + 34, 8 * WAV_BYTES_PER_SAMPLE);
+    memcpy(header + 36, "data", 4);
+    put_u32(header + 40, data_size);
+    fwrite(header, sizeof(header), 1, file);
+}
+
+
+static size_t converted_size(enum video_dump_format format)
+{
+    return format == VIDEO_DUMP_Y4M ? SCREEN_YUV420_SIZE : SCREEN_RGB24_SIZE;
+}
+
+/// Audio samples from the first frame to the start of the given one; per frame, that is about 733.8
+static uint64_t audio_samples_before(uint64_t frame_index)
+{
+    return frame_index * VIDEO_DUMP_AUDIO_RATE * SCREEN_FPS_DENOMINATOR / SCREEN_FPS_NUMERATOR;
+}
+
+static void write_frame(struct video_dump* dump, const struct video_dump_slot* slot)
+{
+    if (dump->frames == 0)
+        dump->first_frame_number = slot->frame.frame_number;
+    uint64_t frame_index = slot->frame.frame_number - dump->first_frame_number;
+    dump->frames++;
+
+    if (!slot->repeat)
+    {
+        if (dump->format == VIDEO_DUMP_Y4M)
+            screen_convert_frame_yuv420(&slot->frame, dump->converted);
+        else
+            screen_convert_frame_rgb24(&slot->frame, dump->converted);
+    }
+    else
+    {
+        dump->repeats++;
+    }
+
+    if (!slot->repeat || dump->timestamps == NULL)
+    {
+        if (dump->format == VIDEO_DUMP_Y4M)
+            fputs("FRAME\n", dump->video);
+        fwrite(dump->converted, converted_size(dump->format), 1, dump->video);
+        if (dump->timestamps != NULL)
+        {
+            fprintf(dump->timestamps, "%.3f\n",
+                    frame_index * 1000.0 * SCREEN_FPS_DENOMINATOR / SCREEN_FPS_NUMERATOR);
+        }
+    }
+
+    if (dump->audio != NULL)
+    {
+        static const int16_t silence[1024];
+        uint64_t samples = audio_samples_before(frame_index + 1) - dump->audio_samples;
+        while (samples != 0)
+        {
+            size_t chunk = samples < 1024 ? samples : 1024;
+            fwrite(silence, WAV_BYTES_PER_SAMPLE, chunk, dump->audio);
+            samples -= chunk;
+            dump->audio_samples += chunk;
+        }
+    }
+
+    if (ferror(dump->video) || (dump->audio != NULL && ferror(dump->audio)))
+        dump->failed = true;
+}
+
+
+/**
+ * Sleeps until `index` no longer has the given value, or the dump is closing.
+ *
+ * The waiting flag is set before index is looked at again, and the other side moves index before it looks at the
+ * flag, both sequentially consistent, so at least one of them sees the other's store: either this side doesn't go to
+ * sleep, or the other side wakes it up, which it can only do once this side waits, as it needs the mutex for that.
+ */
+static void wait_while(struct video_dump* dump, _Atomic uint64_t* index, uint64_t value, atomic_bool* waiting,
+                       pthread_cond_t* wakeup)
+{
+    pthread_mutex_lock(&dump->mutex);
+    atomic_store(waiting, true);
+    while (atomic_load(index) == value && !atomic_load(&dump->closing))
+        pthread_cond_wait(wakeup, &dump->mutex);
+    atomic_store(waiting, false);
+    pthread_mutex_unlock(&dump->mutex);
+}
+
+/// Wakes the other side if it waits for the index just moved; a load and nothing more while it doesn't
+static void wake(struct video_dump* dump, atomic_bool* waiting, pthread_cond_t* wakeup)
+{
+    if (!atomic_load(waiting))
+        return;
+    pthread_mutex_lock(&dump->mutex);
+    pthread_cond_signal(wakeup);
+    pthread_mutex_unlock(&dump->mutex);
+}
+
+
+static void* video_dump_main(void* arg)
+{
+    struct video_dump* dump = arg;
+    telemetry_name_thread("video dump");
+    uint64_t tail = atomic_load_explicit(&dump->tail, memory_order_relaxed);
+    while (1)
+    {
+        // Acquire: the slot's contents are visible once head says it's there
+        uint64_t head = atomic_load_explicit(&dump->head, memory_order_acquire);
+        if (tail == head)
+        {
+            // The producer is done before closing is set, so head is final from then on
+            if (atomic_load(&dump->closing) && atomic_load(&dump->head) == tail)
+                break;
+            wait_while(dump, &dump->head, tail, &dump->writer_waiting, &dump->writer_wakeup);
+            continue;
+        }
+
+        for (; tail != head; ++tail)
+        {
+            const struct video_dump_slot* slot = &dump->slots[tail & VIDEO_DUMP_INDEX_MASK];
+            uint64_t begin_ns = telemetry_begin();
+            if (!dump->failed)
+                write_frame(dump, slot);
+            telemetry_end(TELEMETRY_DUMP, begin_ns, slot->frame.frame_number);
+            // The producer may only reuse the slot once it's written; sequentially consistent for wait_while()
+            atomic_store(&dump->tail, tail + 1);
+            wake(dump, &dump->producer_waiting, &dump->producer_wakeup);
+        }
+    }
+    return NULL;
+}
+
+
+void video_dump_open(struct video_dump* dump, const char* video_path, enum video_dump_format format,
+                     const char* timestamps_path, const char* audio_path)
+{
+    dump->format = format;
+    dump->converted = calloc(1, converted_size(format));
+    if (dump->converted == NULL)
+    {
+        fprintf(stderr, "Out of memory for dump frame");
+        exit(ERROR_CODE__OH_NO);
+    }
+
+    // A broken pipe shows up as a failed write, rather than killing the emulator halfway through a batch
+    if (video_path[0] == '|' || (audio_path != NULL && audio_path[0] == '|'))
+        signal(SIGPIPE, SIG_IGN);
+
+    dump->video = open_output(video_path, &dump->video_is_pipe);
+    if (format == VIDEO_DUMP_Y4M)
+    {
+        fprintf(dump->video, "YUV4MPEG2 W%d H%d F%d:%d Ip A8:7 C420jpeg\n", FRAME_WIDTH, FRAME_HEIGHT,
+                SCREEN_FPS_NUMERATOR, SCREEN_FPS_DENOMINATOR);
+    }
+
+    dump->timestamps = NULL;
+    if (timestamps_path != NULL)
+    {
+        dump->timestamps = fopen(timestamps_path, "w");
+        if (dump->timestamps == NULL)
+        {
+            fprintf(stderr, "Could not open timestamps file: %s", timestamps_path);
+            exit(ERROR_CODE__INVALID_FILE);
+        }
+        fputs("# timestamp format v2\n", dump->timestamps);
+    }
+
+    dump->audio = NULL;
+    if (audio_path != NULL)
+    {
+        dump->audio = open_output(audio_path, &dump->audio_is_pipe);
+        write_wav_header(dump->audio, WAV_UNKNOWN_SIZE);
+    }
+
+    atomic_init(&dump->head, 0);
+    atomic_init(&dump->tail, 0);
+    atomic_init(&dump->closing, false);
+    atomic_init(&dump->writer_waiting, false);
+    atomic_init(&dump->producer_waiting, false);
+    pthread_mutex_init(&dump->mutex, NULL);
+    pthread_cond_init(&dump->writer_wakeup, NULL);
+    pthread_cond_init(&dump->producer_wakeup, NULL);
+    dump->has_last = false;
+    dump->producer_waits = 0;
+    dump->frames = 0;
+    dump->repeats = 0;
+    dump->audio_samples = 0;
+    dump->failed = false;
+    if (pthread_create(&dump->thread, NULL, video_dump_main, dump) != 0)
+    {
+        fprintf(stderr, "Could not start video dump thread");
+        exit(ERROR_CODE__OH_NO);
+    }
+}
+
+
+void video_dump_frame(struct video_dump* dump, uint64_t frame_number, const uint8_t (*pixels)[FRAME_WIDTH],
+                      const uint64_t* row_hashes)
+{
+    uint64_t head = atomic_load_explicit(&dump->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&dump->tail, memory_order_acquire) == VIDEO_DUMP_QUEUE_SIZE)
+    {
+        uint64_t begin_ns = telemetry_begin();
+        wait_while(dump, &dump->tail, head - VIDEO_DUMP_QUEUE_SIZE, &dump->producer_waiting,
+                   &dump->producer_wakeup);
+        telemetry_end(TELEMETRY_WAIT_DUMP, begin_ns, frame_number);
+        dump->producer_waits++;
+    }
+
+    struct video_dump_slot* slot = &dump->slots[head & VIDEO_DUMP_INDEX_MASK];
+    slot->frame.frame_number = frame_number;
+    slot->repeat = dump->has_last && memcmp(dump->last_row_hashes, row_hashes, sizeof(dump->last_row_hashes)) == 0;
+    if (!slot->repeat)
+    {
+        memcpy(slot->frame.pixels, pixels, sizeof(slot->frame.pixels));
+        memcpy(dump->last_row_hashes, row_hashes, sizeof(dump->last_row_hashes));
+        dump->has_last = true;
+    }
+    // The writer may only read the slot once it's filled in; sequentially consistent for wait_while()
+    atomic_store(&dump->head, head + 1);
+    wake(dump, &dump->writer_waiting, &dump->writer_wakeup);
+}
+
+
+bool video_dump_close(struct video_dump* dump)
+{
+    if (dump->video == NULL)
+        return true;
+
+    atomic_store(&dump->closing, true);
+    pthread_mutex_lock(&dump->mutex);
+    pthread_cond_signal(&dump->writer_wakeup);
+    pthread_mutex_unlock(&dump->mutex);
+    pthread_join(dump->thread, NULL);
+    pthread_cond_destroy(&dump->producer_wakeup);
+    pthread_cond_destroy(&dump->writer_wakeup);
+    pthread_mutex_destroy(&dump->mutex);
+
+    bool ok = !dump->failed;
+    if (dump->audio != NULL && !dump->audio_is_pipe && dump->audio != stdout && !dump->failed)
+    {
+        // A file can have its real sizes filled in; a pipe keeps the "unknown" ones
+        uint64_t data_size = dump->audio_samples * WAV_BYTES_PER_SAMPLE;
+        if (data_size <= UINT32_MAX - WAV_HEADER_SIZE && fseek(dump->audio, 0, SEEK_SET) == 0)
+            write_wav_header(dump->audio, (uint32_t) data_size);
+    }
+    ok = close_output(dump->audio, dump->audio_is_pipe) && ok;
+    ok = close_output(dump->timestamps, false) && ok;
+    ok = close_output(dump->video, dump->video_is_pipe) && ok;
+    free(dump->converted);
+    dump->video = NULL;
+    dump->audio = NULL;
+    dump->timestamps = NULL;
+    dump->converted = NULL;
+    return ok;
+}
@@ -0,0 +1,113 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Recording of the emulator's output for external encoders: video as YUV4MPEG2 or raw 24-bit RGB, audio as WAV, to
+// files, standard output or a pipe into a command.
+//
+// The thread that publishes frames only copies each one into a bounded single-producer single-consumer ring. A writer
+// thread of the dump's own converts and writes them, so emulation runs uncapped as long as the disk, or the encoder at
+// the other end of the pipe, keeps up. When the ring is full the publishing thread waits: a dump never drops frames.
+// The ring's indices are lock-free; a side only takes the mutex to sleep on an empty (writer) or full (publisher) ring,
+// or to wake the other side up from that.
+//
+// Games often show the same picture for many frames in a row. A frame whose row hashes all match those of the frame
+// before is queued as a repeat, without its pixels, and the writer either writes the bytes it converted last again
+// (Y4M and raw RGB stay constant frame rate), or, with a timestamps file, leaves the frame out of the video and lists
+// the display time of each frame it does write instead, in Matroska timestamp format v2 (mkvmerge --timestamps).
+//
+// The APU doesn't synthesize audio yet, so the WAV track is silence as long as the video, which keeps muxers and
+// players in sync.
+//
+
+#ifndef NES_EMULATOR_VIDEO_DUMP_H
+#define NES_EMULATOR_VIDEO_DUMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "frame.h"
+
+/// Frames the ring holds; a power of two
+#define VIDEO_DUMP_QUEUE_SIZE 32
+
+#define VIDEO_DUMP_AUDIO_RATE 44100
+
+enum video_dump_format
+{
+    VIDEO_DUMP_Y4M,    /// YUV4MPEG2, 4:2:0 (C420jpeg), NTSC frame rate and 8:7 pixel aspect ratio in the header
+    VIDEO_DUMP_RGB24,  /// Headerless frames of FRAME_WIDTH * FRAME_HEIGHT pixels, three bytes (R, G, B) each
+};
+
+struct video_dump_slot
+{
+    bool repeat;         /// Same picture as the frame before; only frame.frame_number is filled in
+    struct frame frame;
+};
+
+struct video_dump
+{
+    enum video_dump_format format;
+    FILE* video;         /// NULL when not open
+    FILE* timestamps;    /// NULL to write repeats in full
+    FILE* audio;         /// NULL for no audio
+    bool video_is_pipe;
+    bool audio_is_pipe;
+
+    struct video_dump_slot slots[VIDEO_DUMP_QUEUE_SIZE];
+    _Atomic uint64_t head;  /// Frames queued so far; only the producer writes it
+    _Atomic uint64_t tail;  /// Frames written so far; only the writer thread writes it
+    atomic_bool closing;
+
+    /// Sleeping on an empty or full ring
+    pthread_mutex_t mutex;
+    pthread_cond_t writer_wakeup;
+    pthread_cond_t producer_wakeup;
+    atomic_bool writer_waiting;    /// The writer is asleep, or about to be, until head moves
+    atomic_bool producer_waiting;  /// The producer is asleep, or about to be, until tail moves
+
+    /// Producer-owned
+    uint64_t last_row_hashes[FRAME_HEIGHT];
+    bool has_last;
+    uint64_t producer_waits;  /// Frames that found the ring full
+
+    /// Writer-owned
+    pthread_t thread;
+    uint8_t* converted;       /// The last frame that wasn't a repeat, in the output format
+    uint64_t first_frame_number;
+    uint64_t frames;          /// Frames dumped, repeats included
+    uint64_t repeats;
+    uint64_t audio_samples;
+    bool failed;              /// A write failed, e.g. the encoder exited; the rest is discarded
+};
+
+/**
+ * Opens the outputs and starts the writer thread. Exits on failure.
+ *
+ * @param video_path File to write the video to, "-" for standard output, or "|command" to pipe it into a shell command
+ * @param timestamps_path NULL to write repeated frames in full, or a file to list the display times of the frames
+ *                        written in, leaving repeats out
+ * @param audio_path Like video_path, or NULL for no audio
+ */
+void video_dump_open(struct video_dump* dump, const char* video_path, enum video_dump_format format,
+                     const char* timestamps_path, const char* audio_path);
+
+/**
+ * Queues a frame. Call from one thread at a time, for every frame in order; waits while the ring is full.
+ *
+ * @param pixels The frame, FRAME_HEIGHT rows of FRAME_WIDTH palette indices
+ * @param row_hashes Their ppu_row_hashes
+ */
+void video_dump_frame(struct video_dump* dump, uint64_t frame_number, const uint8_t (*pixels)[FRAME_WIDTH],
+                      const uint64_t* row_hashes);
+
+/**
+ * Writes out the frames still queued, finishes and closes the outputs, and stops the writer thread. The counters keep
+ * their values. Does nothing if the dump isn't open.
+ *
+ * @return false if a write failed along the way
+ */
+bool video_dump_close(struct video_dump* dump);
+
+#endif //NES_EMULATOR_VIDEO_DUMP_H
@@ -0,0 +1,472 @@
+//
+// Created by quate on 10/19/2026.
+//
+// Test ROM conformance farm. Runs every .nes file under a directory, each in its own forked process (the core keeps
+// its state in globals), several at a time, and reports pass/fail, the result text and emulation speed per ROM.
+//
+// Usage: nes_testfarm DIR [--jobs N] [--max-frames N] [--stable-frames N] [--perf]
+//
+// ROMs that follow the blargg test protocol are judged by it: once 0x6001-0x6003 hold DE B0 61, 0x6000 is the status
+// (0x80 running, 0x81 reset requested, below 0x80 done with that result code, 0 meaning passed) and 0x6004 on holds
+// the result text. A reset request is answered the way the protocol asks, by pressing reset TEST_RESET_DELAY frames
+// later (at least 100 ms) and going on polling.
+// Other ROMs (nestest and the like) run until their picture has not changed for --stable-frames frames and are judged
+// by the hash of that picture: they pass if it matches the one in NAME.hash next to NAME.nes (16 hex digits, as
+// printed, from a known good run), and fail otherwise, also when there is no such file, so that a ROM that settles on
+// an error screen or a blank one doesn't pass. Either kind times out after --max-frames frames.
+//
+// The CPU does not implement the whole instruction set yet (no STA, JSR, JMP, LDY/STY, logic operations, shifts or
+// compares), so blargg's test ROMs and nestest stop at the first such instruction and are reported as ERROR for now.
+//
+// With --perf, each ROM's run is measured with hardware performance counters (see perf_counters.h), reported per frame
+// and per emulated CPU cycle under it. Jobs running side by side share caches, so compare these with --jobs 1.
+//
+// Exits with 1 if any ROM failed, timed out or could not be run.
+//
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "cpu/cpu.h"
+#include "ppu.h"
+#include "load.h"
+#include "emu.h"
+#include "clock.h"
+#include "io.h"
+#include "perf_counters.h"
+#include "exit_codes.h"
+
+
+#define DEFAULT_MAX_FRAMES 3600    // One emulated minute
+#define DEFAULT_STABLE_FRAMES 300
+
+#define TEST_STATUS_ADDR 0x6000
+#define TEST_SIGNATURE_ADDR 0x6001
+#define TEST_TEXT_ADDR 0x6004
+#define TEST_TEXT_SIZE 1024
+#define TEST_STATUS_RUNNING 0x80
+#define TEST_STATUS_RESET 0x81
+#define TEST_RESET_DELAY 6  // frames, 100 ms
+
+static const uint8_t test_signature[3] = { 0xDE, 0xB0, 0x61 };
+
+enum test_outcome
+{
+    TEST_PASS,
+    TEST_FAIL,
+    TEST_STABLE,     /// No result protocol; the picture stopped changing. The farm turns it into PASS or FAIL.
+    TEST_TIMEOUT,
+    TEST_ERROR,      /// Could not be loaded, reached an unimplemented opcode, or the run crashed
+};
+
+static const char* const test_outcome_names[] = {
+    [TEST_PASS] = "PASS",
+    [TEST_FAIL] = "FAIL",
+    [TEST_STABLE] = "STABLE",
+    [TEST_TIMEOUT] = "TIMEOUT",
+    [TEST_ERROR] = "ERROR",
+};
+
+/// Sent from a test process to the farm through a pipe
+struct test_result
+{
+    enum test_outcome outcome;
+    uint8_t code;          /// Result code from 0x6000
+    uint64_t frames;
+    uint64_t cpu_cycles;
+    uint64_t elapsed_ns;
+    uint64_t frame_hash;   /// Hash of the last drawn picture
+    bool picture;          /// Judged by frame_hash rather than by the result protocol
+    struct perf_counts perf;
+    char text[TEST_TEXT_SIZE];
+};
+
+struct test
+{
+    char* path;
+    pid_t pid;
+    int pipe_fd;
+    struct test_result result;
+};
+
+static uint64_t max_frames = DEFAULT_MAX_FRAMES;
+static uint64_t stable_frames = DEFAULT_STABLE_FRAMES;
+static bool perf = false;
+
+static struct test* tests = NULL;
+static size_t num_tests = 0;
+static size_t tests_capacity = 0;
+
+
+static int compare_tests(const void* a, const void* b)
+{
+    return strcmp(((const struct test*) a)->path, ((const struct test*) b)->path);
+}
+
+static void find_roms(const char* dir_path)
+{
+    DIR* dir = opendir(dir_path);
+    if (dir == NULL)
+    {
+        fprintf(stderr, "Could not open directory: %s", dir_path);
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+        size_t length = strlen(dir_path) + 1 + strlen(entry->d_name) + 1;
+        char* path = malloc(length);
+        snprintf(path, length, "%s/%s", dir_path, entry->d_name);
+
+        struct stat info;
+        if (stat(path, &info) == 0 && S_ISDIR(info.st_mode))
+        {
+            find_roms(path);
+            free(path);
+            continue;
+        }
+        size_t name_length = strlen(entry->d_name);
+        if (name_length < 4 || strcmp(entry->d_name + name_length - 4, ".nes") != 0)
+        {
+            free(path);
+            continue;
+        }
+
+        if (num_tests == tests_capacity)
+        {
+            tests_capacity = tests_capacity == 0 ? 64 : tests_capacity * 2;
+            tests = realloc(tests, tests_capacity * sizeof(struct test));
+            if (tests == NULL)
+            {
+                fprintf(stderr, "Out of memory for %zu test ROMs", tests_capacity);
+                exit(ERROR_CODE__OH_NO);
+            }
+        }
+        tests[num_tests++] = (struct test) { .path = path, .pid = 0, .pipe_fd = -1 };
+    }
+    closedir(dir);
+}
+
+
+static uint64_t frame_hash()
+{
+    uint64_t hash = 0;
+    for (size_t y = 0; y < FRAME_HEIGHT; ++y)
+    {
+        hash = (hash ^ ppu_row_hashes[y]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+static bool has_signature()
+{
+    for (size_t i = 0; i < sizeof(test_signature); ++i)
+    {
+        if (cpu_dma_read(TEST_SIGNATURE_ADDR + i) != test_signature[i])
+            return false;
+    }
+    return true;
+}
+
+static void read_text(char* text)
+{
+    size_t i = 0;
+    for (; i < TEST_TEXT_SIZE - 1; ++i)
+    {
+        text[i] = (char) cpu_dma_read(TEST_TEXT_ADDR + i);
+        if (text[i] == '\0')
+            break;
+    }
+    text[i] = '\0';
+}
+
+/**
+ * Runs one ROM to completion. Called in the test process, which has the core to itself.
+ */
+static void run_test(const char* path, struct test_result* result)
+{
+    struct nes_file nes_file = open_file(path);
+    if (!load_file_supported(&nes_file))
+    {
+        result->outcome = TEST_ERROR;
+        snprintf(result->text, sizeof(result->text), "mapper %d is not implemented", nes_file.mapper_idx);
+        return;
+    }
+    load_file(&nes_file);
+    cpu_reset();
+
+    struct perf_counters counters;
+    bool counting = perf && perf_counters_open(&counters);
+    if (counting)
+        perf_counters_start(&counters);
+    uint64_t start_ns = clock_now_ns();
+    uint64_t last_hash = 0;
+    uint64_t unchanged = 0;
+    uint64_t reset_frame = 0;    // when to press reset; 0 while none is due
+    bool reset_pressed = false;  // the 0x81 still in 0x6000 was answered already
+    result->outcome = TEST_TIMEOUT;
+    while (result->frames < max_frames && io_poll_input())
+    {
+        if (!emu_run_frame())
+        {
+            result->outcome = TEST_ERROR;
+            snprintf(result->text, sizeof(result->text), "unimplemented opcode $%02X at $%04X", cpu_ir,
+                     (uint16_t) (cpu_registers.pc - 1));
+            break;
+        }
+        result->frames++;
+
+        if (has_signature())
+        {
+            // The result comes from memory, so stop drawing frames
+            ppu_set_no_render(true);
+            uint8_t status = cpu_dma_read(TEST_STATUS_ADDR);
+            if (status == TEST_STATUS_RESET)
+            {
+                if (reset_pressed)
+                    continue;
+                if (reset_frame == 0)
+                    reset_frame = result->frames + TEST_RESET_DELAY;
+                if (result->frames >= reset_frame)
+                {
+                    cpu_reset();
+                    reset_frame = 0;
+                    reset_pressed = true;
+                }
+                continue;
+            }
+            reset_pressed = false;
+            if (status == TEST_STATUS_RUNNING)
+                continue;
+            read_text(result->text);
+            result->code = status;
+            result->outcome = status == 0 ? TEST_PASS : TEST_FAIL;
+            break;
+        }
+
+        result->frame_hash = frame_hash();
+        unchanged = result->frame_hash == last_hash ? unchanged + 1 : 0;
+        last_hash = result->frame_hash;
+        if (unchanged == stable_frames)
+        {
+            result->outcome = TEST_STABLE;
+            break;
+        }
+    }
+    result->elapsed_ns = clock_now_ns() - start_ns;
+    if (counting)
+    {
+        perf_counters_stop(&counters, &result->perf);
+        perf_counters_close(&counters);
+    }
+    result->cpu_cycles = clock_cpu_cycles;
+    nes_file_free(&nes_file);
+}
+
+
+static void start_test(struct test* test)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        fprintf(stderr, "Could not create pipe");
+        exit(ERROR_CODE__OH_NO);
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        fprintf(stderr, "Could not fork");
+        exit(ERROR_CODE__OH_NO);
+    }
+    if (pid == 0)
+    {
+        close(fds[0]);
+        static struct test_result result;
+        run_test(test->path, &result);
+        // Fits in the pipe buffer, so this doesn't wait for the farm
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? 0 : 1);
+    }
+    close(fds[1]);
+    test->pid = pid;
+    test->pipe_fd = fds[0];
+}
+
+/**
+ * Judges a ROM whose picture stopped changing by the expected hash of that picture, from the file next to it.
+ */
+static void judge_picture(struct test* test)
+{
+    struct test_result* result = &test->result;
+    result->picture = true;
+
+    char hash_path[PATH_MAX];
+    int name_length = (int) strlen(test->path) - 4;  // without .nes
+    snprintf(hash_path, sizeof(hash_path), "%.*s.hash", name_length, test->path);
+    unsigned long long expected;
+    FILE* file = fopen(hash_path, "r");
+    bool known = file != NULL && fscanf(file, "%llx", &expected) == 1;
+    if (file != NULL)
+        fclose(file);
+
+    if (known && expected == result->frame_hash)
+    {
+        result->outcome = TEST_PASS;
+        return;
+    }
+    result->outcome = TEST_FAIL;
+    if (known)
+        snprintf(result->text, sizeof(result->text), "picture differs from the expected %016llx", expected);
+    else
+        snprintf(result->text, sizeof(result->text), "no .hash file; if this picture is right, put %016llx in one",
+                 (unsigned long long) result->frame_hash);
+}
+
+static void finish_test(struct test* test, int status)
+{
+    ssize_t got = read(test->pipe_fd, &test->result, sizeof(test->result));
+    close(test->pipe_fd);
+    if (got == sizeof(test->result))
+    {
+        if (test->result.outcome == TEST_STABLE)
+            judge_picture(test);
+        return;
+    }
+
+    memset(&test->result, 0, sizeof(test->result));
+    test->result.outcome = TEST_ERROR;
+    if (WIFSIGNALED(status))
+        snprintf(test->result.text, sizeof(test->result.text), "crashed with signal %d", WTERMSIG(status));
+    else
+        snprintf(test->result.text, sizeof(test->result.text), "exited with code %d", (int8_t) WEXITSTATUS(status));
+}
+
+static void print_result(const struct test* test)
+{
+    const struct test_result* result = &test->result;
+    double mcycles_per_s = result->elapsed_ns != 0 ? result->cpu_cycles * 1e3 / result->elapsed_ns : 0;
+    printf("%-7s %6llu frames %8.2f Mcycles/s  %s", test_outcome_names[result->outcome],
+           (unsigned long long) result->frames, mcycles_per_s, test->path);
+    if (result->picture)
+        printf("  [%016llx]", (unsigned long long) result->frame_hash);
+    else if (result->outcome == TEST_FAIL)
+        printf("  [result %u]", result->code);
+    printf("\n");
+    if (result->perf.available != 0)
+        perf_counts_print(stdout, &result->perf, result->frames, result->cpu_cycles, "        ");
+    if (result->outcome == TEST_PASS || result->text[0] == '\0')
+        return;
+
+    // The result text, indented under the ROM
+    bool line_start = true;
+    for (const char* c = result->text; *c != '\0'; ++c)
+    {
+        if (line_start && *c != '\n')
+            printf("        ");
+        putchar(*c);
+        line_start = *c == '\n';
+    }
+    if (!line_start)
+        printf("\n");
+}
+
+
+int main(int argc, char** argv)
+{
+    const char* dir_path = NULL;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+            jobs = strtol(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--max-frames") == 0 && i + 1 < argc)
+            max_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--stable-frames") == 0 && i + 1 < argc)
+            stable_frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--perf") == 0)
+            perf = true;
+        else
+            dir_path = argv[i];
+    }
+    if (dir_path == NULL)
+    {
+        fprintf(stderr, "Usage: nes_testfarm DIR [--jobs N] [--max-frames N] [--stable-frames N] [--perf]\n"
+                        "ROMs without the $6000 result protocol pass only if their final picture matches NAME.hash.\n"
+                        "The CPU lacks STA, JSR, JMP, LDY/STY, logic ops, shifts and compares, so blargg's test ROMs\n"
+                        "and nestest end in ERROR for now.\n");
+        exit(ERROR_CODE__INVALID_FILE);
+    }
+    if (jobs < 1)
+        jobs = 1;
+
+    // Each test process opens its own counters; find out once here whether there will be any
+    if (perf)
+    {
+        struct perf_counters counters;
+        if (perf_counters_open(&counters))
+            perf_counters_close(&counters);
+        else
+            printf("perf counters unavailable, %s\n\n", perf_counters_error(&counters));
+    }
+
+    find_roms(dir_path);
+    qsort(tests, num_tests, sizeof(struct test), compare_tests);
+
+    uint64_t start_ns = clock_now_ns();
+    size_t next = 0;
+    size_t running = 0;
+    while (next < num_tests || running != 0)
+    {
+        if (next < num_tests && running < (size_t) jobs)
+        {
+            start_test(&tests[next++]);
+            running++;
+            continue;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            break;
+        for (size_t i = 0; i < next; ++i)
+        {
+            if (tests[i].pid == pid)
+            {
+                finish_test(&tests[i], status);
+                tests[i].pid = 0;
+                running--;
+                break;
+            }
+        }
+    }
+    uint64_t elapsed_ns = clock_now_ns() - start_ns;
+
+    size_t counts[TEST_ERROR + 1] = { 0 };
+    for (size_t i = 0; i < num_tests; ++i)
+    {
+        print_result(&tests[i]);
+        counts[tests[i].result.outcome]++;
+        free(tests[i].path);
+    }
+    free(tests);
+
+    printf("\n%zu ROMs in %.2f s with %ld jobs:", num_tests, elapsed_ns / 1e9, jobs);
+    for (enum test_outcome outcome = TEST_PASS; outcome <= TEST_ERROR; ++outcome)
+    {
+        if (counts[outcome] != 0)
+            printf(" %zu %s", counts[outcome], test_outcome_names[outcome]);
+    }
+    printf("\n");
+
+    bool ok = counts[TEST_FAIL] == 0 && counts[TEST_TIMEOUT] == 0 && counts[TEST_ERROR] == 0;
+    return ok ? 0 : 1;
+}